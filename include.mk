@@ -2,6 +2,11 @@ CC := /home/liam/bin/cross/bin/i686-elf-gcc
 AS := nasm
 
 CONFIG ?= opt
+SCHED ?= fair
+HZ ?= 100
+NO_HZ ?= 1
+NR_CPUS ?= 8
+LOCK_STAT ?= 0
 
 ROOT := $(abspath $(dir $(lastword $(MAKEFILE_LIST))))
 SRCDIR := $(ROOT)/src
@@ -22,7 +27,9 @@ OBJFILES = $(addprefix $(OBJDIR)/, $(notdir $(OBJECTS)))
 
 INCLUDE := -I$(INCDIR)
 
-CFLAGS_COMMON := -std=gnu99 -ffreestanding -Wall -Wextra -Werror $(INCLUDE)
+CFLAGS_COMMON := -std=gnu99 -ffreestanding -Wall -Wextra -Werror $(INCLUDE) \
+    -DCONFIG_SCHED=sched_$(SCHED) -DCONFIG_HZ=$(HZ) -DCONFIG_NO_HZ=$(NO_HZ) \
+    -DCONFIG_NR_CPUS=$(NR_CPUS) -DCONFIG_LOCK_STAT=$(LOCK_STAT)
 CFLAGS_opt := $(CFLAGS_COMMON) -O2
 CFLAGS_dbg := $(CFLAGS_COMMON) -g
 LDFLAGS_COMMON := -T $(ROOT)/link.ld -ffreestanding -nostdlib $(INCLUDE)
@@ -0,0 +1,74 @@
+	;; trampoline.s - real mode startup code for the other processors
+        ;; The boot CPU copies this below 1MB, at TRAMPOLINE_BASE, fills in
+        ;; trampoline_params and sends the processor a startup IPI. The
+        ;; processor starts here in real mode with CS:IP at TRAMPOLINE_BASE:0,
+        ;; switches to protected mode and paging with the boot CPU's control
+        ;; registers and its own page directory, and jumps to the kernel.
+        ;;
+        ;; Everything here runs from the copy, so addresses are worked out
+        ;; relative to trampoline_start.
+[BITS 16]
+
+TRAMPOLINE_BASE equ 0x8000
+
+        [GLOBAL trampoline_start]
+        [GLOBAL trampoline_params]
+        [GLOBAL trampoline_end]
+
+section .text
+trampoline_start:
+        cli
+        cld
+
+        mov ax, cs
+        mov ds, ax
+
+        lgdt [gdt_pointer - trampoline_start]
+
+        mov eax, cr0
+        or  eax, 1
+        mov cr0, eax
+
+        jmp dword 0x08:(protected - trampoline_start + TRAMPOLINE_BASE)
+
+[BITS 32]
+protected:
+        mov ax, 0x10
+        mov ds, ax
+        mov es, ax
+        mov fs, ax
+        mov gs, ax
+        mov ss, ax
+
+        ;; The page directory maps this page where it is, so we carry on
+        ;; from here once paging is on
+        mov eax, [params_cr3 - trampoline_start + TRAMPOLINE_BASE]
+        mov cr3, eax
+
+        mov eax, [params_cr0 - trampoline_start + TRAMPOLINE_BASE]
+        mov cr0, eax
+
+        mov esp, [params_stack - trampoline_start + TRAMPOLINE_BASE]
+
+        push dword [params_cpu - trampoline_start + TRAMPOLINE_BASE]
+        push 0                  ; entry never returns
+        jmp [params_entry - trampoline_start + TRAMPOLINE_BASE]
+
+align 8
+gdt:
+        dq 0
+        dq 0x00CF9A000000FFFF   ; flat code
+        dq 0x00CF92000000FFFF   ; flat data
+gdt_pointer:
+        dw gdt_pointer - gdt - 1
+        dd gdt - trampoline_start + TRAMPOLINE_BASE
+
+        ;; struct trampoline_params in smp.c
+align 4
+trampoline_params:
+params_cr0:     dd 0
+params_cr3:     dd 0
+params_stack:   dd 0
+params_entry:   dd 0
+params_cpu:     dd 0
+trampoline_end:
@@ -1,8 +1,10 @@
 #include "bits.h"
 
+#include "cpu.h"
 #include "ldsymbol.h"
 #include "printf.h"
 
+#include "device/apic.h"
 #include "device/descriptor_tables.h"
 #include "device/interrupt.h"
 #include "device/port.h"
@@ -78,7 +80,8 @@ struct tss {
     uint16_t iopb_offset;
 };
 
-static volatile struct tss tss;
+/* One for each CPU, so each has its own kernel stack to take interrupts on */
+static volatile struct tss tss[NR_CPUS];
 
 extern void gdt_flush(uint32_t ptr);
 extern void idt_flush(uint32_t ptr);
@@ -141,11 +144,17 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void irq17();
+extern void irq18();
 extern void isr128();
 
 extern ldsymbol ld_tss_stack;
 
-struct gdt_entry gdt_entries[6];
+#define GDT_TSS 5
+#define GDT_ENTRIES (GDT_TSS + NR_CPUS)
+
+struct gdt_entry gdt_entries[GDT_ENTRIES];
 struct idt_entry idt_entries[256];
 struct gdt_ptr gdt_ptr;
 struct idt_ptr idt_ptr;
@@ -177,8 +186,9 @@ static void load_task_register(uint16_t selector)
  *  - TSS descriptor - must hold the address of the task state segment
  *        for the processor. The stack pointer is reloaded from the
  *        ss0:esp0 fields in the TSS on task switches (int 0x80).
- *        In our implementation this is gate 5, descriptor 0x28 - however,
- *        this particular placement is NOT required.
+ *        In our implementation these are gates 5 onwards, one per CPU,
+ *        starting at descriptor 0x28 (TSS_SELECTOR) - however, this
+ *        particular placement is NOT required.
  *
  * The above segments are mandated by Intel in order to transfer control
  *  from CPL 3 to CPL 0 (and back again). Other than that, we don't use
@@ -188,22 +198,25 @@ static void gdt_init()
 {
     puts("Initializing GDT...\n");
 
-    gdt_ptr.limit = (sizeof(struct gdt_entry) * 6) - 1;
+    gdt_ptr.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
     gdt_ptr.base = (uint32_t)&gdt_entries;
     gdt_set_gate(0, 0, 0, 0);
     gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A); // CS
     gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92); // DS
     gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA); // userland CS
     gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2); // userland DS
-        
-    gdt_set_gate(5, (uint32_t)&tss, sizeof(tss), 0x89);
+
+    for (uint32_t cpu = 0; cpu < NR_CPUS; ++cpu) {
+        gdt_set_gate(GDT_TSS + cpu, (uint32_t)&tss[cpu],
+                     sizeof(struct tss), 0x89);
+        tss[cpu].ss0 = 0x10;
+        tss[cpu].iopb_offset = sizeof(struct tss);
+    }
 
     gdt_flush((uint32_t)&gdt_ptr);
 
-    tss.ss0 = 0x10;
-    tss.esp0 = (uint32_t)ld_tss_stack + 4092;
-    tss.iopb_offset = sizeof(tss);
-    load_task_register(0x28);
+    tss[0].esp0 = (uint32_t)ld_tss_stack + 4092;
+    load_task_register(TSS_SELECTOR);
 }
 
 /**
@@ -271,6 +284,10 @@ static void idt_init()
     idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
 
+    idt_set_gate(APIC_TIMER_INTERRUPT, (uint32_t)irq16, 0x08, 0x8E);
+    idt_set_gate(RESCHEDULE_INTERRUPT, (uint32_t)irq17, 0x08, 0x8E);
+    idt_set_gate(SPURIOUS_INTERRUPT, (uint32_t)irq18, 0x08, 0x8E);
+
     idt_set_gate(0x80, (uint32_t)isr128, 0x0B, 0xEE);
 
     idt_flush((uint32_t)&idt_ptr);
@@ -340,6 +357,16 @@ void flush_idt()
     idt_flush((uint32_t)&idt_ptr);
 }
 
+/**
+ * Load the boot CPU's tables on another CPU, along with its own TSS
+ */
+void load_descriptor_tables(uint32_t cpu)
+{
+    gdt_flush((uint32_t)&gdt_ptr);
+    idt_flush((uint32_t)&idt_ptr);
+    load_task_register(TSS_SELECTOR + cpu * sizeof(struct gdt_entry));
+}
+
 void enable_irq(uint8_t irq)
 {
     if (irq < 8) {
@@ -370,5 +397,5 @@ void disable_irq(uint8_t irq)
 
 void set_esp0(uint32_t new)
 {
-    tss.esp0 = new;
+    tss[cpu_id()].esp0 = new;
 }
@@ -0,0 +1,171 @@
+#include "device/apic.h"
+
+#include "cpu.h"
+#include "errno.h"
+#include "printf.h"
+
+#include "device/clock.h"
+#include "device/timer.h"
+#include "memory/pmm.h"
+#include "memory/vmalloc.h"
+
+/**
+ * The local APIC: each CPU's own interrupt controller. CPUs interrupt each
+ *   other through it, and its timer gives every CPU but the boot one its
+ *   tick. Device interrupts still come from the PICs, through the boot
+ *   CPU's LINT0 pin (the firmware's "virtual wire" mode).
+ *
+ * Every CPU's APIC is at the same physical address, and each CPU sees its
+ *   own there.
+ */
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define SVR_ENABLE (1 << 8)
+
+#define LVT_MASKED (1 << 16)
+#define LVT_NMI (4 << 8)
+#define LVT_EXTINT (7 << 8)
+#define LVT_TIMER_PERIODIC (1 << 17)
+
+#define TIMER_DIVIDE_16 0x3
+
+#define ICR_FIXED (0 << 8)
+#define ICR_INIT (5 << 8)
+#define ICR_STARTUP (6 << 8)
+#define ICR_PENDING (1 << 12)
+#define ICR_ASSERT (1 << 14)
+
+/* How long to count the timer for against the TSC */
+#define CALIBRATE_US 10000
+
+/* INIT-SIPI-SIPI timing, from the Intel MP spec */
+#define INIT_DELAY_US 10000
+#define STARTUP_DELAY_US 200
+
+static volatile uint32_t *lapic;
+
+/* Timer counts per tick */
+static uint32_t timer_count;
+
+static uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+}
+
+/**
+ * Count the timer's input clock against the TSC, for ticking at TIMER_HZ
+ */
+static void calibrate_timer(void)
+{
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+
+    udelay(CALIBRATE_US);
+
+    uint32_t counts = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    timer_count = counts / (CALIBRATE_US / 1000) * 1000 / TIMER_HZ;
+}
+
+/**
+ * Map the local APICs' registers, on the boot CPU
+ */
+int init_lapic(uint32_t physical)
+{
+    lapic = ioremap(physical, PAGE_SIZE);
+    if (!lapic) {
+        return -ENOMEM;
+    }
+
+    calibrate_timer();
+    printf("local APIC at %x, timer %u counts per tick\n",
+           physical, timer_count);
+
+    return 0;
+}
+
+/**
+ * Enable this CPU's APIC. Only the boot CPU takes the PICs' interrupts and
+ *   NMIs; the rest only hear from the other CPUs and their own timer.
+ */
+void lapic_enable(bool boot)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | SPURIOUS_INTERRUPT);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, boot ? LVT_EXTINT : LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, boot ? LVT_NMI : LVT_MASKED);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/**
+ * Tick this CPU periodically at TIMER_HZ
+ */
+void lapic_start_timer(void)
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_INTERRUPT | LVT_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_count);
+}
+
+static void send_icr(uint32_t apic_id, uint32_t command)
+{
+    uint32_t flags = irq_save();
+
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector)
+{
+    send_icr(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+/**
+ * Start another CPU running the real mode code at start, which must be
+ *   page aligned and below 1MB
+ */
+void lapic_start_ap(uint32_t apic_id, uint32_t start)
+{
+    send_icr(apic_id, ICR_INIT | ICR_ASSERT);
+    udelay(INIT_DELAY_US);
+
+    for (int i = 0; i < 2; ++i) {
+        send_icr(apic_id, ICR_STARTUP | (start >> 12));
+        udelay(STARTUP_DELAY_US);
+    }
+}
@@ -10,6 +10,7 @@
 #include "device/interrupt.h"
 #include "device/pci.h"
 #include "device/port.h"
+#include "memory/dma-pool.h"
 #include "memory/kheap.h"
 #include "memory/memory.h"
 #include "memory/vmm.h"
@@ -99,6 +100,7 @@
 #define ATA_BMR_PADDR 0x4
 
 #define ATA_PRDT_SIZE 256
+#define ATA_SECTOR_SIZE 256
 
 #define ATA_PRDT_LAST (1 << 15)
 
@@ -358,10 +360,15 @@ static void print_drives(ata_bus_t *bus, const char *msg)
     }
 }
 
+static struct dma_pool *prdt_pool;
+static struct dma_pool *sector_pool;
+
 static void init_busmaster(ata_bus_t *bus)
 {
-    bus->prdt = kzalloc(MEM_DMA, ATA_PRDT_SIZE);
-    bus->prdt_phys = get_physical((uint32_t)bus->prdt);
+    bus->prdt = dma_pool_zalloc(prdt_pool, &bus->prdt_phys);
+    if (!bus->prdt) {
+        PANIC("Unable to allocate DMA memory for the PRDT!");
+    }
 
     printf("Initialized busmaster with PRDT virt %x phys %x\n", bus->prdt, bus->prdt_phys);
 
@@ -533,14 +540,13 @@ static void write_dma_sectors(const uint64_t lba, ata_bus_t *bus)
     transfer_dma_sectors(lba, bus, ATA_CMD_WRITE_DMA);
 }
 
-static bool irq_primary = false;
-static bool irq_secondary = false;
-
-static void ata_irq(ata_bus_t *bus, const char *msg)
+static void report_ata_irq(struct work *work)
 {
-    printf("ATA IRQ recieved: %s\n", msg);
+    ata_bus_t *bus = WORK_ENTRY(work, ata_bus_t, irq_work);
+    uint8_t status = bus->irq_status;
+
+    printf("ATA IRQ recieved: %s\n", bus->name);
 
-    uint8_t status = inb(bus->port_bmide + ATA_BMR_STAT);
     if (!TST_BITS(status, ATA_BMRSTAT_DSKIRQ)) {
         printf(" IRQ was from device other than ATA drive!\n");
     }
@@ -549,28 +555,35 @@ static void ata_irq(ata_bus_t *bus, const char *msg)
     }
 }
 
-static void ata_primary_irq(registers_t  __unused *regs)
+/**
+ * Wake whoever's waiting on the bus, leaving the printing to the workqueue
+ */
+static void ata_irq(ata_bus_t *bus)
 {
-    ata_irq(&buses[ATA_BUS_PRI], "primary");
-    irq_primary = 1;
+    bus->irq_status = inb(bus->port_bmide + ATA_BMR_STAT);
+    queue_work(&bus->irq_work);
+
+    bus->irq_done = true;
+    wake_up(&bus->irq_wait);
 }
 
-static void ata_secondary_irq(registers_t __unused *regs)
+static void ata_primary_irq(registers_t  __unused *regs)
 {
-    ata_irq(&buses[ATA_BUS_SEC], "secondary");
-    irq_secondary = 1;
+    ata_irq(&buses[ATA_BUS_PRI]);
 }
 
-static void wait_ata_primary()
+static void ata_secondary_irq(registers_t __unused *regs)
 {
-    while (!irq_primary) { /* wait */ }
-    irq_primary = 0;
+    ata_irq(&buses[ATA_BUS_SEC]);
 }
 
-static void wait_ata_secondary()
+/**
+ * Sleep until the bus's IRQ says the command we sent it is done
+ */
+static void wait_ata_irq(ata_bus_t *bus)
 {
-    while (!irq_secondary) { /* wait */ printf("waiting for secondary irq...\n");}
-    irq_secondary = 0;
+    wait_event(bus->irq_wait, bus->irq_done);
+    bus->irq_done = false;
 }
 
 static void read_ata_sectors(uint32_t buf, const uint64_t lba,
@@ -586,12 +599,7 @@ static void read_ata_sectors(uint32_t buf, const uint64_t lba,
 
     read_dma_sectors(lba, bus);
 
-    if (bus == &buses[ATA_BUS_PRI]) {
-        wait_ata_primary();
-    }
-    else {
-        wait_ata_secondary();
-    }
+    wait_ata_irq(bus);
 }
 
 static void write_ata_sectors(uint32_t buf, const uint64_t lba,
@@ -607,12 +615,7 @@ static void write_ata_sectors(uint32_t buf, const uint64_t lba,
 
     write_dma_sectors(lba, bus);
 
-    if (bus == &buses[ATA_BUS_PRI]) {
-        wait_ata_primary();
-    }
-    else {
-        wait_ata_secondary();
-    }
+    wait_ata_irq(bus);
 }
 
 void ata_read_sectors(uint32_t buf, const uint64_t lba,
@@ -647,7 +650,24 @@ void init_ata()
 {
     printf("Initializing ATA drives...\n");
 
+    // PRDs must be dword aligned and the table can't cross a 64K boundary,
+    //   which the pool guarantees for anything that fits in a page
+    prdt_pool = dma_pool_create("ata-prdt", ATA_PRDT_SIZE, 4);
+    sector_pool = dma_pool_create("ata-sector", ATA_SECTOR_SIZE, 2);
+    if (!prdt_pool || !sector_pool) {
+        PANIC("Unable to create ATA DMA pools!");
+    }
+
     init_drives();
+
+    buses[ATA_BUS_PRI].name = "primary";
+    buses[ATA_BUS_SEC].name = "secondary";
+
+    for (uint32_t i = 0; i < PCI_IDE_NBUSES; ++i) {
+        wait_queue_init(&buses[i].irq_wait);
+        work_setup(&buses[i].irq_work, report_ata_irq);
+    }
+
     /* register_interrupt_handler(0x20, &ata_primary_irq); */
     /* register_interrupt_handler(0x21, &ata_primary_irq); */
     /* register_interrupt_handler(0x22, &ata_primary_irq); */
@@ -664,7 +684,8 @@ void init_ata()
     register_interrupt_handler(0x20 + buses[ATA_BUS_PRI].irq, &ata_primary_irq);
     register_interrupt_handler(0x20 + buses[ATA_BUS_SEC].irq, &ata_secondary_irq);
 
-    uint32_t *out = kmalloc(MEM_DMA, 256);
+    uint32_t out_phys;
+    uint32_t *out = dma_pool_alloc(sector_pool, &out_phys);
     if (!out) {
         PANIC("Unable to allocate contiguous DMA memory for test transfer!");
     }
@@ -675,19 +696,18 @@ void init_ata()
         out[i] = 0xDEADC0DE;
     }
     
-    uint32_t out_phys = get_physical((uint32_t)out);
     ata_write_sectors(out_phys, lba, 1, &buses[ATA_BUS_PRI], ATA_MASTER);
 
-    uint32_t *buf = kmalloc(MEM_DMA, 256);
-    if (!out) {
+    uint32_t phys;
+    uint32_t *buf = dma_pool_alloc(sector_pool, &phys);
+    if (!buf) {
         PANIC("Unable to allocate contiguous DMA memory for test transfer 2!");
     }
 
-    uint32_t phys = get_physical((uint32_t)buf);
     ata_read_sectors(phys, lba, 1, &buses[ATA_BUS_PRI], ATA_MASTER);
 
     printf("Read data from block 1:\n");
-    for (uint32_t i = 0; i < 256; ++i) {
+    for (uint32_t i = 0; i < ATA_SECTOR_SIZE / 4; ++i) {
         printf(" %x\n", buf[i]);
     }
 
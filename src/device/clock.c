@@ -0,0 +1,172 @@
+#include "device/clock.h"
+
+#include "cpu.h"
+#include "errno.h"
+#include "printf.h"
+
+#include "device/port.h"
+#include "device/timer.h"
+#include "memory/vmm.h"
+
+/**
+ * Timekeeping: a monotonic nanosecond clock, counted by the TSC from
+ *   init_clock().
+ *
+ * The TSC's rate is measured at boot against the PIT's channel 2, which
+ *   can be gated and polled without interrupts and doesn't disturb the
+ *   timer on channel 0. Cycles are converted to nanoseconds with a fixed
+ *   point multiply rather than a division: ns = cycles * mult >> CLOCK_SHIFT.
+ */
+#define CLOCK_SHIFT 24
+
+#define CALIBRATE_MS 10
+#define CALIBRATE_COUNT (PIT_HZ * CALIBRATE_MS / 1000)
+#define CALIBRATE_TRIES 3
+
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_CHANNEL2_ONESHOT 0xB0 // channel 2, low then high byte, mode 0
+
+#define SPEAKER_PORT 0x61
+#define SPEAKER_GATE 0x01   // channel 2 counts while set
+#define SPEAKER_ENABLE 0x02 // channel 2 drives the speaker while set
+#define SPEAKER_OUT 0x20    // channel 2's output
+
+uint32_t tsc_khz;
+
+static uint32_t mult;
+static uint64_t tsc_base;
+
+/**
+ * Divide a 64-bit number by a 32-bit one, without the 64-bit division
+ *   libgcc would otherwise be needed for
+ */
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t *rem)
+{
+    uint32_t high = n >> 32;
+    uint32_t q_high = high / d;
+    uint32_t q_low;
+    uint32_t r;
+
+    // The remainder of the high half is less than d, so this fits
+    asm ("divl %4"
+         : "=a"(q_low), "=d"(r)
+         : "a"((uint32_t)n), "d"(high % d), "rm"(d));
+
+    if (rem) {
+        *rem = r;
+    }
+
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+/**
+ * Count TSC cycles over CALIBRATE_MS of the PIT's channel 2
+ */
+static uint32_t measure_tsc(void)
+{
+    uint8_t speaker = inb(SPEAKER_PORT);
+    outb(SPEAKER_PORT, (speaker & ~SPEAKER_ENABLE) | SPEAKER_GATE);
+
+    outb(PIT_COMMAND, PIT_CHANNEL2_ONESHOT);
+    outb(PIT_CHANNEL2, CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, (CALIBRATE_COUNT >> 8) & 0xFF);
+
+    uint64_t start = rdtsc();
+    while (!(inb(SPEAKER_PORT) & SPEAKER_OUT)) {
+    }
+    uint64_t end = rdtsc();
+
+    outb(SPEAKER_PORT, speaker);
+    return end - start;
+}
+
+void init_clock(void)
+{
+    printf("Initializing clock...\n");
+
+    // Take the shortest measurement: anything else only adds cycles
+    uint32_t cycles = measure_tsc();
+    for (uint32_t i = 1; i < CALIBRATE_TRIES; ++i) {
+        uint32_t again = measure_tsc();
+        if (again < cycles) {
+            cycles = again;
+        }
+    }
+
+    tsc_khz = cycles / CALIBRATE_MS;
+    mult = div64_32((uint64_t)NSEC_PER_MSEC << CLOCK_SHIFT, tsc_khz, NULL);
+    tsc_base = rdtsc();
+
+    printf("TSC runs at %u kHz\n", tsc_khz);
+}
+
+uint64_t cycles_to_ns(uint64_t cycles)
+{
+    // Split so neither product overflows
+    uint64_t high = (cycles >> 32) * mult;
+    uint64_t low = (cycles & 0xFFFFFFFF) * mult;
+
+    return (high << (32 - CLOCK_SHIFT)) + (low >> CLOCK_SHIFT);
+}
+
+/**
+ * Spin for at least us microseconds
+ */
+void udelay(uint32_t us)
+{
+    uint64_t end = rdtsc() + div64_32((uint64_t)us * tsc_khz, 1000, NULL);
+
+    while (rdtsc() < end) {
+        cpu_relax();
+    }
+}
+
+/**
+ * Nanoseconds since the clock was initialised
+ */
+uint64_t clock_ns(void)
+{
+    return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/**
+ * Timer ticks to cover ns, rounded up, and capped at 2^30 so it's still
+ *   safe to compare with ticks
+ */
+uint32_t ns_to_ticks(uint64_t ns)
+{
+    uint32_t tick_ns = NSEC_PER_SEC / TIMER_HZ;
+    uint32_t rem;
+
+    if (ns >= (uint64_t)tick_ns << 30) {
+        return 1 << 30;
+    }
+
+    uint32_t n = div64_32(ns, tick_ns, &rem);
+    return rem ? n + 1 : n;
+}
+
+uint64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+void ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+    ts->tv_sec = div64_32(ns, NSEC_PER_SEC, &ts->tv_nsec);
+}
+
+int clock_gettime(int clock, struct timespec __user *ts)
+{
+    if (!check_user_ptr(ts)) {
+        return -EFAULT;
+    }
+
+    if (clock != CLOCK_MONOTONIC) {
+        return -EINVAL;
+    }
+
+    ns_to_timespec(clock_ns(), ts);
+    return 0;
+}
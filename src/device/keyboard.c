@@ -41,7 +41,7 @@ static void keyboard_handler(registers_t __unused *regs)
         /* printf("device/keyboard.handler: read key %c from keyboard\n", key); */
         ring_buffer_write(tty->kbd_in, &mods, sizeof(mods));
         ring_buffer_write(tty->kbd_in, &key, sizeof(scancode));
-        wake(tty->fg_pid);
+        wake_up(&tty->readers);
         /* printf("device/keyboard.handler: wrote ring buffer 2 bytes\n"); */
     }
 
@@ -0,0 +1,376 @@
+#include "device/mp.h"
+
+#include "compiler.h"
+#include "errno.h"
+#include "printf.h"
+#include "string.h"
+
+#include "device/apic.h"
+#include "memory/kheap.h"
+#include "memory/memory.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+/**
+ * Processor discovery. The ACPI MADT lists every processor's local APIC;
+ *   firmware without ACPI has the older Intel MP configuration table, which
+ *   lists them too. Each is found from a structure somewhere in the BIOS
+ *   areas below 1MB, identified by its signature and checksum.
+ *
+ * None of this memory is mapped, so it's all read through temporary
+ *   mappings.
+ */
+#define BDA_EBDA_SEGMENT 0x40E
+#define BDA_BASE_KB 0x413
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+#define RSDP_SIGNATURE "RSD PTR "
+#define MADT_SIGNATURE "APIC"
+#define ACPI_MAX_TABLE 0x10000
+
+#define MADT_LAPIC 0
+#define MADT_LAPIC_ENABLED (1 << 0)
+
+#define MPF_SIGNATURE "_MP_"
+#define MPC_SIGNATURE "PCMP"
+
+#define MPC_PROCESSOR 0
+#define MPC_PROCESSOR_ENABLED (1 << 0)
+#define MPC_ENTRY_SIZE 8 // every entry but a processor's
+
+struct rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem[6];
+    uint8_t revision;
+    uint32_t rsdt;
+} __packed;
+
+struct sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[6];
+    char oem_table[8];
+    uint32_t oem_revision;
+    uint32_t creator;
+    uint32_t creator_revision;
+} __packed;
+
+struct madt {
+    struct sdt_header header;
+    uint32_t lapic;
+    uint32_t flags;
+} __packed;
+
+struct madt_lapic {
+    uint8_t type;
+    uint8_t length;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __packed;
+
+struct mp_floating {
+    char signature[4];
+    uint32_t config;
+    uint8_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __packed;
+
+struct mp_table {
+    char signature[4];
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[8];
+    char product[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entries;
+    uint32_t lapic;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __packed;
+
+struct mp_processor {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __packed;
+
+static void read_physical(void *buf, uint32_t physical, uint32_t len)
+{
+    char *dest = buf;
+
+    while (len > 0) {
+        uint32_t offset = physical & (PAGE_SIZE - 1);
+        uint32_t chunk = len < PAGE_SIZE - offset ? len : PAGE_SIZE - offset;
+
+        uint32_t virtual = map_physical(physical);
+        memcpy(dest, (void *)virtual, chunk);
+        unmap_page(virtual);
+
+        dest += chunk;
+        physical += chunk;
+        len -= chunk;
+    }
+}
+
+static uint8_t checksum(const void *data, uint32_t len)
+{
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < len; ++i) {
+        sum += bytes[i];
+    }
+
+    return sum;
+}
+
+static uint32_t scan(uint32_t start, uint32_t end, const char *signature,
+                     uint32_t len)
+{
+    uint8_t buf[sizeof(struct rsdp)];
+
+    for (uint32_t physical = start; physical + len <= end; physical += 16) {
+        read_physical(buf, physical, len);
+
+        if (!memcmp(buf, signature, strlen(signature))
+            && !checksum(buf, len))
+        {
+            return physical;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find a structure in the first KB of the extended BIOS data area, the
+ *   last KB of base memory, or the BIOS ROM, as both specs allow
+ */
+static uint32_t find_bios_structure(const char *signature, uint32_t len)
+{
+    uint16_t segment = 0;
+    uint16_t base_kb = 0;
+
+    read_physical(&segment, BDA_EBDA_SEGMENT, sizeof(segment));
+    read_physical(&base_kb, BDA_BASE_KB, sizeof(base_kb));
+
+    uint32_t ebda = (uint32_t)segment << 4;
+    uint32_t base_end = (uint32_t)base_kb * 1024;
+
+    uint32_t found = 0;
+
+    if (ebda) {
+        found = scan(ebda, ebda + 1024, signature, len);
+    }
+
+    if (!found && base_end >= 1024) {
+        found = scan(base_end - 1024, base_end, signature, len);
+    }
+
+    if (!found) {
+        found = scan(BIOS_ROM_START, BIOS_ROM_END, signature, len);
+    }
+
+    return found;
+}
+
+static void add_cpu(struct mp_config *config, uint8_t apic_id)
+{
+    if (config->nr_cpus == NR_CPUS) {
+        printf("ignoring CPU with APIC id %u (NR_CPUS is %u)\n",
+               apic_id, NR_CPUS);
+        return;
+    }
+
+    config->apic_ids[config->nr_cpus++] = apic_id;
+}
+
+/**
+ * Read a whole ACPI table, checking its checksum. Returns NULL if it's bad.
+ */
+static struct sdt_header *read_table(uint32_t physical)
+{
+    struct sdt_header header;
+    read_physical(&header, physical, sizeof(header));
+
+    if (header.length < sizeof(header) || header.length > ACPI_MAX_TABLE) {
+        return NULL;
+    }
+
+    struct sdt_header *table = kmalloc(MEM_GEN, header.length);
+    if (!table) {
+        return NULL;
+    }
+
+    read_physical(table, physical, header.length);
+
+    if (checksum(table, header.length)) {
+        kfree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+static void parse_madt(struct madt *madt, struct mp_config *config)
+{
+    uint8_t *entry = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+
+    config->lapic = madt->lapic;
+
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        struct madt_lapic *lapic = (struct madt_lapic *)entry;
+
+        if (lapic->type == MADT_LAPIC && lapic->length >= sizeof(*lapic)
+            && (lapic->flags & MADT_LAPIC_ENABLED))
+        {
+            add_cpu(config, lapic->apic_id);
+        }
+
+        entry += lapic->length;
+    }
+}
+
+static int acpi_find_cpus(struct mp_config *config)
+{
+    uint32_t physical = find_bios_structure(RSDP_SIGNATURE,
+                                            sizeof(struct rsdp));
+    if (!physical) {
+        return -ENODEV;
+    }
+
+    struct rsdp rsdp;
+    read_physical(&rsdp, physical, sizeof(rsdp));
+
+    struct sdt_header *rsdt = read_table(rsdp.rsdt);
+    if (!rsdt) {
+        return -ENODEV;
+    }
+
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+    uint32_t ntables = (rsdt->length - sizeof(*rsdt)) / sizeof(*tables);
+    int err = -ENODEV;
+
+    for (uint32_t i = 0; i < ntables; ++i) {
+        struct sdt_header header;
+        read_physical(&header, tables[i], sizeof(header));
+
+        if (memcmp(header.signature, MADT_SIGNATURE, 4)) {
+            continue;
+        }
+
+        struct madt *madt = (struct madt *)read_table(tables[i]);
+        if (madt && madt->header.length >= sizeof(*madt)) {
+            parse_madt(madt, config);
+            err = 0;
+        }
+
+        kfree(madt);
+        break;
+    }
+
+    kfree(rsdt);
+    return err;
+}
+
+static int mptable_find_cpus(struct mp_config *config)
+{
+    uint32_t physical = find_bios_structure(MPF_SIGNATURE,
+                                            sizeof(struct mp_floating));
+    if (!physical) {
+        return -ENODEV;
+    }
+
+    struct mp_floating floating;
+    read_physical(&floating, physical, sizeof(floating));
+
+    // No table: one of the spec's default configurations, all of which
+    //   have two processors
+    if (floating.features[0] || !floating.config) {
+        config->lapic = LAPIC_DEFAULT_BASE;
+        add_cpu(config, 0);
+        add_cpu(config, 1);
+        return 0;
+    }
+
+    struct mp_table header;
+    read_physical(&header, floating.config, sizeof(header));
+
+    if (memcmp(header.signature, MPC_SIGNATURE, 4)
+        || header.length < sizeof(header))
+    {
+        return -ENODEV;
+    }
+
+    uint8_t *table = kmalloc(MEM_GEN, header.length);
+    if (!table) {
+        return -ENOMEM;
+    }
+
+    read_physical(table, floating.config, header.length);
+
+    if (checksum(table, header.length)) {
+        kfree(table);
+        return -ENODEV;
+    }
+
+    config->lapic = header.lapic;
+
+    uint8_t *entry = table + sizeof(header);
+    uint8_t *end = table + header.length;
+
+    for (uint32_t i = 0; i < header.entries && entry < end; ++i) {
+        if (*entry != MPC_PROCESSOR) {
+            entry += MPC_ENTRY_SIZE;
+            continue;
+        }
+
+        struct mp_processor *cpu = (struct mp_processor *)entry;
+        if (entry + sizeof(*cpu) <= end
+            && (cpu->flags & MPC_PROCESSOR_ENABLED))
+        {
+            add_cpu(config, cpu->apic_id);
+        }
+
+        entry += sizeof(*cpu);
+    }
+
+    kfree(table);
+    return 0;
+}
+
+/**
+ * Find the enabled processors, from the MADT if there is one or else the
+ *   MP table
+ */
+int mp_find_cpus(struct mp_config *config)
+{
+    memset(config, 0, sizeof(*config));
+
+    if (acpi_find_cpus(config) == 0 && config->nr_cpus > 0) {
+        return 0;
+    }
+
+    memset(config, 0, sizeof(*config));
+
+    if (mptable_find_cpus(config) == 0 && config->nr_cpus > 0) {
+        return 0;
+    }
+
+    return -ENODEV;
+}
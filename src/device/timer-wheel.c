@@ -0,0 +1,232 @@
+#include "device/timer.h"
+
+#include "cpu.h"
+
+/**
+ * Hierarchical timer wheel. Timers due in the next TVR_SIZE ticks hang off
+ *   tv1, one list per tick. Later ones go in one of TVN_LEVELS coarser
+ *   wheels of TVN_SIZE lists each, every level covering TVN_SIZE times the
+ *   span of the one below; together they cover every 32-bit expiry.
+ *
+ * Adding or cancelling a timer is a list insert or remove. Each time tv1
+ *   comes round, the next list of the level above is cascaded: its timers
+ *   are re-added, landing a level lower (and that level's own wrap cascades
+ *   the one above it in turn).
+ *
+ * A wheel's next is the next tick to run timers for; running it catches
+ *   next up to the time it's given, however far that's jumped. The
+ *   kernel's wheel runs off ticks, which jumps while the tick is stopped.
+ */
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+
+#define TVN_INDEX(time, level) \
+    (((time) >> (TVR_BITS + (level) * TVN_BITS)) & TVN_MASK)
+
+static struct timer_base timers;
+
+static void enqueue(struct timer_base *base, struct timer *timer)
+{
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - base->next;
+    struct list *vec;
+
+    if (time_before(expires, base->next)) {
+        // Already due: run it on the next tick
+        vec = &base->tv1[base->next & TVR_MASK];
+    }
+    else if (delta < TVR_SIZE) {
+        vec = &base->tv1[expires & TVR_MASK];
+    }
+    else {
+        int level = 0;
+        while (level < TVN_LEVELS - 1
+               && delta >= 1U << (TVR_BITS + (level + 1) * TVN_BITS))
+        {
+            ++level;
+        }
+
+        vec = &base->tvn[level][TVN_INDEX(expires, level)];
+    }
+
+    list_insert(vec->prev, &timer->node);
+}
+
+static void dequeue(struct timer *timer)
+{
+    list_remove(&timer->node);
+    timer->node.next = NULL;
+    --timer->base->nr_timers;
+}
+
+/**
+ * Re-add the timers on one list of a level, returning the list's index so
+ *   the caller knows whether this level wrapped too
+ */
+static uint32_t cascade(struct timer_base *base, int level, uint32_t index)
+{
+    struct list *vec = &base->tvn[level][index];
+
+    while (!list_empty(vec)) {
+        struct timer *timer = LIST_ENTRY(vec->next, struct timer, node);
+        list_remove(&timer->node);
+        enqueue(base, timer);
+    }
+
+    return index;
+}
+
+void timer_base_init(struct timer_base *base, uint32_t now)
+{
+    for (uint32_t i = 0; i < TVR_SIZE; ++i) {
+        list_init(&base->tv1[i]);
+    }
+
+    for (uint32_t level = 0; level < TVN_LEVELS; ++level) {
+        for (uint32_t i = 0; i < TVN_SIZE; ++i) {
+            list_init(&base->tvn[level][i]);
+        }
+    }
+
+    base->next = now;
+    base->nr_timers = 0;
+}
+
+/**
+ * (Re)arm a timer to run on tick expires of the given wheel
+ */
+void timer_base_add(struct timer_base *base, struct timer *timer,
+                    uint32_t expires)
+{
+    uint32_t flags = irq_save();
+
+    if (timer_pending(timer)) {
+        dequeue(timer);
+    }
+
+    timer->expires = expires;
+    timer->base = base;
+    ++base->nr_timers;
+    enqueue(base, timer);
+
+    irq_restore(flags);
+}
+
+/**
+ * Run every timer on a wheel that's expired by now
+ */
+void timer_base_run(struct timer_base *base, uint32_t now)
+{
+    uint32_t flags = irq_save();
+
+    while (!time_before(now, base->next)) {
+        uint32_t index = base->next & TVR_MASK;
+
+        if (!index) {
+            for (int level = 0; level < TVN_LEVELS; ++level) {
+                if (cascade(base, level, TVN_INDEX(base->next, level))) {
+                    break;
+                }
+            }
+        }
+
+        ++base->next;
+
+        struct list *vec = &base->tv1[index];
+        while (!list_empty(vec)) {
+            struct timer *timer = LIST_ENTRY(vec->next, struct timer, node);
+            dequeue(timer);
+            timer->fn(timer);
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Ticks from now until a wheel's next timer is due. Only tv1 is looked at:
+ *   if nothing's due there before it next wraps, the wrap, when the level
+ *   above cascades, is the next event.
+ */
+uint32_t timer_base_next_event(struct timer_base *base, uint32_t now)
+{
+    if (!base->nr_timers) {
+        return UINT32_MAX;
+    }
+
+    uint32_t tick = base->next;
+    while (list_empty(&base->tv1[tick & TVR_MASK])) {
+        if (!(++tick & TVR_MASK)) {
+            break;
+        }
+    }
+
+    return time_before(now, tick) ? tick - now : 0;
+}
+
+void timer_setup(struct timer *timer, void (*fn)(struct timer *timer))
+{
+    timer->node.next = NULL;
+    timer->expires = 0;
+    timer->base = NULL;
+    timer->fn = fn;
+}
+
+bool timer_pending(const struct timer *timer)
+{
+    return timer->node.next != NULL;
+}
+
+/**
+ * (Re)arm a timer to run on tick expires
+ */
+void timer_add(struct timer *timer, uint32_t expires)
+{
+    uint32_t flags = irq_save();
+
+    timer_base_add(&timers, timer, expires);
+
+    // A stopped tick may be set to come back later than this
+    if (timer_tick_stopped()) {
+        timer_stop_tick(time_before(ticks, expires) ? expires - ticks : 0);
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Cancel a timer, returning whether it was still pending
+ */
+bool timer_cancel(struct timer *timer)
+{
+    uint32_t flags = irq_save();
+    bool pending = timer_pending(timer);
+
+    if (pending) {
+        dequeue(timer);
+    }
+
+    irq_restore(flags);
+    return pending;
+}
+
+/**
+ * Run every timer that's expired, from the timer interrupt
+ */
+void run_timers(void)
+{
+    timer_base_run(&timers, ticks);
+}
+
+/**
+ * Ticks until the next timer is due, for stopping the tick
+ */
+uint32_t timer_next_event(void)
+{
+    return timer_base_next_event(&timers, ticks);
+}
+
+void init_timers(void)
+{
+    timer_base_init(&timers, ticks);
+}
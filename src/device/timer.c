@@ -1,20 +1,217 @@
 #include "device/timer.h"
 
+#include "device/clock.h"
 #include "device/interrupt.h"
 #include "device/port.h"
 #include "device/terminal.h"
 
+/**
+ * Timer ticks from the PIT (channel 0), either periodic at TIMER_HZ, or,
+ *   while the tick is stopped, one-shot for as long as nothing needs doing.
+ *
+ * While it's stopped, ticks is kept by the TSC clock instead: when the
+ *   tick stops, we note when the tick it was partway through started, and
+ *   on entry to every interrupt ticks is brought up to however many whole
+ *   ticks have gone by since, so it reads the same as if the tick had kept
+ *   going. One-shots are set for the start of a tick, worked out the same
+ *   way, rather than some number of counts from whenever they're set, so
+ *   they don't drift. The periodic tick restarts at the start of the next
+ *   tick, so the part of the current one that's already gone isn't lost.
+ */
+#define PIT_MAX_COUNT 0xFFFFU
+
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+
+#define PIT_LATCH 0x00
+#define PIT_ONESHOT 0x30  // channel 0, low then high byte, mode 0
+#define PIT_PERIODIC 0x34 // channel 0, low then high byte, mode 2
+
+#define TICK_NSEC (NSEC_PER_SEC / TIMER_HZ)
+#define TICK_USEC (1000000 / TIMER_HZ)
+
+/*
+ * The PIT and the TSC don't quite agree, so a one-shot for the start of a
+ *   tick can go off just before it by the TSC
+ */
+#define TICK_SLACK_NSEC (TICK_NSEC / 16)
+
 uint32_t ticks = 0;
 
-void init_timer(uint32_t frequency)
+static uint32_t divisor = PIT_HZ / TIMER_HZ; // counts per tick
+
+static bool stopped;
+static bool restarting; // going periodic at the next timer interrupt
+
+static bool armed;        // a one-shot is set...
+static uint64_t armed_ns; // ...to go off then, by the TSC clock
+
+/* While stopped, tick base_ticks started at base_ns by the TSC clock */
+static uint32_t base_ticks;
+static uint64_t base_ns;
+
+static void program(uint8_t mode, uint32_t count)
+{
+    outb(PIT_COMMAND, mode);
+    outb(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
+
+static uint32_t read_count(void)
+{
+    outb(PIT_COMMAND, PIT_LATCH);
+
+    uint8_t low = inb(PIT_CHANNEL0);
+    uint8_t high = inb(PIT_CHANNEL0);
+
+    return (high << 8) | low;
+}
+
+static uint32_t counts_to_us(uint32_t counts)
+{
+    return counts * TICK_USEC / divisor;
+}
+
+/**
+ * When a tick starts, by the TSC clock
+ */
+static uint64_t tick_start_ns(uint32_t tick)
+{
+    return base_ns + (uint64_t)(tick - base_ticks) * TICK_NSEC;
+}
+
+/**
+ * Bring ticks up to date from the TSC clock, treating anything within
+ *   slack of the next tick as having reached it. ticks never goes back.
+ */
+static void catch_up(uint32_t slack)
+{
+    uint64_t elapsed = clock_ns() + slack - base_ns;
+    uint32_t now = base_ticks + (uint32_t)div64_32(elapsed, TICK_NSEC, NULL);
+
+    if (time_before(ticks, now)) {
+        ticks = now;
+    }
+}
+
+/**
+ * Set the one-shot to go off at deadline by the TSC clock, or as near to
+ *   it as the PIT can count
+ */
+static void program_deadline(uint64_t deadline)
+{
+    uint64_t now = clock_ns();
+    uint64_t max_ns = (uint64_t)counts_to_us(PIT_MAX_COUNT) * 1000;
+    uint32_t count = 1;
+
+    if (deadline > now + max_ns) {
+        count = PIT_MAX_COUNT;
+        deadline = now + max_ns;
+    }
+    else if (deadline > now) {
+        // Round up, so it's not early
+        uint32_t us = ((uint32_t)(deadline - now) + 999) / 1000;
+        count = (us * divisor + TICK_USEC - 1) / TICK_USEC;
+        if (count > PIT_MAX_COUNT) {
+            count = PIT_MAX_COUNT;
+        }
+    }
+
+    program(PIT_ONESHOT, count);
+    armed = true;
+    armed_ns = deadline;
+}
+
+/**
+ * Bring ticks up to date on entry to an interrupt; timer is true for the
+ *   timer's own
+ */
+void timer_irq_enter(bool timer)
+{
+    if (!stopped) {
+        if (timer) {
+            ++ticks;
+        }
+        return;
+    }
+
+    if (!timer) {
+        catch_up(0);
+        return;
+    }
+
+    armed = false;
+    catch_up(TICK_SLACK_NSEC);
+
+    if (restarting) {
+        program(PIT_PERIODIC, divisor);
+        restarting = false;
+        stopped = false;
+    }
+}
+
+bool timer_tick_stopped(void)
 {
-    uint32_t divisor = 1193180 / frequency;
+    return stopped && !restarting;
+}
 
-    outb(0x43, 0x36);
+/**
+ * Stop the periodic tick, and have the timer interrupt when max_ticks more
+ *   have started, or as near as it can count to
+ */
+void timer_stop_tick(uint32_t max_ticks)
+{
+    if (stopped) {
+        catch_up(0);
+    }
+    else {
+        // Time the tick we're partway through from when it started
+        uint32_t count = read_count();
+        uint32_t into = count <= divisor ? divisor - count : 0;
 
-    uint8_t low = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
+        base_ticks = ticks;
+        base_ns = clock_ns() - counts_to_us(into) * 1000;
+    }
+
+    // Further than the PIT can count anyway, and safe to add to ticks
+    uint32_t max_pit_ticks = PIT_MAX_COUNT / divisor + 1;
+    if (max_ticks > max_pit_ticks) {
+        max_ticks = max_pit_ticks;
+    }
+
+    uint64_t deadline = tick_start_ns(ticks + max_ticks);
+
+    restarting = false;
+    stopped = true;
+
+    // Leave a sooner one-shot that's already set
+    if (armed && armed_ns <= deadline) {
+        return;
+    }
+
+    program_deadline(deadline);
+}
+
+/**
+ * Go back to ticking periodically, from the start of the next tick
+ */
+void timer_restart_tick(void)
+{
+    if (!stopped || restarting) {
+        return;
+    }
+
+    catch_up(0);
+    program_deadline(tick_start_ns(ticks + 1));
+    restarting = true;
+}
+
+void init_timer(uint32_t frequency)
+{
+    divisor = PIT_HZ / frequency;
 
-    outb(0x40, low);
-    outb(0x40, high);
+    program(PIT_PERIODIC, divisor);
+    armed = false;
+    restarting = false;
+    stopped = false;
 }
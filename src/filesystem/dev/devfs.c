@@ -1,5 +1,6 @@
 #include "fs/devfs.h"
 
+#include "algorithm.h"
 #include "compiler.h"
 #include "errno.h"
 #include "printf.h"
@@ -8,8 +9,9 @@
 #include "device/tty.h"
 #include "fs/fs.h"
 #include "memory/kheap.h"
+#include "memory/memory.h"
 
-#define DEV_NFILES 4
+#define DEV_NFILES 16
 
 static inode_t *devfs_alloc_inode(struct superblock *sb);
 static void devfs_read_inode(struct superblock *sb, struct inode *inode);
@@ -61,7 +63,7 @@ static int devfs_create(struct inode *inode, char *name, uint32_t permissions)
     devfs_files[new->ino].name = kzalloc(MEM_GEN, strlen(name) + 1);
     strncpy(devfs_files[new->ino].name, name, strlen(name));
     devfs_files[new->ino].inode = new;
-    devfs_files[new->ino].file = kzalloc(MEM_GEN, sizeof(struct file));
+    devfs_files[new->ino].file = alloc_file();
 
     return 0;
 }
@@ -95,16 +97,16 @@ static uint32_t devfs_lookup(struct inode *parent, char *name)
 
 static inode_t *devfs_alloc_inode(struct superblock __unused *sb)
 {
-    if (devfs_nfiles > DEV_NFILES) {
+    if (devfs_nfiles >= DEV_NFILES) {
         return NULL;
     }
 
-    struct inode *inode = kzalloc(MEM_GEN, sizeof(*inode));
+    struct inode *inode = alloc_inode();
     inode->ino = devfs_nfiles;
     inode->ops = &devfs_iops;
 
     devfs_files[devfs_nfiles].inode = inode;
-    devfs_files[devfs_nfiles].file = kzalloc(MEM_GEN, sizeof(struct file));
+    devfs_files[devfs_nfiles].file = alloc_file();
     ++devfs_nfiles;
 
     return inode;
@@ -113,8 +115,7 @@ static inode_t *devfs_alloc_inode(struct superblock __unused *sb)
 superblock_t *init_devfs(void)
 {
     char *name = "dev";
-    superblock_t *mount = kzalloc(MEM_GEN, sizeof(*mount) + strlen(name) + 1);
-    strncpy(mount->name, name, strlen(name));
+    superblock_t *mount = alloc_superblock(name);
     mount->ops = &devfs_sops;
 
     inode_t *root = devfs_alloc_inode(NULL);
@@ -148,3 +149,66 @@ int create_device_file(struct file_ops *fops, char *name, uint32_t permissions)
 
     return -EBADF; // TODO: did we really get a bad file descriptor?...
 }
+
+/**
+ * Default open() for device files that don't keep any per-file state
+ */
+int devfs_open(file_t *file, inode_t *inode, uint8_t mode)
+{
+    file->inode = inode;
+    file->length = 0;
+    file->offset = 0;
+    file->mode = mode;
+    file->ops = inode->fops;
+
+    return 0;
+}
+
+/**
+ * Copy the part of a generated text buffer starting at *offset out to a
+ * reader, advancing the offset. Used by the read() of the stats devices.
+ */
+uint32_t devfs_read_text(const char *text, uint32_t len, uint32_t *offset,
+                         uint32_t size, void *buf)
+{
+    if (*offset >= len) {
+        return 0;
+    }
+
+    size = min(size, len - *offset);
+    memcpy(buf, text + *offset, size);
+    *offset += size;
+
+    return size;
+}
+
+void devfs_printf(struct devfs_text *text, const char *format, ...)
+{
+    char line[DEVFS_LINE_MAX];
+    va_list args;
+
+    va_start(args, format);
+    uint32_t len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    uint32_t from = max(text->len, text->start);
+    uint32_t to = min(text->len + len, text->start + text->size);
+
+    if (from < to) {
+        memcpy(text->buf + (from - text->start), line + (from - text->len),
+               to - from);
+        text->copied = to - text->start;
+    }
+
+    text->len += len;
+}
+
+/**
+ * Finish a read of generated text, advancing the reader's offset past what
+ *   was copied out and returning how much that was
+ */
+uint32_t devfs_text_done(struct devfs_text *text, uint32_t *offset)
+{
+    *offset += text->copied;
+    return text->copied;
+}
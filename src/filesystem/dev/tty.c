@@ -1,6 +1,7 @@
 #include "device/tty.h"
 
 #include "bits.h"
+#include "preempt.h"
 #include "printf.h"
 #include "ring-buffer.h"
 #include "task.h"
@@ -13,6 +14,9 @@
 
 #define TTY_KEYBUF_SIZE 1024
 
+/* Characters written between chances to give up the CPU */
+#define TTY_WRITE_BATCH 256
+
 static struct tty tty;
 
 static uint32_t tty_read(file_t *file, uint32_t *offset,
@@ -37,9 +41,9 @@ static uint32_t tty_read(file_t __unused *file, uint32_t __unused *offset,
     uint32_t ret = size;
 
     // Wait until we're in the foreground and the device/tty.has enough data
-    while (current_task->pid != tty.fg_pid || tty.kbd_in->size < size * 2) {
-        sleep();
-    }
+    wait_event(tty.readers,
+               current_task->pid == tty.fg_pid
+               && tty.kbd_in->size >= size * 2);
 
     uint8_t *keys = kmalloc(MEM_GEN, size * 2);
     ring_buffer_read(tty.kbd_in, keys, size * 2);
@@ -67,6 +71,10 @@ static uint32_t tty_write(file_t __unused *file, uint32_t __unused *offset,
         printf("%c", *(char *)buf);
         ++buf;
         --size;
+
+        if (!(size % TTY_WRITE_BATCH)) {
+            cond_resched();
+        }
     }
 
     return ret;
@@ -98,6 +106,7 @@ void init_tty(void)
 
     tty.kbd_in = ring_buffer_create(TTY_KEYBUF_SIZE * 2);
     tty.fg_pid = 1;
+    wait_queue_init(&tty.readers);
 
     if (set_keyboard_tty(&tty) < 0) {
         PANIC("Unable to set keyboard active tty!");
@@ -10,6 +10,7 @@
 #include "fs/vfs.h"
 #include "memory/kheap.h"
 #include "memory/memory.h"
+#include "memory/slab.h"
 
 #define INODE_MAX 1024
 
@@ -17,6 +18,38 @@ extern ldsymbol ld_initrd;
 
 superblock_t *mounts;
 
+static DEFINE_KMEM_CACHE(superblock_cache, superblock_t, NULL);
+static DEFINE_KMEM_CACHE(inode_cache, inode_t, NULL);
+static DEFINE_KMEM_CACHE(file_cache, file_t, NULL);
+
+/**
+ * Filesystem objects come from their own slab caches
+ */
+superblock_t *alloc_superblock(const char *name)
+{
+    superblock_t *sb = kmem_cache_zalloc(&superblock_cache);
+    if (sb) {
+        strncpy(sb->name, name, SB_NAME_MAX - 1);
+    }
+
+    return sb;
+}
+
+inode_t *alloc_inode(void)
+{
+    return kmem_cache_zalloc(&inode_cache);
+}
+
+file_t *alloc_file(void)
+{
+    return kmem_cache_zalloc(&file_cache);
+}
+
+void free_file(file_t *file)
+{
+    kmem_cache_free(&file_cache, file);
+}
+
 void mount(superblock_t *sb)
 {
     sb->next = NULL;
@@ -96,8 +129,18 @@ file_t *open_path(const char *pathname, const uint8_t mode)
         vfs_read_inode(mount, &inode);
     }
 
-    file_t *file = kzalloc(MEM_GEN, sizeof(*file));
+    file_t *file = alloc_file();
+    if (!file) {
+        return NULL;
+    }
+
     vfs_open(file, &inode, mode);
     
     return file;
 }
+
+void close_file(file_t *file)
+{
+    vfs_close(file);
+    free_file(file);
+}
@@ -1,9 +1,11 @@
 
 #include "fs/initrd.h"
 
+#include "algorithm.h"
 #include "compiler.h"
 #include "errno.h"
 #include "macros.h"
+#include "preempt.h"
 #include "printf.h"
 #include <stdint.h>
 #include "string.h"
@@ -12,6 +14,7 @@
 #include "memory/kheap.h"
 
 #include "memory/memory.h"
+#include "memory/pmm.h"
 
 #define INITRD_MAX_FILES 64
 #define INITRD_MAGIC 0x0BADC0DE
@@ -119,7 +122,11 @@ static uint32_t initrd_read(file_t *file, uint32_t *offset,
         + initrd_files[file->inode->ino].offset
         + *offset;
 
-    memcpy(buf, start, size);
+    // A page at a time, so reading a big file lets others have the CPU
+    for (uint32_t done = 0; done < size; done += PAGE_SIZE) {
+        memcpy(buf + done, start + done, min(size - done, (uint32_t)PAGE_SIZE));
+        cond_resched();
+    }
 
     return size;
 }
@@ -152,15 +159,13 @@ superblock_t *init_initrd(uint32_t start)
 {
     /* printf("Initializing initrd at %x\n", start); */
     const char *name = "init";
-    superblock_t *sb = kzalloc(MEM_GEN, sizeof(*sb) + strlen(name) + 1);
-
-    strncpy(sb->name, name, strlen(name));
+    superblock_t *sb = alloc_superblock(name);
     sb->ops = &initrd_sops;
 
     initrd_start = start;
     memcpy(&initrd_num, (void *)initrd_start, sizeof(initrd_num));
 
-    inode_t *root = kzalloc(MEM_GEN, sizeof(*root));
+    inode_t *root = alloc_inode();
     root->flags = FS_DIR;
     root->permissions = 0x0755;
     root->ops = &initrd_iops;
@@ -12,6 +12,9 @@
 #define __user
 #define __section(sct) __attribute((section (sct)))
 
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
 #define KBYTE (1024)
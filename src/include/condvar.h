@@ -0,0 +1,33 @@
+#ifndef __CONDVAR_H_
+#define __CONDVAR_H_
+
+#include "list.h"
+#include "spinlock.h"
+
+struct mutex;
+
+/**
+ * Condition variables. cond_wait() releases the mutex and sleeps until
+ *   signalled, then takes the mutex again before returning; waiters are
+ *   signalled in the order they started waiting. The condition should be
+ *   rechecked after waking, as it may have changed again before the mutex
+ *   was retaken.
+ */
+struct condvar {
+    spinlock_t lock; // guards the waiters
+    struct list waiters;
+};
+
+#define CONDVAR_INIT(name) {                    \
+    .lock = SPINLOCK_INIT,                      \
+    .waiters = LIST_INIT((name).waiters),       \
+}
+
+#define DEFINE_CONDVAR(name) struct condvar name = CONDVAR_INIT(name)
+
+void cond_init(struct condvar *cond);
+void cond_wait(struct condvar *cond, struct mutex *mutex);
+void cond_signal(struct condvar *cond);
+void cond_broadcast(struct condvar *cond);
+
+#endif // __CONDVAR_H_
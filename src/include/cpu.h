@@ -0,0 +1,86 @@
+#ifndef __CPU_H_
+#define __CPU_H_
+
+#include <stdint.h>
+
+#define EFLAGS_IF (1 << 9)
+
+/* The most processors brought up (make NR_CPUS=...) */
+#ifndef CONFIG_NR_CPUS
+#define CONFIG_NR_CPUS 1
+#endif
+
+#define NR_CPUS CONFIG_NR_CPUS
+
+/* The boot CPU's TSS selector; the others' follow it in the GDT */
+#define TSS_SELECTOR 0x28
+
+/**
+ * Index of the processor we're running on, for per-CPU data. Each CPU
+ *   loads its own TSS, so its task register says which one it is; until
+ *   the boot CPU loads its TSS, the register is 0.
+ */
+static inline uint32_t cpu_id(void)
+{
+    uint16_t selector;
+
+    asm ("str %0" : "=r"(selector));
+    return selector ? (selector - TSS_SELECTOR) / 8 : 0;
+}
+
+/**
+ * Hint to the processor that we're spinning on a lock
+ */
+static inline void cpu_relax(void)
+{
+    asm volatile ("pause" : : : "memory");
+}
+
+/**
+ * Read the processor's time stamp counter
+ */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline uint32_t read_cr0(void)
+{
+    uint32_t cr0;
+
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0)
+{
+    asm volatile ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+/**
+ * Disable interrupts, returning the previous eflags so the caller can
+ * restore the interrupt state with irq_restore() when it's done
+ */
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+
+    asm volatile ("pushf\n\t"
+                  "pop %0\n\t"
+                  "cli\n\t"
+                  : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & EFLAGS_IF) {
+        asm volatile ("sti" : : : "memory");
+    }
+}
+
+#endif // __CPU_H_
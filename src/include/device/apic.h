@@ -0,0 +1,26 @@
+#ifndef __APIC_H_
+#define __APIC_H_
+
+#include "bool.h"
+
+#include <stdint.h>
+
+/* Where the local APIC is unless the firmware's tables say otherwise */
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+
+/* Vectors for the local APIC's own interrupts, above the PICs' */
+#define APIC_TIMER_INTERRUPT 48
+#define RESCHEDULE_INTERRUPT 49
+#define SPURIOUS_INTERRUPT 255
+
+int init_lapic(uint32_t physical);
+void lapic_enable(bool boot);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_start_timer(void);
+
+void lapic_send_ipi(uint32_t apic_id, uint32_t vector);
+void lapic_start_ap(uint32_t apic_id, uint32_t start);
+
+#endif // __APIC_H_
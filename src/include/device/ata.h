@@ -1,6 +1,10 @@
 #ifndef __ATA_H_
 #define __ATA_H_
 
+#include "bool.h"
+#include "wait-queue.h"
+#include "workqueue.h"
+
 #include <stdint.h>
 
 typedef enum {
@@ -42,6 +46,11 @@ typedef struct ata_bus {
     uint16_t irq;
     prd_t *prdt;
     uint32_t prdt_phys;
+    volatile bool irq_done; // the last command's IRQ has come in
+    struct wait_queue irq_wait;
+    uint8_t irq_status;     // bus master status as of the last IRQ
+    struct work irq_work;   // reports it, outside the IRQ handler
+    const char *name;
 } ata_bus_t;
 
 void init_ata();
@@ -0,0 +1,35 @@
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+#include "compiler.h"
+
+#include <stdint.h>
+
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+
+/* Clock ids and flags, numbered as on Linux */
+#define CLOCK_MONOTONIC 1
+
+#define TIMER_ABSTIME 1
+
+struct timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+extern uint32_t tsc_khz;
+
+void init_clock(void);
+
+uint64_t div64_32(uint64_t n, uint32_t d, uint32_t *rem);
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t clock_ns(void);
+void udelay(uint32_t us);
+
+uint32_t ns_to_ticks(uint64_t ns);
+uint64_t timespec_to_ns(const struct timespec *ts);
+void ns_to_timespec(uint64_t ns, struct timespec *ts);
+int clock_gettime(int clock, struct timespec __user *ts);
+
+#endif // __CLOCK_H_
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 void init_descriptor_tables();
+void load_descriptor_tables(uint32_t cpu);
 void flush_idt();
 
 void enable_irq(uint8_t irq);
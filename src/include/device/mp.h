@@ -0,0 +1,19 @@
+#ifndef __MP_H_
+#define __MP_H_
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+/**
+ * The processors the firmware says we have
+ */
+struct mp_config {
+    uint32_t lapic; // physical address of the local APICs
+    uint32_t nr_cpus;
+    uint8_t apic_ids[NR_CPUS];
+};
+
+int mp_find_cpus(struct mp_config *config);
+
+#endif // __MP_H_
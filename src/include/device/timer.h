@@ -1,8 +1,104 @@
 #ifndef __TIMER_H_
 #define __TIMER_H_
 
+#include "bool.h"
+#include "list.h"
+
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * The tick rate is set at build time (make HZ=...). The PIT's 16-bit
+ *   counter can't count out a period much longer than 55ms, which sets
+ *   the lowest rate it can tick at.
+ */
+#ifndef CONFIG_HZ
+#define CONFIG_HZ 100
+#endif
+
+#define TIMER_HZ CONFIG_HZ
+
+#if TIMER_HZ < 19
+#error "the PIT can't tick slower than 19Hz"
+#endif
+
+/**
+ * With dynamic ticks (make NO_HZ=1, the default), the periodic tick stops
+ *   while the CPU is idle or has only one task to run, and the timer is
+ *   programmed one-shot for the next time something needs doing instead.
+ */
+#ifndef CONFIG_NO_HZ
+#define CONFIG_NO_HZ 1
+#endif
+
+#define TIMER_INTERRUPT 32
+
+/* The PIT's input clock */
+#define PIT_HZ 1193182
+
+#define MSECS_TO_TICKS(ms) ((ms) * TIMER_HZ / 1000)
+
+extern uint32_t ticks;
+
+/* Tick comparisons that survive ticks wrapping around */
+static inline bool time_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
 void init_timer(uint32_t frequency);
 
+void timer_irq_enter(bool timer);
+bool timer_tick_stopped(void);
+void timer_stop_tick(uint32_t max_ticks);
+void timer_restart_tick(void);
+
+/**
+ * Callback timers, run from the timer interrupt on the tick they expire.
+ *   Callers embed a struct timer in their own structure and find it again
+ *   in the callback with TIMER_ENTRY().
+ */
+struct timer_base;
+
+struct timer {
+    struct list node; // our node in the timer wheel, NULL next if not pending
+    uint32_t expires; // the tick to run on
+    struct timer_base *base; // the wheel we're on, while pending
+    void (*fn)(struct timer *timer);
+};
+
+#define TIMER_ENTRY(ptr, struct_name, timer_name)                       \
+    ((struct_name *)((char *)(ptr) - offsetof(struct_name, timer_name)))
+
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVN_LEVELS 4
+
+/**
+ * A timer wheel. The kernel's runs off ticks; tests can set up their own
+ *   and drive it with whatever time they like.
+ */
+struct timer_base {
+    struct list tv1[TVR_SIZE];
+    struct list tvn[TVN_LEVELS][TVN_SIZE];
+    uint32_t next; // the next tick to run timers for
+    uint32_t nr_timers;
+};
+
+void timer_base_init(struct timer_base *base, uint32_t now);
+void timer_base_add(struct timer_base *base, struct timer *timer,
+                    uint32_t expires);
+void timer_base_run(struct timer_base *base, uint32_t now);
+uint32_t timer_base_next_event(struct timer_base *base, uint32_t now);
+
+void init_timers(void);
+void timer_setup(struct timer *timer, void (*fn)(struct timer *timer));
+void timer_add(struct timer *timer, uint32_t expires);
+bool timer_cancel(struct timer *timer);
+bool timer_pending(const struct timer *timer);
+void run_timers(void);
+uint32_t timer_next_event(void);
+
 #endif // __TIMER__H_
@@ -3,12 +3,14 @@
 
 #include "bool.h"
 #include "ring-buffer.h"
+#include "wait-queue.h"
 
 #include "device/terminal.h"
 
 struct tty {
     struct ring_buffer *kbd_in;
     uint32_t fg_pid;
+    struct wait_queue readers; // woken as keys come in
 };
 
 void set_active_tty(uint8_t tty);
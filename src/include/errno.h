@@ -4,11 +4,14 @@
 extern int errno;
 
 #define ENOENT 2
+#define ESRCH  3
 #define EIO    6
 #define EBADF  9
+#define EAGAIN 11
 #define ENOMEM 12
 #define EFAULT 14
 #define EBUSY  16
+#define ENODEV 19
 #define ENODIR 20
 #define EISDIR 21
 #define EINVAL 22
@@ -0,0 +1,40 @@
+#ifndef __FPU_H_
+#define __FPU_H_
+
+#include "bool.h"
+
+#include <stdint.h>
+
+struct task;
+
+/**
+ * x87 and SSE state, as saved by FXSAVE. Tasks only get one once they
+ *   first use the FPU.
+ */
+struct fpu_state {
+    uint16_t fcw;
+    uint16_t fsw;
+    uint8_t ftw; // abridged: a bit per register, set if it's in use
+    uint8_t reserved;
+    uint16_t fop;
+    uint32_t fip;
+    uint32_t fcs;
+    uint32_t fdp;
+    uint32_t fds;
+    uint32_t mxcsr;
+    uint32_t mxcsr_mask;
+    uint8_t regs[480]; // st0-st7, xmm0-xmm7 and FXSAVE's reserved space
+} __attribute__((aligned(16)));
+
+void init_fpu(void);
+void fpu_init_cpu(void);
+
+void fpu_switch_out(struct task *prev);
+int fpu_first_use(struct task *task);
+int fpu_fork(struct task *child, struct task *parent);
+void fpu_release(struct task *task);
+
+/* Tests set this to have the next new FPU state fail to allocate */
+extern bool fpu_fail_alloc;
+
+#endif // __FPU_H_
@@ -8,4 +8,29 @@ superblock_t *init_devfs();
 
 int create_device_file(struct file_ops *fops, char *name, uint32_t permissions);
 
+int devfs_open(file_t *file, inode_t *inode, uint8_t mode);
+uint32_t devfs_read_text(const char *text, uint32_t len, uint32_t *offset,
+                         uint32_t size, void *buf);
+
+/**
+ * Generated text of any length, read a piece at a time: the device prints
+ *   all of it with devfs_printf(), and only the part in the reader's window
+ *   is copied out. Each devfs_printf() call prints at most a line.
+ */
+struct devfs_text {
+    uint32_t start;  // the reader's offset
+    uint32_t size;   // how much they want
+    char *buf;       // where it goes
+    uint32_t len;    // text printed so far
+    uint32_t copied; // of which copied out
+};
+
+#define DEVFS_TEXT_INIT(offset, sz, b) \
+    { .start = (offset), .size = (sz), .buf = (b), .len = 0, .copied = 0 }
+
+#define DEVFS_LINE_MAX 256
+
+void devfs_printf(struct devfs_text *text, const char *format, ...);
+uint32_t devfs_text_done(struct devfs_text *text, uint32_t *offset);
+
 #endif // __DEVFS_H_
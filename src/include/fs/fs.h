@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #define NAME_MAX 128
+#define SB_NAME_MAX 16
 
 #define FS_FILE (1 << 0)
 #define FS_DIR (1 << 1)
@@ -32,7 +33,7 @@ typedef struct superblock {
     struct superblock *next;
     inode_t *mount;
     superblock_ops_t *ops;
-    char name[0];
+    char name[SB_NAME_MAX];
 } superblock_t;
 
 typedef struct superblock_ops {
@@ -79,6 +80,12 @@ extern superblock_t *mounts;
 void init_filesystem();
 void mount(superblock_t *sb);
 
+superblock_t *alloc_superblock(const char *name);
+inode_t *alloc_inode(void);
+file_t *alloc_file(void);
+void free_file(file_t *file);
+
 file_t *open_path(const char *pathname, const uint8_t mode);
+void close_file(file_t *file);
 
 #endif // __FS_H_
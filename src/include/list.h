@@ -7,9 +7,13 @@ struct list
     struct list *prev;
 };
 
+/* Static initializer for an empty list head */
+#define LIST_INIT(name) { &(name), &(name) }
+
 void list_init(struct list *list);
 void list_insert(struct list *list, struct list *entry);
 void list_remove(struct list *entry);
+int list_empty(const struct list *list);
 int list_size(struct list *list);
 
 #define LIST_FOR_EACH(list, var) for (var = (list)->next; var != (list); var = var->next)
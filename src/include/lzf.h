@@ -0,0 +1,19 @@
+#ifndef __LZF_H_
+#define __LZF_H_
+
+#include <stdint.h>
+
+/**
+ * Small LZF-style compressor (byte-oriented LZ77 with a 8K window).
+ *
+ * lzf_compress() returns the compressed length, or 0 if the output doesn't
+ *   fit in out_len bytes (callers use this to reject incompressible data).
+ * lzf_decompress() returns the decompressed length, or 0 if the input is
+ *   corrupt or the output doesn't fit.
+ */
+uint32_t lzf_compress(const void *in, uint32_t in_len,
+                      void *out, uint32_t out_len);
+uint32_t lzf_decompress(const void *in, uint32_t in_len,
+                        void *out, uint32_t out_len);
+
+#endif // __LZF_H_
@@ -4,10 +4,14 @@
 
 #include "memory/pmm.h"
 
+struct wss;
+
 typedef struct address_space {
     uint32_t **pgdir;
 
     uint32_t brk;
+
+    struct wss *wss; // working-set estimate, allocated on first scan
 } address_space_t;
 
 address_space_t *alloc_address_space();
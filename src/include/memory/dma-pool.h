@@ -0,0 +1,29 @@
+#ifndef __DMA_POOL_H_
+#define __DMA_POOL_H_
+
+#include "list.h"
+
+#include <stdint.h>
+
+/**
+ * Pools of fixed-size DMA buffers, smaller than a page (PRDTs, sector
+ *   buffers...). Buffers never cross a page, so never a 64K boundary
+ *   either, and their physical addresses are handed out along with them.
+ */
+struct dma_pool {
+    const char *name;
+    uint32_t size;
+    uint32_t offset; // of the first buffer in each page
+    struct list partial;
+    struct list full;
+    struct list empty;
+    uint32_t nempty;
+};
+
+struct dma_pool *dma_pool_create(const char *name, uint32_t size,
+                                 uint32_t align);
+void *dma_pool_alloc(struct dma_pool *pool, uint32_t *physical);
+void *dma_pool_zalloc(struct dma_pool *pool, uint32_t *physical);
+void dma_pool_free(struct dma_pool *pool, void *buf);
+
+#endif // __DMA_POOL_H_
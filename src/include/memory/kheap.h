@@ -8,12 +8,24 @@ typedef enum {
     MEM_DMA
 } kmem_type_t;
 
+struct kheap_stats {
+    uint32_t heap_pages;     // pages currently mapped for the heap
+    uint32_t idle_pages;     // pages of entirely free regions still mapped
+    uint32_t released_pages; // pages given back to the PMM so far
+    uint32_t live_bytes;     // bytes in allocated chunks
+    uint32_t free_bytes;     // bytes in free chunks
+    uint32_t large_pages;    // pages mapped by vmalloc for large allocations
+};
+
 void *kmalloc(kmem_type_t type, uint32_t size);
 void *kcalloc(kmem_type_t type, uint32_t num, uint32_t size);
 void *kzalloc(kmem_type_t type, uint32_t size);
 void kfree(void *address);
 
+void kheap_get_stats(struct kheap_stats *stats);
+
 void init_kheap(void);
+void init_kheap_stats(void);
 void print_chunk_list(void);
 
 #endif
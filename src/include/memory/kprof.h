@@ -0,0 +1,28 @@
+#ifndef __KPROF_H_
+#define __KPROF_H_
+
+#include "bool.h"
+#include "compiler.h"
+
+#include <stdint.h>
+
+/**
+ * Kernel heap profiler: while enabled, every kmalloc() is charged to its
+ *   call site, and every kfree() of a block allocated meanwhile is credited
+ *   back to it. /dev/kprof reports the sites by live bytes; writing "on",
+ *   "off" or "reset" to it controls the profiler. Its addresses can be
+ *   turned into function names on the host with tools/kprof/symbolize.sh.
+ *
+ * While disabled, the heap only pays for testing kprof_enabled.
+ */
+#define KPROF_MAX_SITES 256
+#define KPROF_MAX_LIVE 4096
+
+extern bool kprof_enabled;
+
+void kprof_alloc(const void *site, const void *ptr, uint32_t size);
+void kprof_free(const void *ptr);
+
+void init_kprof(void);
+
+#endif // __KPROF_H_
@@ -0,0 +1,22 @@
+#ifndef __KSM_H_
+#define __KSM_H_
+
+#include "memory/address-space.h"
+#include "memory/pmm.h"
+
+#include <stdint.h>
+
+/* Pages hashed per idle-time scan step */
+#define KSM_SCAN_BATCH 64
+
+void init_ksm(void);
+
+uint32_t ksm_scan(address_space_t *as, uint32_t *virtual, uint32_t budget);
+void ksm_end_pass(void);
+
+int ksm_fault(uint32_t virtual);
+uint32_t ksm_share(uint32_t pte);
+void ksm_unshare(uint32_t pte);
+void ksm_forget(address_space_t *as);
+
+#endif // __KSM_H_
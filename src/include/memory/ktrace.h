@@ -0,0 +1,42 @@
+#ifndef __KTRACE_H_
+#define __KTRACE_H_
+
+#include "bool.h"
+
+#include <stdint.h>
+
+/**
+ * Kernel heap allocation trace: while enabled, every kmalloc()/kfree() (and
+ *   whole-page DMA buffer allocation and free) appends a record to a ring
+ *   buffer, which is drained by reading /dev/ktrace. Writing "on" or "off"
+ *   to it starts and stops tracing; "on" also empties the buffer.
+ *
+ * The device reads as a stream of raw struct ktrace_records, to be replayed
+ *   against host builds of the heap with tools/heapbench/replay. If the
+ *   buffer fills up, records are dropped until there's room again, and a
+ *   KTRACE_LOST record with the number dropped is written first.
+ */
+#define KTRACE_RECORDS 16384
+
+enum ktrace_op {
+    KTRACE_ALLOC,
+    KTRACE_FREE,
+    KTRACE_DMA_ALLOC,
+    KTRACE_DMA_FREE,
+    KTRACE_LOST,
+};
+
+struct ktrace_record {
+    uint64_t timestamp; // TSC
+    uint32_t ptr;
+    uint32_t size : 28; // bytes requested, or records lost
+    uint32_t op : 4;
+};
+
+extern bool ktrace_enabled;
+
+void ktrace_record(enum ktrace_op op, const void *ptr, uint32_t size);
+
+void init_ktrace(void);
+
+#endif // __KTRACE_H_
@@ -9,4 +9,5 @@
 void *memset(void *ptr, int value, size_t num);
 
 void *memcpy(void *dest, const void *src, size_t sz);
+int memcmp(const void *a, const void *b, size_t sz);
 #endif // __MEMORY_H_
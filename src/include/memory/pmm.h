@@ -17,6 +17,10 @@
 #define PG_ACCESSED (1 << 3)
 #define PG_DIRTY (1 << 4)
 
+/* Software-defined bits (ignored by the MMU) */
+#define PG_ZRAM (1 << 9) /* not-present page stored compressed in zram */
+#define PG_KSM (1 << 10) /* read-only page merged with identical pages */
+
 #define PG_FRAME(p) ((p) & ~0xFFF)
 #define PG_INFO(p) ((p) & 0xFFF)
 #define PG_IS_PRESENT(p) ((p) & PG_PRESENT)
@@ -36,6 +40,7 @@ uint32_t _alloc_frame();
 uint32_t alloc_frame();
 uint32_t dma_alloc_frames(uint32_t n);
 void free_frame(uint32_t address);
+uint32_t pmm_free_frames(void);
 void dma_free_frames(uint32_t physical, uint32_t n);
 bool check_dma_address(uint32_t physical);
 
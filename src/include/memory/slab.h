@@ -0,0 +1,59 @@
+#ifndef __SLAB_H_
+#define __SLAB_H_
+
+#include "list.h"
+#include "spinlock.h"
+
+#include <stdint.h>
+
+/* Objects are aligned (and padded) to a cache line */
+#define SLAB_ALIGN 64
+
+/* Objects per single-page slab are limited by the freelist in its header */
+#define SLAB_MAX_OBJS 62
+
+/* Empty slabs kept around per cache before going back to the PMM */
+#define SLAB_MAX_EMPTY 1
+
+/**
+ * A cache of fixed-size objects, carved out of single-page slabs.
+ *
+ * If a constructor is given it's run on each object once, when its slab is
+ *   created - objects must be freed back in their constructed state.
+ *   Caches without one hand out zeroed objects from kmem_cache_zalloc().
+ *
+ * Each cache has its own lock, taken with interrupts off since interrupt
+ *   handlers allocate too.
+ */
+struct kmem_cache {
+    spinlock_t lock;
+    const char *name;
+    uint32_t size;
+    uint32_t objs_per_slab;
+    void (*ctor)(void *);
+
+    struct list partial;
+    struct list full;
+    struct list empty;
+    uint32_t nempty;
+
+    uint32_t nslabs;
+    uint32_t active;
+};
+
+#define DEFINE_KMEM_CACHE(var, type, constructor)                       \
+    struct kmem_cache var = {                                           \
+        .lock = SPINLOCK_INIT_NAMED(#var),                              \
+        .name = #type,                                                  \
+        .size = sizeof(type),                                           \
+        .ctor = constructor,                                            \
+        .partial = LIST_INIT(var.partial),                              \
+        .full = LIST_INIT(var.full),                                    \
+        .empty = LIST_INIT(var.empty),                                  \
+    }
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_zalloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif // __SLAB_H_
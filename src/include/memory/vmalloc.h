@@ -0,0 +1,31 @@
+#ifndef __VMALLOC_H_
+#define __VMALLOC_H_
+
+#include "bool.h"
+
+#include <stdint.h>
+
+/**
+ * Kernel virtual areas: page-granular allocations made of whatever frames
+ *   are free, mapped contiguously between VMALLOC_START and VMALLOC_END.
+ *   Each area is preceded by an unmapped guard page, so running off the
+ *   bottom of a kernel stack faults instead of corrupting its neighbour.
+ */
+#define VMALLOC_START 0xE0000000
+#define VMALLOC_END 0xF0000000
+
+void *vmalloc(uint32_t size);
+void vfree(void *address);
+void *ioremap(uint32_t physical, uint32_t size);
+
+static inline bool is_vmalloc_addr(const void *address)
+{
+    return (uint32_t)address >= VMALLOC_START
+        && (uint32_t)address < VMALLOC_END;
+}
+
+uint32_t vmalloc_used_pages(void);
+
+void init_vmalloc(void);
+
+#endif // __VMALLOC_H_
@@ -6,6 +6,8 @@
 #include "compiler.h"
 #include <stdint.h>
 
+int map_page(uint32_t virtual, uint32_t physical,
+             uint8_t readonly, uint8_t kernel);
 int alloc_page(uint32_t virtual, uint8_t readonly, uint8_t kernel);
 int alloc_pages(uint32_t virtual, uint8_t readonly,
                 uint8_t kernel, uint32_t num);
@@ -27,6 +29,8 @@ void unmap_page(uint32_t virtual);
 bool check_user_ptr(const void __user *ptr);
 
 void flush_tlb(uint32_t virtual);
+void flush_tlb_all(void);
+void sync_kernel_tlb(void);
 
 void init_paging();
 
@@ -0,0 +1,45 @@
+#ifndef __WSS_H_
+#define __WSS_H_
+
+#include "device/timer.h"
+#include "memory/address-space.h"
+#include "memory/pmm.h"
+
+#include <stdint.h>
+
+/* Timer ticks between samples of the accessed bits */
+#define WSS_SCAN_TICKS MSECS_TO_TICKS(1000)
+
+/* A page is in the working set if it was touched within this many scans */
+#define WSS_WINDOW 4
+
+/* Idle page age histogram buckets: 0, 1, 2-3, 4-7, ..., 64+ scans */
+#define WSS_NBUCKETS 8
+
+struct wss_stats {
+    uint32_t mapped;   // present and swapped-out user pages
+    uint32_t resident; // present user pages
+    uint32_t wss;      // resident pages touched within WSS_WINDOW scans
+    uint32_t dirty;    // resident pages written since they were mapped
+    uint32_t hist[WSS_NBUCKETS];
+};
+
+/**
+ * Per address space working-set state: an idle age (in scans, saturating)
+ *   for every user page, kept in arrays allocated per page table as they
+ *   are first scanned, and the stats from the last scan.
+ */
+struct wss {
+    uint8_t *ages[1024];
+    uint32_t scans;
+    uint32_t pass; // the last pass over every task to get to us
+    struct wss_stats stats;
+};
+
+void init_wss(void);
+
+void wss_scan(address_space_t *as);
+uint32_t wss_page_age(const address_space_t *as, uint32_t virtual);
+void wss_free(address_space_t *as);
+
+#endif // __WSS_H_
@@ -0,0 +1,39 @@
+#ifndef __ZRAM_H_
+#define __ZRAM_H_
+
+#include "bool.h"
+
+#include "memory/address-space.h"
+#include "memory/pmm.h"
+#include "memory/wss.h"
+
+#include <stdint.h>
+
+/**
+ * A page stored in zram is left in its page table as a not-present entry
+ *   carrying PG_ZRAM, the index of its zram entry in the frame bits, and
+ *   its original writeable/user bits so they can be restored on fault.
+ */
+#define ZRAM_MAX_ENTRIES (1 << 20)
+
+#define ZRAM_PTE(handle, pte)                                           \
+    (((handle) << 12) | PG_ZRAM | ((pte) & (PG_WRITEABLE | PG_USER)))
+#define ZRAM_PTE_HANDLE(pte) ((pte) >> 12)
+#define ZRAM_PTE_IS_STORED(pte) (!PG_IS_PRESENT(pte) && ((pte) & PG_ZRAM))
+
+/* Start compressing cold pages once free frames drop below this */
+#define ZRAM_LOW_WATERMARK 256
+#define ZRAM_RECLAIM_BATCH 32
+
+/* Only pages idle for this many working-set scans are compressed */
+#define ZRAM_COLD_AGE (WSS_WINDOW * 2)
+
+void init_zram(void);
+
+bool zram_under_pressure(void);
+uint32_t zram_reclaim(address_space_t *as, uint32_t nr);
+
+int zram_fault(uint32_t virtual);
+void zram_free_pte(uint32_t pte);
+
+#endif // __ZRAM_H_
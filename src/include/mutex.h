@@ -0,0 +1,58 @@
+#ifndef __MUTEX_H_
+#define __MUTEX_H_
+
+#include "bool.h"
+#include "list.h"
+#include "spinlock.h"
+
+#include <stdint.h>
+
+struct task;
+
+/**
+ * Sleeping locks, for kernel code that may block while holding them. Only
+ *   tasks take them; never an interrupt handler.
+ *
+ * A task that finds a mutex held spins for a while if its holder is
+ *   running on another CPU, as it's likely to let go soon, and otherwise
+ *   sleeps on the mutex's queue. Released with tasks waiting, a mutex goes
+ *   straight to the one that's waited longest, and while any waits its
+ *   holder inherits the highest real-time priority among them.
+ *
+ * owner is the lock itself: the holding task with MUTEX_LOCKED set, so a
+ *   mutex taken before there are any tasks is still locked, or 0 when free.
+ */
+#define MUTEX_LOCKED 0x1
+
+struct mutex {
+    volatile uint32_t owner;
+    spinlock_t wait_lock; // guards the waiters
+    struct list waiters;
+    struct list held; // our node in our holder's list of mutexes
+};
+
+#define MUTEX_INIT(name) {                      \
+    .owner = 0,                                 \
+    .wait_lock = SPINLOCK_INIT,                 \
+    .waiters = LIST_INIT((name).waiters),       \
+    .held = LIST_INIT((name).held),             \
+}
+
+#define DEFINE_MUTEX(name) struct mutex name = MUTEX_INIT(name)
+
+void mutex_init(struct mutex *mutex);
+void mutex_lock(struct mutex *mutex);
+bool mutex_trylock(struct mutex *mutex);
+void mutex_unlock(struct mutex *mutex);
+
+static inline bool mutex_is_locked(const struct mutex *mutex)
+{
+    return mutex->owner;
+}
+
+static inline struct task *mutex_owner(const struct mutex *mutex)
+{
+    return (struct task *)(mutex->owner & ~MUTEX_LOCKED);
+}
+
+#endif // __MUTEX_H_
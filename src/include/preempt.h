@@ -0,0 +1,79 @@
+#ifndef __PREEMPT_H_
+#define __PREEMPT_H_
+
+#include "bool.h"
+#include "cpu.h"
+#include "smp.h"
+
+#include <stdint.h>
+
+/**
+ * Kernel preemption. Most of the kernel runs with interrupts off, which
+ *   keeps everyone else out, but code that runs with them on (kernel
+ *   threads, the idle task and cond_resched() points) can be switched out
+ *   by the scheduler on the way out of an interrupt, unless it's disabled
+ *   preemption. Holding a spinlock disables it, as do preempt_disable()s.
+ *   Everywhere else, a task in the kernel only gives the CPU up where it
+ *   sleeps or at a cond_resched(), so how long it can keep others waiting
+ *   is only as short as the longest stretch between those.
+ *
+ * The count is per CPU while a task runs, and goes with the task when it's
+ *   switched out, like its kernel lock depth. Interrupts are masked while
+ *   it's updated, so we can't be moved to another CPU halfway through.
+ */
+void preempt_schedule(void);
+bool cond_resched(void);
+
+static inline uint32_t preempt_count(void)
+{
+    return this_cpu()->preempt_count;
+}
+
+static inline void preempt_disable(void)
+{
+    uint32_t flags = irq_save();
+    ++this_cpu()->preempt_count;
+    irq_restore(flags);
+}
+
+static inline void preempt_enable_no_resched(void)
+{
+    uint32_t flags = irq_save();
+    --this_cpu()->preempt_count;
+    irq_restore(flags);
+}
+
+/**
+ * Allow preemption again, and take it straight away if it was asked for
+ *   while we couldn't be preempted
+ */
+static inline void preempt_enable(void)
+{
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    bool resched = --cpu->preempt_count == 0 && cpu->resched;
+    irq_restore(flags);
+
+    if (resched && (flags & EFLAGS_IF)) {
+        preempt_schedule();
+    }
+}
+
+/**
+ * Take a preemption that was asked for while we couldn't be preempted, if
+ *   we now can: for when interrupts come back on after preemption did, as
+ *   preempt_enable() with them off can't take it
+ */
+static inline void preempt_check_resched(void)
+{
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    bool resched = cpu->preempt_count == 0 && cpu->resched;
+    irq_restore(flags);
+
+    if (resched && (flags & EFLAGS_IF)) {
+        preempt_schedule();
+    }
+}
+
+#endif // __PREEMPT_H_
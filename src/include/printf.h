@@ -6,4 +6,7 @@
 void printf(const char *format, ...);
 void vprintf(const char *format, va_list args);
 
+int snprintf(char *buf, unsigned int size, const char *format, ...);
+int vsnprintf(char *buf, unsigned int size, const char *format, va_list args);
+
 #endif // __PRINTF_H_
@@ -0,0 +1,53 @@
+#ifndef __RBTREE_H_
+#define __RBTREE_H_
+
+#include <stddef.h>
+
+/**
+ * Intrusive red-black tree. Users embed a struct rb_node in their own
+ *   structure, walk down from the root themselves to find where a new node
+ *   belongs, then hand it over with rb_link_node() and rb_insert_color():
+ *
+ *     struct rb_node **link = &root->node, *parent = NULL;
+ *     while (*link) {
+ *         parent = *link;
+ *         link = key < RB_ENTRY(parent, ...)->key
+ *             ? &parent->left : &parent->right;
+ *     }
+ *     rb_link_node(&new->node, parent, link);
+ *     rb_insert_color(&new->node, root);
+ *
+ * A tree can cache per-subtree data in its nodes: root->augment is called
+ *   on a node whenever its subtree changes shape, children before parents.
+ *   If a node's own contribution changes in place, call rb_augment_path().
+ */
+struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    int red;
+};
+
+struct rb_root {
+    struct rb_node *node;
+    void (*augment)(struct rb_node *node);
+};
+
+#define RB_ROOT { NULL, NULL }
+#define RB_ROOT_AUGMENTED(fn) { NULL, fn }
+
+#define RB_ENTRY(ptr, struct_name, node_name)                           \
+    ((struct_name *)((char *)(ptr) - offsetof(struct_name, node_name)))
+
+void rb_link_node(struct rb_node *node, struct rb_node *parent,
+                  struct rb_node **link);
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+void rb_augment_path(struct rb_node *node, struct rb_root *root);
+
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+
+#endif // __RBTREE_H_
@@ -1,8 +1,35 @@
 #ifndef __SEMAPHORE_H_
 #define __SEMAPHORE_H_
 
+#include "bool.h"
+#include "list.h"
+#include "spinlock.h"
+
+#include <stdint.h>
+
+/**
+ * Counting semaphores. down() takes one of count, sleeping until one's
+ *   free, and up() gives one back, straight to the task that's waited
+ *   longest if any are. up() never sleeps, so interrupt handlers can use it.
+ */
 struct semaphore {
-    uint8_t count;
+    uint32_t count;
+    spinlock_t lock; // guards count and the waiters
+    struct list waiters;
 };
 
+#define SEMAPHORE_INIT(name, n) {               \
+    .count = (n),                               \
+    .lock = SPINLOCK_INIT,                      \
+    .waiters = LIST_INIT((name).waiters),       \
+}
+
+#define DEFINE_SEMAPHORE(name, n) \
+    struct semaphore name = SEMAPHORE_INIT(name, n)
+
+void sema_init(struct semaphore *sem, uint32_t count);
+void down(struct semaphore *sem);
+bool down_trylock(struct semaphore *sem);
+void up(struct semaphore *sem);
+
 #endif // __SEMAPHORE_H_
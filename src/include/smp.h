@@ -0,0 +1,50 @@
+#ifndef __SMP_H_
+#define __SMP_H_
+
+#include "bool.h"
+#include "cpu.h"
+
+#include <stdint.h>
+
+struct address_space;
+struct task;
+
+/**
+ * Per-CPU state, indexed by cpu_id(). CPUs are numbered in the order they
+ *   came up, so the ones online are always 0 to nr_cpus - 1; CPU 0 is the
+ *   one we booted on.
+ */
+struct cpu {
+    uint32_t apic_id;
+
+    struct task *task;   // the task running here
+    struct task *idle;
+    bool resched;        // preempt the running task on return from IRQ
+    uint32_t nr_running; // runnable tasks on our run queues, or running here
+
+    uint32_t lock_depth;    // how many times we've taken the kernel lock
+    uint32_t preempt_count; // the running task can't be preempted unless 0
+
+    struct address_space *as; // user page tables loaded, kept for kthreads
+    struct task *fpu_owner;   // whose FPU state is loaded, if anyone's
+};
+
+extern struct cpu cpus[NR_CPUS];
+extern uint32_t nr_cpus;
+
+static inline struct cpu *this_cpu(void)
+{
+    return &cpus[cpu_id()];
+}
+
+#define for_each_cpu(cpu) for ((cpu) = 0; (cpu) < nr_cpus; ++(cpu))
+
+void init_smp(void);
+void smp_send_reschedule(uint32_t cpu);
+
+void lock_kernel(void);
+void unlock_kernel(void);
+bool kernel_lock_handoff(struct task *next);
+void kernel_lock_drop(void);
+
+#endif // __SMP_H_
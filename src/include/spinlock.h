@@ -0,0 +1,282 @@
+#ifndef __SPINLOCK_H_
+#define __SPINLOCK_H_
+
+#include "bool.h"
+#include "cpu.h"
+#include "preempt.h"
+
+#include <stdint.h>
+
+/**
+ * Spinlocks, for data shared between CPUs.
+ *
+ * spinlock_t is a ticket lock: a CPU takes the next ticket and waits until
+ *   the owner count comes round to it, so the lock goes to waiters in the
+ *   order they asked for it and none of them can be starved. Waiters only
+ *   read the lock while they spin.
+ *
+ * mcs_lock_t is a queue lock for the more contended paths. Each waiter
+ *   brings its own queue node (on its stack) and spins on that, and the
+ *   holder hands the lock straight to the next node when it's done, so a
+ *   release touches one waiter's cache line rather than every waiter's.
+ *
+ * Neither masks interrupts: code that also takes a lock from an interrupt
+ *   handler uses the _irqsave variants, which hand back the eflags to
+ *   restore like irq_save() does. Both disable preemption while they're
+ *   held (see preempt.h), except for the raw_ spinlock functions, which
+ *   are only for the kernel lock: that's handed from task to task as they
+ *   switch.
+ *
+ * Built with LOCK_STAT=1, each lock counts how often it's taken and how
+ *   often a CPU had to wait for it, and for how long it's waited for and
+ *   held, all shown by /dev/locks. Only named locks are counted: those
+ *   defined with DEFINE_SPINLOCK or DEFINE_MCS_LOCK are named for their
+ *   variables.
+ */
+#ifndef CONFIG_LOCK_STAT
+#define CONFIG_LOCK_STAT 0
+#endif
+
+struct lock_stat {
+    const char *name;
+    uint32_t acquired;
+    uint32_t contended;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+    uint64_t since; // when the holder took the lock
+    bool listed;
+    struct lock_stat *next;
+};
+
+#if CONFIG_LOCK_STAT
+#define LOCK_STAT_INIT(n) , .stat = { .name = (n) }
+#define lock_stat_now() rdtsc()
+void lock_stat_acquired(struct lock_stat *stat, uint64_t wait_start);
+void lock_stat_released(struct lock_stat *stat);
+#else
+#define LOCK_STAT_INIT(n)
+#define lock_stat_now() 0
+#define lock_stat_acquired(stat, wait_start) ((void)(wait_start))
+#define lock_stat_released(stat) do { } while (0)
+#endif
+
+void init_lock_stats(void);
+
+typedef struct spinlock {
+    union {
+        volatile uint32_t ticket; // both halves, for trylock
+        struct {
+            volatile uint16_t owner;
+            volatile uint16_t next;
+        };
+    };
+#if CONFIG_LOCK_STAT
+    struct lock_stat stat;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT_NAMED(n) { .ticket = 0 LOCK_STAT_INIT(n) }
+#define SPINLOCK_INIT SPINLOCK_INIT_NAMED(0)
+#define DEFINE_SPINLOCK(var) spinlock_t var = SPINLOCK_INIT_NAMED(#var)
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+    *lock = (spinlock_t)SPINLOCK_INIT;
+}
+
+static inline void raw_spin_lock(spinlock_t *lock)
+{
+    uint16_t ticket = 1;
+    uint64_t wait = 0;
+
+    asm volatile ("lock xaddw %0, %1"
+                  : "+r"(ticket), "+m"(lock->next)
+                  :
+                  : "memory");
+
+    if (lock->owner != ticket) {
+        wait = lock_stat_now();
+
+        while (lock->owner != ticket) {
+            cpu_relax();
+        }
+    }
+
+    lock_stat_acquired(&lock->stat, wait);
+}
+
+static inline bool raw_spin_trylock(spinlock_t *lock)
+{
+    uint32_t free = lock->ticket;
+    uint32_t old = free;
+
+    // Free when the next ticket is the owner's: take it if it still is
+    if ((free & 0xFFFF) != free >> 16) {
+        return false;
+    }
+
+    asm volatile ("lock cmpxchgl %2, %1"
+                  : "+a"(old), "+m"(lock->ticket)
+                  : "r"(free + (1 << 16))
+                  : "memory");
+
+    if (old != free) {
+        return false;
+    }
+
+    lock_stat_acquired(&lock->stat, 0);
+    return true;
+}
+
+static inline void raw_spin_unlock(spinlock_t *lock)
+{
+    lock_stat_released(&lock->stat);
+
+    // Stores aren't reordered with earlier loads or stores on x86, so the
+    //   compiler is all that needs holding back. Only the holder writes the
+    //   owner count.
+    asm volatile ("" : : : "memory");
+    lock->owner = lock->owner + 1;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    preempt_disable();
+    raw_spin_lock(lock);
+}
+
+static inline bool spin_trylock(spinlock_t *lock)
+{
+    preempt_disable();
+
+    if (!raw_spin_trylock(lock)) {
+        preempt_enable_no_resched();
+        return false;
+    }
+
+    return true;
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    raw_spin_unlock(lock);
+    preempt_enable();
+}
+
+static inline bool spin_is_locked(const spinlock_t *lock)
+{
+    return lock->owner != lock->next;
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags)
+{
+    spin_unlock(lock);
+    irq_restore(flags);
+    preempt_check_resched();
+}
+
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile bool locked;
+};
+
+typedef struct mcs_lock {
+    struct mcs_node *volatile tail; // the last waiter, or the holder
+#if CONFIG_LOCK_STAT
+    struct lock_stat stat;
+#endif
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT_NAMED(n) { .tail = 0 LOCK_STAT_INIT(n) }
+#define MCS_LOCK_INIT MCS_LOCK_INIT_NAMED(0)
+#define DEFINE_MCS_LOCK(var) mcs_lock_t var = MCS_LOCK_INIT_NAMED(#var)
+
+static inline void mcs_lock(mcs_lock_t *lock, struct mcs_node *node)
+{
+    struct mcs_node *prev = node;
+    uint64_t wait = 0;
+
+    preempt_disable();
+
+    node->next = 0;
+    node->locked = true;
+
+    asm volatile ("xchg %0, %1"
+                  : "+r"(prev), "+m"(lock->tail)
+                  :
+                  : "memory");
+
+    if (prev) {
+        wait = lock_stat_now();
+        prev->next = node;
+
+        while (node->locked) {
+            cpu_relax();
+        }
+    }
+
+    asm volatile ("" : : : "memory");
+    lock_stat_acquired(&lock->stat, wait);
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, struct mcs_node *node)
+{
+    lock_stat_released(&lock->stat);
+
+    if (!node->next) {
+        struct mcs_node *tail = node;
+
+        // No one waiting: empty the queue, unless someone's just joined it
+        asm volatile ("lock cmpxchg %2, %1"
+                      : "+a"(tail), "+m"(lock->tail)
+                      : "r"((struct mcs_node *)0)
+                      : "memory");
+
+        if (tail == node) {
+            preempt_enable();
+            return;
+        }
+
+        // They've swapped themselves in as the tail, but haven't linked
+        //   themselves to us yet
+        while (!node->next) {
+            cpu_relax();
+        }
+    }
+
+    asm volatile ("" : : : "memory");
+    node->next->locked = false;
+    preempt_enable();
+}
+
+static inline bool mcs_is_locked(const mcs_lock_t *lock)
+{
+    return lock->tail != 0;
+}
+
+static inline uint32_t mcs_lock_irqsave(mcs_lock_t *lock,
+                                        struct mcs_node *node)
+{
+    uint32_t flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t *lock,
+                                         struct mcs_node *node,
+                                         uint32_t flags)
+{
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+    preempt_check_resched();
+}
+
+#endif // __SPINLOCK_H_
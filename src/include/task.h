@@ -1,51 +1,136 @@
 #ifndef __TASK_H_
 #define __TASK_H_
 
+#include "device/clock.h"
 #include "device/interrupt.h"
 #include "fs/fs.h"
 #include "memory/address-space.h"
+#include "bool.h"
+#include "fpu.h"
 #include "list.h"
+#include "rbtree.h"
+#include "smp.h"
+#include "wait-queue.h"
 
 #define TASK_MAX_FILES 128
 
 enum status {
+    TASK_NEW, // not on any queue
     TASK_RUNNING,
     TASK_BLOCKED,
     TASK_FINISHED
 };
 
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+/* Scheduling policies, numbered as on Linux */
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define SCHED_DEADLINE 6
+
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 99
+
+/**
+ * Scheduler bookkeeping. Times are in sched clock units (see sched.c),
+ *   except for SCHED_DEADLINE's, which are in timer ticks.
+ */
+struct sched_entity {
+    struct rb_node node; // our node in the fair or deadline run tree
+    uint64_t vruntime;   // runtime, weighted by nice
+    uint64_t exec_start; // clock when we last started running or were charged
+    uint64_t sum_exec;   // total runtime
+    uint32_t weight;
+    int nice;
+
+    int policy;
+    uint32_t rt_priority; // RT_PRIO_MIN to RT_PRIO_MAX, for SCHED_FIFO/RR
+    struct list rt_node;  // our node in an RT run queue, or while throttled
+    uint32_t rt_slice;    // ticks left of our SCHED_RR time slice
+
+    uint32_t dl_runtime;  // SCHED_DEADLINE budget per period
+    uint32_t dl_deadline; // relative to the start of each period
+    uint32_t dl_period;
+    uint32_t deadline;    // absolute deadline this period
+    uint32_t next_period; // when the budget is next replenished
+    uint32_t budget;      // runtime left this period
+
+    uint64_t wakeup_start; // clock when we were woken, until we run
+    uint32_t nr_switches;  // times we've been switched out
+    uint32_t max_latency;  // longest wait from wakeup to running
+
+    bool pi_boosted;      // running at the priority of a task waiting on us
+    int pi_policy;        // our own policy and priority, while boosted
+    uint32_t pi_priority;
+};
+
 struct task {
     address_space_t *as;
 
-    uint32_t esp0;
+    uint32_t esp;    // kernel stack pointer, saved while switched out
+    uint32_t kstack; // bottom of the kernel stack
 
     uint32_t pid;
-    enum status status;
+    struct task *pid_next; // next task in our pid hash chain
+    enum status status; // which queue the task is on
 
     file_t *files[TASK_MAX_FILES];
 
-    struct task *next;
-    struct task *prev;
+    struct list queue; // our node in the queue for our status
+    struct sched_entity se;
+    uint32_t cpu;        // whose run queue we're on, or last ran on
+    bool pinned;         // never moved off cpu
+    uint32_t lock_depth; // kernel lock depth to go back to when we run
+    uint32_t preempt_count; // and preempt count (see preempt.h)
+
+    struct fpu_state *fpu; // saved FPU state, once we've used the FPU
+    uint32_t fpu_cpu;      // the CPU last loaded with our FPU state
+    bool fpu_live;         // our FPU state is in the registers, newer than fpu
 
     struct task *parent;
 
     struct list children; // head of our list of children
     struct list children_list; // our node in the list of our parent's children
+    struct wait_queue child_exit; // woken as each of our children exits
+
+    struct list mutexes; // head of our list of mutexes held
 
     int exit_code;
 };
 
-extern struct task *current_task;
+#define current_task (this_cpu()->task)
+#define need_resched (this_cpu()->resched)
 
 void init_scheduler(void);
+void init_sched_stats(void);
+void init_pingpong(void);
 int exec(const char __user *path);
+struct task *kthread_run(void (*fn)(void *data), void *data);
+struct task *kthread_run_on(void (*fn)(void *data), void *data, uint32_t cpu);
 int fork(void);
 void exit(int code);
+void task_exit(struct task *task, int code);
 int wait(uint32_t pid, int __user *status);
 
+struct task *task_first(void);
+struct task *task_next(struct task *task);
+struct task *task_next_by_pid(uint32_t pid);
+bool task_skip_scan(struct task *task);
+
+void schedule(void);
 void sleep(void);
-void wake(uint32_t pid);
+uint32_t sleep_timeout(uint32_t timeout);
+void sleep_until(uint64_t deadline);
+int nanosleep(const struct timespec __user *req, struct timespec __user *rem);
+int clock_nanosleep(int clock, int flags, const struct timespec __user *req,
+                    struct timespec __user *rem);
 void switch_tasks(void);
+int nice(int increment);
+int sched_setscheduler(uint32_t pid, int policy, uint32_t priority);
+int sched_setdeadline(uint32_t pid, uint32_t runtime_ms, uint32_t deadline_ms,
+                      uint32_t period_ms);
 
 void print_regs(registers_t *regs, char *msg);
 
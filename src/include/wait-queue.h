@@ -0,0 +1,69 @@
+#ifndef __WAIT_QUEUE_H_
+#define __WAIT_QUEUE_H_
+
+#include "bool.h"
+#include "list.h"
+#include "spinlock.h"
+
+#include <stdint.h>
+
+struct task;
+
+/**
+ * Wait queues: somewhere for tasks to sleep until something happens to
+ *   the object the queue is embedded in. wait_event(wq, cond) sleeps until
+ *   cond is true, and wake_up(wq), called once cond may have become true,
+ *   wakes every task waiting on wq to check it again. Tasks waiting on
+ *   anything else aren't disturbed.
+ *
+ * cond is checked with the queue's lock held and interrupts off, so it
+ *   can't miss a wake_up() between finding cond false and going to sleep;
+ *   it has to be quick, and mustn't sleep itself. wake_up() never sleeps,
+ *   so interrupt handlers can use it.
+ *
+ * Before the scheduler starts there's no task to put to sleep, so
+ *   wait_event() spins with interrupts on until cond is true.
+ */
+
+/**
+ * A task waiting on a wait queue, mutex, semaphore or condition variable,
+ *   in the order they started waiting. Whoever wakes the task sets woken,
+ *   under the lock that guards the queue; until then any wakeup is spurious.
+ */
+struct waiter {
+    struct list list;
+    struct task *task;
+    volatile bool woken;
+};
+
+struct wait_queue {
+    spinlock_t lock; // guards the waiters
+    struct list waiters;
+};
+
+#define WAIT_QUEUE_INIT(name) {                 \
+    .lock = SPINLOCK_INIT,                      \
+    .waiters = LIST_INIT((name).waiters),       \
+}
+
+#define DEFINE_WAIT_QUEUE(name) struct wait_queue name = WAIT_QUEUE_INIT(name)
+
+void wait_queue_init(struct wait_queue *wq);
+uint32_t prepare_to_wait(struct wait_queue *wq, struct waiter *waiter);
+uint32_t wait_queue_sleep(struct wait_queue *wq, uint32_t flags);
+void finish_wait(struct wait_queue *wq, struct waiter *waiter,
+                 uint32_t flags);
+void wake_up(struct wait_queue *wq);
+
+#define wait_event(wq, cond) do {                                       \
+    struct waiter __waiter;                                             \
+    uint32_t __flags = prepare_to_wait(&(wq), &__waiter);               \
+                                                                        \
+    while (!(cond)) {                                                   \
+        __flags = wait_queue_sleep(&(wq), __flags);                     \
+    }                                                                   \
+                                                                        \
+    finish_wait(&(wq), &__waiter, __flags);                             \
+} while (0)
+
+#endif // __WAIT_QUEUE_H_
@@ -0,0 +1,34 @@
+#ifndef __WORKQUEUE_H_
+#define __WORKQUEUE_H_
+
+#include "bool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Deferred work, run in a kernel thread. Interrupt handlers queue work to
+ *   do the slow part of their job later, with interrupts on and the option
+ *   of sleeping; queueing never blocks, so it's safe anywhere.
+ *
+ * Callers embed a struct work in their own structure and find it again in
+ *   the callback with WORK_ENTRY(). A work item is queued at most once at a
+ *   time, and can be queued again as soon as its callback starts.
+ */
+struct work {
+    void (*fn)(struct work *work);
+    struct work *next;         // the next work queued, while pending
+    volatile uint32_t pending; // queued and not yet started
+};
+
+#define WORK_INIT(func) { .fn = (func), .next = NULL, .pending = 0 }
+#define DEFINE_WORK(name, func) struct work name = WORK_INIT(func)
+
+#define WORK_ENTRY(ptr, struct_name, work_name)                         \
+    ((struct_name *)((char *)(ptr) - offsetof(struct_name, work_name)))
+
+void init_workqueue(void);
+void work_setup(struct work *work, void (*fn)(struct work *work));
+bool queue_work(struct work *work);
+
+#endif // __WORKQUEUE_H_
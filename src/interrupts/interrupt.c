@@ -1,35 +1,64 @@
 #include "device/interrupt.h"
 
+#include "preempt.h"
 #include "printf.h"
+#include "smp.h"
 #include "task.h"
 
+#include "device/apic.h"
 #include "device/descriptor_tables.h"
 #include "device/port.h"
+#include "device/timer.h"
 
 interrupt_handler callbacks[256];
 
-static void send_pic_eoi(uint32_t interrupt)
+static void send_eoi(uint32_t interrupt)
 {
+    if (interrupt >= APIC_TIMER_INTERRUPT) {
+        lapic_eoi();
+        return;
+    }
+
     outb(0x20, 0x20);
     if (interrupt >= 0x28) outb(0xA0, 0x20);
 }
 
+/**
+ * Interrupt handlers, like all kernel code, run under the kernel lock (see
+ *   smp.c)
+ */
 void handle_interrupt(registers_t *registers)
 {
-    if (current_task) {
-        current_task->esp0 = (uint32_t)registers;
-    }
+    lock_kernel();
 
     if (callbacks[registers->interrupt] != NULL) {
         interrupt_handler cb = callbacks[registers->interrupt];
         cb(registers);
     }
+
+    unlock_kernel();
 }
 
 void handle_irq(registers_t *registers)
 {
-    send_pic_eoi(registers->interrupt);
+    // Not a real interrupt, so nothing to acknowledge
+    if (registers->interrupt == SPURIOUS_INTERRUPT) {
+        return;
+    }
+
+    lock_kernel();
+
+    send_eoi(registers->interrupt);
+    timer_irq_enter(registers->interrupt == TIMER_INTERRUPT);
     handle_interrupt(registers);
+
+    // Whatever we interrupted had interrupts on, so can be preempted
+    //   unless it's said otherwise
+    if (need_resched && !preempt_count()) {
+        switch_tasks();
+    }
+
+    unlock_kernel();
 }
 
 void register_interrupt_handler(uint8_t n, interrupt_handler cb)
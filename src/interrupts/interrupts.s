@@ -132,4 +132,7 @@ IRQ 12, 44
 IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
+IRQ 16, 48                      ; local APIC timer
+IRQ 17, 49                      ; reschedule IPI
+IRQ 18, 255                     ; local APIC spurious interrupt
 ISR_NOERROR 128
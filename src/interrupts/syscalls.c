@@ -5,6 +5,7 @@
 #include "printf.h"
 #include "task.h"
 
+#include "device/clock.h"
 #include "device/interrupt.h"
 #include "fs/vfs.h"
 #include "memory/vmm.h"
@@ -18,6 +19,16 @@ static int sys_open(char __user *path, uint8_t mode);
 static int sys_close(int fd);
 static int sys_exec(const char __user *path);
 static int sys_yield(void);
+static int sys_nice(int increment);
+static int sys_sched_setscheduler(uint32_t pid, int policy, uint32_t priority);
+static int sys_sched_setdeadline(uint32_t pid, uint32_t runtime_ms,
+                                 uint32_t deadline_ms, uint32_t period_ms);
+static int sys_clock_gettime(int clock, struct timespec __user *ts);
+static int sys_nanosleep(const struct timespec __user *req,
+                         struct timespec __user *rem);
+static int sys_clock_nanosleep(int clock, int flags,
+                               const struct timespec __user *req,
+                               struct timespec __user *rem);
 
 extern void restore_context(registers_t *new);
 
@@ -35,6 +46,12 @@ static void *syscalls[] = {
     0, /* sys_unlink */         /* 10 */
     sys_exec, /* sys_execve */
     sys_yield,
+    sys_nice,
+    sys_sched_setscheduler,
+    sys_sched_setdeadline,      /* 15 */
+    sys_clock_gettime,
+    sys_nanosleep,
+    sys_clock_nanosleep,
 };
 
 static uint32_t nsyscalls = ARRAY_SIZE(syscalls);
@@ -117,7 +134,7 @@ static int sys_open(char __user *path, uint8_t mode)
         }
     }
 
-    vfs_close(file);
+    close_file(file);
     return -ENFILE;
 }
 
@@ -125,7 +142,8 @@ static int sys_close(int fd)
 {
     file_t *file = current_task->files[fd];
     if (file) {
-        vfs_close(file);
+        close_file(file);
+        current_task->files[fd] = NULL;
         return 0;
     }
 
@@ -134,13 +152,44 @@ static int sys_close(int fd)
 
 static int sys_yield(void)
 {
-    /* printf("task %d yielding (esp0 %x)...\n", current_task->pid, current_task->esp0); */
-    /* registers_t *regs = (registers_t *)current_task->esp0; */
-    /* print_regs(regs, "task regs"); */
     switch_tasks();
     return 0;
 }
 
+static int sys_nice(int increment)
+{
+    return nice(increment);
+}
+
+static int sys_sched_setscheduler(uint32_t pid, int policy, uint32_t priority)
+{
+    return sched_setscheduler(pid, policy, priority);
+}
+
+static int sys_sched_setdeadline(uint32_t pid, uint32_t runtime_ms,
+                                 uint32_t deadline_ms, uint32_t period_ms)
+{
+    return sched_setdeadline(pid, runtime_ms, deadline_ms, period_ms);
+}
+
+static int sys_clock_gettime(int clock, struct timespec __user *ts)
+{
+    return clock_gettime(clock, ts);
+}
+
+static int sys_nanosleep(const struct timespec __user *req,
+                         struct timespec __user *rem)
+{
+    return nanosleep(req, rem);
+}
+
+static int sys_clock_nanosleep(int clock, int flags,
+                               const struct timespec __user *req,
+                               struct timespec __user *rem)
+{
+    return clock_nanosleep(clock, flags, req, rem);
+}
+
 static void syscall_handler(registers_t *regs)
 {
     /* current_task->regs = *regs; */
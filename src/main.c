@@ -1,18 +1,29 @@
 // main.c - entry point for kernel from the bootloader
 // author: Liam Mitchell
 
+#include "fpu.h"
 #include "macros.h"
 #include "mboot.h"
+#include "smp.h"
+#include "spinlock.h"
 #include "syscalls.h"
 #include "task.h"
 #include "test.h"
 
+#include "device/clock.h"
 #include "device/descriptor_tables.h"
 #include "device/keyboard.h"
 #include "device/terminal.h"
+#include "device/timer.h"
 #include "fs/fs.h"
 #include "memory/kheap.h"
+#include "memory/kprof.h"
+#include "memory/ktrace.h"
+#include "memory/ksm.h"
+#include "memory/vmalloc.h"
 #include "memory/vmm.h"
+#include "memory/wss.h"
+#include "memory/zram.h"
 
 /**
  * kernel's main function
@@ -21,6 +32,10 @@
 
 void kernel_main(multiboot_info_t *mboot, uint32_t magic)
 {
+    // Held until we first drop into user mode, so the other CPUs wait for
+    //   the kernel to finish starting up
+    lock_kernel();
+
     init_terminal();
 
     if (magic != 0x2BADB002) {
@@ -32,13 +47,27 @@ void kernel_main(multiboot_info_t *mboot, uint32_t magic)
     }
 
     init_descriptor_tables();
+    init_clock();
+    init_timers();
     init_paging();
     init_kheap();
+    init_vmalloc();
     init_filesystem();
+    init_kheap_stats();
+    init_kprof();
+    init_ktrace();
+    init_zram();
+    init_ksm();
+    init_wss();
+    init_sched_stats();
+    init_lock_stats();
+    init_pingpong();
     init_keyboard();
     init_syscalls();
+    init_fpu();
 
     ktest();
 
+    init_smp();
     init_scheduler();
 }
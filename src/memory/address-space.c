@@ -4,29 +4,90 @@
 #include "errno.h"
 #include "ldsymbol.h"
 #include "macros.h"
+#include "preempt.h"
 #include "printf.h"
 #include "task.h"
 
 #include "memory/kheap.h"
+#include "memory/ksm.h"
 #include "memory/memory.h"
 #include "memory/pmm.h"
+#include "memory/slab.h"
 #include "memory/vmm.h"
+#include "memory/wss.h"
+#include "memory/zram.h"
 
 extern ldsymbol ld_virtual_offset;
 
+static DEFINE_KMEM_CACHE(as_cache, address_space_t, NULL);
+
 address_space_t *alloc_address_space()
 {
-    address_space_t *as = kzalloc(MEM_GEN, sizeof(*as));
+    address_space_t *as = kmem_cache_zalloc(&as_cache);
+    if (!as) {
+        return NULL;
+    }
+
     as->pgdir = kzalloc(MEM_GEN, PAGE_SIZE);
 
     return as;
 }
 
+/**
+ * Drop the compressed copies of any pages of the address space that were
+ *   moved out to zram, and its references to merged pages
+ */
+static void release_pages(address_space_t *as)
+{
+    for (uint32_t dir = 0; dir < DIRINDEX((uint32_t)ld_virtual_offset); ++dir) {
+        uint32_t pde = (uint32_t)as->pgdir[dir];
+        if (!PG_IS_PRESENT(pde)) {
+            continue;
+        }
+
+        uint32_t *pt = (uint32_t *)map_physical(PG_FRAME(pde));
+
+        for (uint32_t i = 0; i < PAGE_SIZE / 4; ++i) {
+            if (ZRAM_PTE_IS_STORED(pt[i])) {
+                zram_free_pte(pt[i]);
+                pt[i] = 0;
+            }
+            else if (PG_IS_PRESENT(pt[i]) && (pt[i] & PG_KSM)) {
+                ksm_unshare(pt[i]);
+                pt[i] = 0;
+            }
+        }
+
+        unmap_page((uint32_t)pt);
+
+        cond_resched();
+    }
+
+    ksm_forget(as);
+}
+
+/**
+ * Free an address space. A big one takes a while, and we may be switched
+ *   out partway through, so it must already be out of reach: its task
+ *   gone from the task lists, or pointed at another one.
+ */
 void free_address_space(address_space_t *as)
 {
     if (as) {
+        uint32_t cpu;
+
+        // A CPU still running kernel threads on its page tables flushes
+        //   them out before it next loads a user address space
+        for_each_cpu(cpu) {
+            if (cpus[cpu].as == as) {
+                cpus[cpu].as = NULL;
+            }
+        }
+
+        release_pages(as);
+        wss_free(as);
         kfree(as->pgdir);
-        kfree(as);
+        kmem_cache_free(&as_cache, as);
     }
 }
 
@@ -38,6 +99,14 @@ static uint32_t clone_page(uint32_t virtual)
     }
 
     uint32_t *page = get_page(virtual);
+    if (ZRAM_PTE_IS_STORED(*page) && zram_fault(virtual) < 0) {
+        return 0;
+    }
+
+    if (PG_IS_PRESENT(*page) && (*page & PG_KSM)) {
+        return ksm_share(*page);
+    }
+
     if (!PG_IS_USERMODE(*page)) {
         return *page;
     }
@@ -88,6 +157,9 @@ static uint32_t **clone_page_directory()
     {
         /* printf("cloning page table %x\n", virtual); */
         pgdir[DIRINDEX(virtual)] = clone_page_table(virtual);
+
+        // Copying a whole table's pages takes a while
+        cond_resched();
     }
 
     return pgdir;
@@ -96,7 +168,7 @@ static uint32_t **clone_page_directory()
 address_space_t *clone_address_space()
 {
     /* printf("cloning address space...\n"); */
-    address_space_t *as = kzalloc(MEM_GEN, sizeof(*as));
+    address_space_t *as = kmem_cache_zalloc(&as_cache);
     if (!as) {
         return NULL;
     }
@@ -104,7 +176,7 @@ address_space_t *clone_address_space()
     /* printf("cloning page directory...\n"); */
     as->pgdir = clone_page_directory();
     if (!as->pgdir) {
-        kfree(as);
+        kmem_cache_free(&as_cache, as);
         return NULL;
     }
 
@@ -0,0 +1,172 @@
+#include "memory/dma-pool.h"
+
+#include "compiler.h"
+#include "internal.h"
+#include "macros.h"
+
+#include "memory/memory.h"
+#include "memory/pmm.h"
+#include "memory/slab.h"
+#include "memory/vmm.h"
+
+#define DMA_POOL_MAX_EMPTY 1
+
+/**
+ * Each pool page is a single DMA frame, starting with a header that tracks
+ *   its physical address and free buffers; the buffers follow it. Free
+ *   buffers are chained through their first word.
+ */
+struct dma_page {
+    struct list list;
+    uint32_t physical;
+    void *free;
+    uint32_t inuse;
+    uint32_t nbufs;
+};
+
+static DEFINE_KMEM_CACHE(dma_pool_cache, struct dma_pool, NULL);
+
+struct dma_pool *dma_pool_create(const char *name, uint32_t size,
+                                 uint32_t align)
+{
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+
+    size = ALIGN(size, align);
+
+    uint32_t offset = ALIGN(sizeof(struct dma_page), align);
+    if (offset + size > PAGE_SIZE) {
+        return NULL;
+    }
+
+    struct dma_pool *pool = kmem_cache_zalloc(&dma_pool_cache);
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->name = name;
+    pool->size = size;
+    pool->offset = offset;
+    list_init(&pool->partial);
+    list_init(&pool->full);
+    list_init(&pool->empty);
+
+    return pool;
+}
+
+static struct dma_page *alloc_dma_page(struct dma_pool *pool)
+{
+    uint32_t virtual = kheap_reserve(1);
+
+    if (dma_alloc_pages(virtual, false, true, 1) < 0) {
+        kheap_unreserve(virtual, 1);
+        return NULL;
+    }
+
+    struct dma_page *page = (struct dma_page *)virtual;
+    page->physical = get_physical(virtual);
+    page->free = NULL;
+    page->inuse = 0;
+    page->nbufs = 0;
+
+    for (uint32_t off = pool->offset;
+         off + pool->size <= PAGE_SIZE;
+         off += pool->size)
+    {
+        void *buf = (void *)(virtual + off);
+        *(void **)buf = page->free;
+        page->free = buf;
+        ++page->nbufs;
+    }
+
+    return page;
+}
+
+static void free_dma_page(struct dma_page *page)
+{
+    uint32_t virtual = (uint32_t)page;
+
+    dma_free_pages(virtual, 1);
+    kheap_unreserve(virtual, 1);
+}
+
+/**
+ * Allocate a buffer from the pool, storing its physical address in
+ *   *physical
+ */
+void *dma_pool_alloc(struct dma_pool *pool, uint32_t *physical)
+{
+    struct dma_page *page;
+
+    if (pool->partial.next != &pool->partial) {
+        page = LIST_ENTRY(pool->partial.next, struct dma_page, list);
+    }
+    else if (pool->empty.next != &pool->empty) {
+        page = LIST_ENTRY(pool->empty.next, struct dma_page, list);
+        list_remove(&page->list);
+        list_insert(&pool->partial, &page->list);
+        --pool->nempty;
+    }
+    else {
+        page = alloc_dma_page(pool);
+        if (!page) {
+            return NULL;
+        }
+
+        list_insert(&pool->partial, &page->list);
+    }
+
+    void *buf = page->free;
+    page->free = *(void **)buf;
+
+    if (++page->inuse == page->nbufs) {
+        list_remove(&page->list);
+        list_insert(&pool->full, &page->list);
+    }
+
+    *physical = page->physical + ((uint32_t)buf - (uint32_t)page);
+    return buf;
+}
+
+void *dma_pool_zalloc(struct dma_pool *pool, uint32_t *physical)
+{
+    void *buf = dma_pool_alloc(pool, physical);
+    if (buf) {
+        memset(buf, 0, pool->size);
+    }
+
+    return buf;
+}
+
+void dma_pool_free(struct dma_pool *pool, void *buf)
+{
+    if (!buf) {
+        return;
+    }
+
+    struct dma_page *page =
+        (struct dma_page *)align_down((uint32_t)buf, PAGE_SIZE);
+
+    *(void **)buf = page->free;
+    page->free = buf;
+
+    if (page->inuse-- == page->nbufs) {
+        list_remove(&page->list);
+        list_insert(&pool->partial, &page->list);
+    }
+
+    if (page->inuse > 0) {
+        return;
+    }
+
+    list_remove(&page->list);
+
+    if (pool->nempty < DMA_POOL_MAX_EMPTY) {
+        list_insert(&pool->empty, &page->list);
+        ++pool->nempty;
+    }
+    else {
+        free_dma_page(page);
+    }
+}
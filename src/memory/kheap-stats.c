@@ -0,0 +1,60 @@
+#include "memory/kheap.h"
+
+#include "compiler.h"
+#include "macros.h"
+#include "printf.h"
+
+#include "fs/devfs.h"
+#include "memory/pmm.h"
+
+/**
+ * /dev/kheap: how much memory the heap holds (RSS) against how much of it
+ *   is actually allocated
+ */
+static uint32_t kheap_read(file_t __unused *file, uint32_t *offset,
+                           uint32_t size, void *buf)
+{
+    static char text[256];
+
+    struct kheap_stats stats;
+    kheap_get_stats(&stats);
+
+    uint32_t rss = stats.heap_pages * PAGE_SIZE;
+    uint32_t ratio = stats.live_bytes
+        ? rss / (stats.live_bytes / 100 + 1)
+        : 0;
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "heap_pages %u\n"
+                            "rss_bytes %u\n"
+                            "live_bytes %u\n"
+                            "free_bytes %u\n"
+                            "idle_pages %u\n"
+                            "released_pages %u\n"
+                            "large_pages %u\n"
+                            "rss_to_live %u.%u%u\n",
+                            stats.heap_pages,
+                            rss,
+                            stats.live_bytes,
+                            stats.free_bytes,
+                            stats.idle_pages,
+                            stats.released_pages,
+                            stats.large_pages,
+                            ratio / 100, (ratio / 10) % 10, ratio % 10);
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+static struct file_ops kheap_fops = {
+    .read = kheap_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_kheap_stats(void)
+{
+    if (create_device_file(&kheap_fops, "kheap", 0x444) < 0) {
+        PANIC("Unable to create kheap device file!");
+    }
+}
@@ -1,53 +1,75 @@
 #include "memory/kheap.h"
 
+#include "compiler.h"
 #include "errno.h"
 #include "internal.h"
 #include "macros.h"
 #include "printf.h"
 
+#include "memory/ktrace.h"
 #include "memory/pmm.h"
+#include "memory/slab.h"
 #include "memory/vmm.h"
 
-static void insert_dma(struct dma_chunk **list, struct dma_chunk *chunk)
+/**
+ * Whole-page DMA buffers (see dma-pool.h for smaller ones).
+ *
+ * Buffers in use are kept on the dma list. Free ones are kept on free_dma
+ *   sorted by address, so a freed buffer can be merged with its neighbours
+ *   when they're contiguous both virtually and physically.
+ */
+static DEFINE_KMEM_CACHE(dma_chunk_cache, struct dma_chunk, NULL);
+
+static struct dma_chunk *remove_dma(struct dma_chunk **list,
+                                    unsigned long virtual)
 {
-    if (!*list) {
-        *list = chunk;
-        chunk->next = NULL;
-        return;
+    for (struct dma_chunk **curr = list; *curr; curr = &(*curr)->next) {
+        if ((*curr)->virtual == virtual) {
+            struct dma_chunk *chunk = *curr;
+            *curr = chunk->next;
+            return chunk;
+        }
     }
 
-    struct dma_chunk *curr = *list;
-    while (curr->next) {
-        curr = curr->next;
-    }
+    return NULL;
+}
 
-    curr->next = chunk;
-    chunk->next = NULL;
+static bool dma_chunks_adjacent(struct dma_chunk *a, struct dma_chunk *b)
+{
+    return a->virtual + a->size == b->virtual
+        && a->physical + a->size == b->physical;
 }
 
-static struct dma_chunk *remove_dma(struct dma_chunk **list, unsigned long virtual)
+static void insert_free_dma(struct dma_chunk *chunk)
 {
-    struct dma_chunk *curr = *list;
-    struct dma_chunk *next = curr->next;
+    struct dma_chunk *prev = NULL;
+    struct dma_chunk **curr = &free_dma;
 
-    if (curr->virtual == virtual) {
-        *list = next;
-        return curr;
+    while (*curr && (*curr)->virtual < chunk->virtual) {
+        prev = *curr;
+        curr = &(*curr)->next;
     }
 
-    while (next) {
-        if (next->virtual == virtual) {
-            curr->next = next->next;
-            return next;
-        }
+    chunk->next = *curr;
+    *curr = chunk;
+
+    if (chunk->next && dma_chunks_adjacent(chunk, chunk->next)) {
+        struct dma_chunk *next = chunk->next;
+        chunk->size += next->size;
+        chunk->next = next->next;
+        kmem_cache_free(&dma_chunk_cache, next);
     }
 
-    return NULL;
+    if (prev && dma_chunks_adjacent(prev, chunk)) {
+        prev->size += chunk->size;
+        prev->next = chunk->next;
+        kmem_cache_free(&dma_chunk_cache, chunk);
+    }
 }
 
 static bool dma_region_ok(unsigned long physical, unsigned long size)
 {
-    if ((physical & 0xFFFF) + size > 0xFFFF) {
+    if ((physical & 0xFFFF) + size > 0x10000) {
         return false;
     }
     else {
@@ -57,9 +79,8 @@ static bool dma_region_ok(unsigned long physical, unsigned long size)
 
 static struct dma_chunk *find_dma(struct dma_chunk *list, unsigned long size)
 {
-    while (list) {
-        unsigned long physical = get_physical(list->virtual);
-        if (list->size > size && dma_region_ok(physical, size)) {
+    for (; list; list = list->next) {
+        if (list->size >= size && dma_region_ok(list->physical, size)) {
             return list;
         }
     }
@@ -73,55 +94,91 @@ static struct dma_chunk *split_dma(struct dma_chunk *chunk, unsigned long size)
         PANIC("Tried to split DMA chunk into parts larger than the whole!");
     }
 
-    struct dma_chunk *new = kzalloc(MEM_GEN, sizeof(*new));
-    chunk->size -= size;
-    new->size = size;
+    struct dma_chunk *new = kmem_cache_zalloc(&dma_chunk_cache);
+    if (!new) {
+        return NULL;
+    }
+
+    new->size = chunk->size - size;
     new->virtual = chunk->virtual + size;
+    new->physical = chunk->physical + size;
+    chunk->size = size;
 
     return new;
 }
 
-void *kmalloc_dma(unsigned long size)
+static void *alloc_dma(unsigned long size)
 {
-    printf("allocating %x bytes of DMA memory\n", size);
-    size = align(size, PAGE_SIZE);
-
     struct dma_chunk *chunk = find_dma(free_dma, size);
 
     if (chunk) {
-        remove_dma(&free_dma, chunk->virtual);
+        if (chunk->size > size) {
+            struct dma_chunk *rest = split_dma(chunk, size);
+            if (!rest) {
+                errno = ENOMEM;
+                return NULL;
+            }
+
+            rest->next = chunk->next;
+            chunk->next = rest;
+        }
 
-        struct dma_chunk *new = split_dma(chunk, size);
-        insert_dma(&free_dma, new);
-        insert_dma(&dma, chunk);
+        remove_dma(&free_dma, chunk->virtual);
+        chunk->next = dma;
+        dma = chunk;
 
         return (void *)(chunk->virtual);
     }
 
-    int err = dma_alloc_pages(kheap_top, false, true, size / PAGE_SIZE);
-    if (err < 0) {
+    chunk = kmem_cache_zalloc(&dma_chunk_cache);
+    if (!chunk) {
         errno = ENOMEM;
         return NULL;
     }
 
-    unsigned long addr = kheap_top;
-    kheap_top += size;
+    unsigned long virtual = kheap_reserve(size / PAGE_SIZE);
+
+    int err = dma_alloc_pages(virtual, false, true, size / PAGE_SIZE);
+    if (err < 0) {
+        kheap_unreserve(virtual, size / PAGE_SIZE);
+        kmem_cache_free(&dma_chunk_cache, chunk);
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    chunk = kzalloc(MEM_GEN, sizeof(*chunk));
     chunk->size = size;
-    chunk->virtual = addr;
-    insert_dma(&dma, chunk);
+    chunk->virtual = virtual;
+    chunk->physical = get_physical(virtual);
+
+    chunk->next = dma;
+    dma = chunk;
 
     return (void *)(chunk->virtual);
 }
 
+void *kmalloc_dma(unsigned long size)
+{
+    size = align(size, PAGE_SIZE);
+
+    void *ret = alloc_dma(size);
+
+    if (unlikely(ktrace_enabled)) {
+        ktrace_record(KTRACE_DMA_ALLOC, ret, size);
+    }
+
+    return ret;
+}
+
 void kfree_dma(void *virtual)
 {
-    printf("freeing DMA memory at %x\n", virtual);
+    if (unlikely(ktrace_enabled)) {
+        ktrace_record(KTRACE_DMA_FREE, virtual, 0);
+    }
+
     struct dma_chunk *chunk = remove_dma(&dma, (unsigned long)virtual);
     if (!chunk) {
         PANIC("Unable to find DMA chunk to free!");
     }
 
-    insert_dma(&free_dma, chunk);
+    insert_free_dma(chunk);
 }
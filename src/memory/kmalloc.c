@@ -1,247 +1,409 @@
 #include "memory/kheap.h"
 
+#include "bool.h"
+#include "compiler.h"
 #include "errno.h"
 #include "internal.h"
 #include "ldsymbol.h"
 #include "macros.h"
 #include "printf.h"
+#include "spinlock.h"
 #include "string.h"
 
+#include "memory/kprof.h"
+#include "memory/ktrace.h"
 #include "memory/memory.h"
 #include "memory/pmm.h"
+#include "memory/vmalloc.h"
 #include "memory/vmm.h"
 
+/**
+ * General purpose kernel heap: two-level segregated fit (TLSF).
+ *
+ * Free chunks are kept in an array of lists indexed by size class. The first
+ *   level splits sizes by power of two and the second level splits each of
+ *   those linearly into HEAP_SL_COUNT classes; a bitmap per level records
+ *   which lists are non-empty, so a fit is found with a couple of bit scans.
+ *
+ * Every chunk has a boundary tag (its size, and a pointer to the chunk just
+ *   before it in memory), so freed chunks are coalesced with their free
+ *   neighbours in constant time too.
+ *
+ * The heap grows in regions of whole pages taken from kheap_top. Each
+ *   region ends in a zero-sized, in-use sentinel chunk so coalescing never
+ *   runs off the end of it.
+ *
+ * Once a whole region is free again it's kept around while there are no
+ *   more than HEAP_IDLE_PAGES of such idle pages (so alloc/free churn
+ *   doesn't keep mapping and unmapping pages); past that its pages go back
+ *   to the PMM. The freed address range is remembered in a small table of
+ *   holes to be reused by later regions.
+ *
+ * All of it is under heap_lock, taken with interrupts off since interrupt
+ *   handlers allocate too. Large allocations have their own allocator and
+ *   don't take it; the slab, zram and DMA allocators take it only to
+ *   reserve address space through kheap_reserve().
+ */
+#define HEAP_ALIGN_LOG2 3
+#define HEAP_ALIGN (1 << HEAP_ALIGN_LOG2)
+
+#define HEAP_SL_LOG2 4
+#define HEAP_SL_COUNT (1 << HEAP_SL_LOG2)
+
+#define HEAP_FL_SHIFT (HEAP_SL_LOG2 + HEAP_ALIGN_LOG2)
+#define HEAP_FL_MAX 30
+#define HEAP_FL_COUNT (HEAP_FL_MAX - HEAP_FL_SHIFT + 1)
+
+#define HEAP_SMALL (1 << HEAP_FL_SHIFT)
+#define HEAP_LARGE (PAGE_SIZE - CHUNK_HEADER)
+
+#define HEAP_IDLE_PAGES 64
+#define HEAP_MAX_HOLES 64
+
+#define CHUNK_FREE 0x1
+#define CHUNK_SIZE_MASK (~(unsigned long)(HEAP_ALIGN - 1))
+
+#define CHUNK_HEADER offsetof(struct chunk, next_free)
+#define CHUNK_MIN (sizeof(struct chunk) - CHUNK_HEADER)
+
+#define CHUNK_PTR(usr) ((struct chunk *)((char *)(usr) - CHUNK_HEADER))
+#define USER_PTR(chnk) ((void *)((char *)(chnk) + CHUNK_HEADER))
+
+struct chunk {
+    struct chunk *prev_phys;
+    unsigned long size; // payload size | CHUNK_FREE
+
+    // Only valid while the chunk is free
+    struct chunk *next_free;
+    struct chunk *prev_free;
+};
+
 extern ldsymbol ld_heap_start;
 
 unsigned long kheap_top;
-struct chunk *free;
 struct dma_chunk *free_dma;
 struct dma_chunk *dma;
 
-static struct chunk *find_chunk(struct chunk *list, unsigned long size)
+struct hole {
+    unsigned long start;
+    unsigned long pages;
+};
+
+static DEFINE_SPINLOCK(heap_lock);
+
+static struct hole holes[HEAP_MAX_HOLES];
+static uint32_t nholes;
+
+static struct kheap_stats stats;
+
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[HEAP_FL_COUNT];
+static struct chunk *free_lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+
+static int highest_bit(uint32_t x)
 {
-    while (list) {
-        if (list->size >= size) {
-            return list;
-        }
+    return 31 - __builtin_clz(x);
+}
 
-        list = list->next;
-    }
+static int lowest_bit(uint32_t x)
+{
+    return __builtin_ctz(x);
+}
 
-    return NULL;
+static unsigned long chunk_size(const struct chunk *chunk)
+{
+    return chunk->size & CHUNK_SIZE_MASK;
 }
 
-static struct chunk *remove_chunk(struct chunk **list, struct chunk *chunk)
+static bool chunk_is_free(const struct chunk *chunk)
 {
-    if (!list || !chunk) {
-        return NULL;
-    }
+    return chunk->size & CHUNK_FREE;
+}
 
-    if (*list == chunk) {
-        *list = chunk->next;
-    }
-    
-    if (chunk->next) {
-        chunk->next->prev = chunk->prev;
-    }
+static struct chunk *next_phys(const struct chunk *chunk)
+{
+    return (struct chunk *)((char *)USER_PTR(chunk) + chunk_size(chunk));
+}
 
-    if (chunk->prev) {
-        chunk->prev->next = chunk->next;
-    }
+/**
+ * A chunk that fills its whole region (it has no neighbours but the
+ *   sentinel)
+ */
+static bool chunk_is_region(const struct chunk *chunk)
+{
+    return !chunk->prev_phys && next_phys(chunk)->size == 0;
+}
 
-    return chunk;
+static unsigned long region_pages(const struct chunk *chunk)
+{
+    return (chunk_size(chunk) + 2 * CHUNK_HEADER) / PAGE_SIZE;
 }
 
-static struct chunk *split_chunk(struct chunk *chunk, unsigned long size)
+/**
+ * Size class of a chunk of the given size
+ */
+static void mapping_insert(uint32_t size, int *fl, int *sl)
 {
-    if (size + sizeof(unsigned long) > chunk->size) {
-        return NULL;
+    if (size < HEAP_SMALL) {
+        *fl = 0;
+        *sl = size / (HEAP_SMALL / HEAP_SL_COUNT);
+        return;
     }
 
-    unsigned long new_size = chunk->size - sizeof(unsigned long) - size;
-    struct chunk *new = (struct chunk *)(USER_PTR(chunk) + size);
-
-    chunk->size = size;
+    int bit = highest_bit(size);
+    *fl = bit - HEAP_FL_SHIFT + 1;
+    *sl = (size >> (bit - HEAP_SL_LOG2)) ^ HEAP_SL_COUNT;
+}
 
-    new->size = new_size;
-    new->next = NULL;
-    new->prev = NULL;
+/**
+ * Smallest size class whose chunks are all at least the given size
+ */
+static void mapping_search(uint32_t size, int *fl, int *sl)
+{
+    if (size >= HEAP_SMALL) {
+        size += (1UL << (highest_bit(size) - HEAP_SL_LOG2)) - 1;
+    }
 
-    return new;
+    mapping_insert(size, fl, sl);
 }
 
-static void defrag_before(struct chunk *chunk)
+static void insert_free(struct chunk *chunk)
 {
-    while (chunk->prev
-           && (USER_PTR(chunk->prev) + chunk->prev->size == chunk))
-    {
-        chunk->prev->size += chunk->size + sizeof(unsigned long);
-        chunk->prev->next = chunk->next;
+    int fl, sl;
+    mapping_insert(chunk_size(chunk), &fl, &sl);
 
-        if (chunk->next) {
-            chunk->next->prev = chunk->prev;
-        }
+    struct chunk *head = free_lists[fl][sl];
 
-        chunk = chunk->prev;
+    chunk->size |= CHUNK_FREE;
+    chunk->prev_free = NULL;
+    chunk->next_free = head;
+
+    if (head) {
+        head->prev_free = chunk;
     }
-}
 
-static void defrag_after(struct chunk *chunk)
-{
-    while (chunk->next
-           && (USER_PTR(chunk) + chunk->size == chunk->next))
-    {
-        chunk->size += chunk->next->size + sizeof(unsigned long);
-        chunk->next = chunk->next->next;
+    free_lists[fl][sl] = chunk;
+    fl_bitmap |= 1UL << fl;
+    sl_bitmap[fl] |= 1UL << sl;
 
-        if (chunk->next) {
-            chunk->next->prev = chunk;
-        }
+    stats.free_bytes += chunk_size(chunk);
+    if (chunk_is_region(chunk)) {
+        stats.idle_pages += region_pages(chunk);
     }
 }
 
-static void add_before(struct chunk *chunk, struct chunk *new)
+static void remove_free(struct chunk *chunk)
 {
-    if (chunk->prev) {
-        chunk->prev->next = new;
-    }
+    int fl, sl;
+    mapping_insert(chunk_size(chunk), &fl, &sl);
 
-    new->prev = chunk->prev;
-    new->next = chunk;
+    if (chunk->prev_free) {
+        chunk->prev_free->next_free = chunk->next_free;
+    }
+    else {
+        free_lists[fl][sl] = chunk->next_free;
+    }
 
-    chunk->prev = new;
-}
+    if (chunk->next_free) {
+        chunk->next_free->prev_free = chunk->prev_free;
+    }
 
-static void add_after(struct chunk *chunk, struct chunk *new)
-{
-    if (chunk->next) {
-        chunk->next->prev = new;
+    if (!free_lists[fl][sl]) {
+        sl_bitmap[fl] &= ~(1UL << sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~(1UL << fl);
+        }
     }
 
-    new->next = chunk->next;
-    new->prev = chunk;
+    chunk->size &= ~CHUNK_FREE;
 
-    chunk->next = new;
+    stats.free_bytes -= chunk_size(chunk);
+    if (chunk_is_region(chunk)) {
+        stats.idle_pages -= region_pages(chunk);
+    }
 }
 
-static void add_chunk(struct chunk **list, struct chunk *chunk)
+static struct chunk *find_chunk(unsigned long size)
 {
-    if (!list) {
-        return;
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+
+    if (fl >= HEAP_FL_COUNT) {
+        return NULL;
     }
 
-    struct chunk *curr = *list;
+    uint32_t sl_map = sl_bitmap[fl] & (~0UL << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < HEAP_FL_COUNT)
+            ? fl_bitmap & (~0UL << (fl + 1))
+            : 0;
 
-    chunk->next = NULL;
-    chunk->prev = NULL;
+        if (!fl_map) {
+            return NULL;
+        }
 
-    if (!curr) {
-        *list = chunk;
+        fl = lowest_bit(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
 
-        defrag_after(chunk);
+    return free_lists[fl][lowest_bit(sl_map)];
+}
 
+/**
+ * Split the tail off a chunk if it's big enough to make another one, and
+ *   free it
+ */
+static void split_chunk(struct chunk *chunk, unsigned long size)
+{
+    unsigned long total = chunk_size(chunk);
+    if (total < size + CHUNK_HEADER + CHUNK_MIN) {
         return;
     }
 
-    if (curr > chunk) {
-        *list = chunk;
+    struct chunk *rest = (struct chunk *)((char *)USER_PTR(chunk) + size);
+    rest->prev_phys = chunk;
+    rest->size = total - size - CHUNK_HEADER;
+    next_phys(rest)->prev_phys = rest;
 
-        add_before(curr, chunk);
-        defrag_after(chunk);
+    chunk->size = size | (chunk->size & CHUNK_FREE);
 
-        return;
-    }
+    insert_free(rest);
+}
+
+/**
+ * Absorb next (which must be free and follow chunk in memory) into chunk
+ */
+static void merge_chunks(struct chunk *chunk, struct chunk *next)
+{
+    remove_free(next);
 
-    while (curr) {
-        if (curr > chunk) {
-            add_before(curr, chunk);
-            break;
+    chunk->size += chunk_size(next) + CHUNK_HEADER;
+    next_phys(chunk)->prev_phys = chunk;
+}
+
+/**
+ * Find room for a region of the given number of pages, preferring a hole
+ *   left by a released region over the top of the heap
+ */
+static unsigned long reserve_region(unsigned long pages)
+{
+    for (uint32_t i = 0; i < nholes; ++i) {
+        if (holes[i].pages < pages) {
+            continue;
         }
-        else if (!curr->next) {
-            add_after(curr, chunk);
-            break;
+
+        unsigned long start = holes[i].start;
+        holes[i].start += pages * PAGE_SIZE;
+        holes[i].pages -= pages;
+
+        if (!holes[i].pages) {
+            holes[i] = holes[--nholes];
         }
 
-        curr = curr->next;
+        return start;
     }
 
-    defrag_after(chunk);
-    defrag_before(chunk);
+    unsigned long start = kheap_top;
+    kheap_top += pages * PAGE_SIZE;
+
+    return start;
 }
 
-static void *alloc_chunk(unsigned long size)
+/**
+ * Give a region's address space back, merging it with the holes either
+ *   side so they can be reused together, or with the top of the heap
+ */
+static void unreserve_region(unsigned long start, unsigned long pages)
 {
-    int err = alloc_page(kheap_top, 0, 1);
-    if (err < 0) {
-        errno = -ENOMEM;
-        return NULL;
-    }
+    unsigned long end = start + pages * PAGE_SIZE;
 
-    struct chunk *new = (struct chunk *)kheap_top;
-    kheap_top += PAGE_SIZE;
+    for (uint32_t i = 0; i < nholes;) {
+        unsigned long hole_end = holes[i].start + holes[i].pages * PAGE_SIZE;
 
-    new->size = PAGE_SIZE - sizeof(unsigned long);
-    new->next = NULL;
-    new->prev = NULL;
+        if (hole_end == start) {
+            start = holes[i].start;
+        }
+        else if (holes[i].start == end) {
+            end = hole_end;
+        }
+        else {
+            ++i;
+            continue;
+        }
 
-    if (new->size > size) {
-        struct chunk *split = split_chunk(new, size);
-        add_chunk(&free, split);
+        holes[i] = holes[--nholes];
+    }
+
+    if (end == kheap_top) {
+        kheap_top = start;
+        return;
     }
 
-    return USER_PTR(new);
+    // Out of room to remember the range - only the address space is lost
+    if (nholes < HEAP_MAX_HOLES) {
+        holes[nholes].start = start;
+        holes[nholes].pages = (end - start) / PAGE_SIZE;
+        ++nholes;
+    }
 }
 
-static void *kmalloc_general(unsigned long size)
+/**
+ * Map a new region with room for at least size bytes, returning its
+ *   (in-use) chunk
+ */
+static struct chunk *grow_heap(unsigned long size)
 {
-    struct chunk *curr = find_chunk(free, size);
-    if (!curr) {
-        return alloc_chunk(size);
+    unsigned long pages = align(size + 2 * CHUNK_HEADER, PAGE_SIZE) / PAGE_SIZE;
+    unsigned long start = reserve_region(pages);
+
+    int err = alloc_pages(start, 0, 1, pages);
+    if (err < 0) {
+        unreserve_region(start, pages);
+        return NULL;
     }
 
-    remove_chunk(&free, curr);
+    struct chunk *chunk = (struct chunk *)start;
+    chunk->prev_phys = NULL;
+    chunk->size = pages * PAGE_SIZE - 2 * CHUNK_HEADER;
 
-    if (curr->size > size + sizeof(*curr)) {
-        struct chunk *new = split_chunk(curr, size);
-        add_chunk(&free, new);
-    }
+    struct chunk *sentinel = next_phys(chunk);
+    sentinel->prev_phys = chunk;
+    sentinel->size = 0;
+
+    stats.heap_pages += pages;
 
-    return USER_PTR(curr);
+    return chunk;
 }
 
-static void *kmalloc_large(unsigned long size)
+/**
+ * Give a free region's pages back to the PMM
+ */
+static void release_region(struct chunk *chunk)
 {
-    unsigned long alloc_size = size + sizeof(struct chunk);
-    unsigned long aligned_size = align(alloc_size, PAGE_SIZE);
-    unsigned long num_pages = aligned_size / PAGE_SIZE;
+    unsigned long start = (unsigned long)chunk;
+    unsigned long pages = region_pages(chunk);
 
-    int err = alloc_pages(kheap_top, 0, 1, num_pages);
-    if (err < 0) {
-        errno = ENOMEM;
-        return NULL;
+    for (unsigned long i = 0; i < pages; ++i) {
+        free_page(start + i * PAGE_SIZE);
     }
 
-    struct chunk *chunk = (struct chunk *)kheap_top;
-    chunk->size = aligned_size - sizeof(struct chunk);
-    chunk->next = NULL;
-    chunk->prev = NULL;
+    unreserve_region(start, pages);
 
-    if (size < chunk->size - sizeof(struct chunk)) {
-        struct chunk *new = split_chunk(chunk, size);
-        add_chunk(&free, new);
-    }
+    stats.heap_pages -= pages;
+    stats.released_pages += pages;
+}
 
-    kheap_top += aligned_size;
-    
-    return USER_PTR(chunk);
+static void *kmalloc_large(uint32_t size)
+{
+    return vmalloc(size);
 }
 
-void *kmalloc(kmem_type_t type, unsigned long size)
+static void *heap_alloc(kmem_type_t type, uint32_t size)
 {
     if (size == 0) {
         return NULL;
     }
-    
+
     if (type == MEM_DMA) {
         return kmalloc_dma(size);
     }
@@ -249,12 +411,62 @@ void *kmalloc(kmem_type_t type, unsigned long size)
         return NULL;
     }
 
-    size = align(size, sizeof(unsigned long) * 2);
-    if (size > PAGE_SIZE - sizeof(struct chunk)) {
+    if (size > HEAP_LARGE) {
         return kmalloc_large(size);
     }
 
-    return kmalloc_general(size);
+    unsigned long csize = align(size, HEAP_ALIGN);
+    if (csize < CHUNK_MIN) {
+        csize = CHUNK_MIN;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    struct chunk *chunk = find_chunk(csize);
+    if (chunk) {
+        remove_free(chunk);
+    }
+    else {
+        chunk = grow_heap(csize);
+        if (!chunk) {
+            spin_unlock_irqrestore(&heap_lock, flags);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    split_chunk(chunk, csize);
+    stats.live_bytes += chunk_size(chunk);
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    return USER_PTR(chunk);
+}
+
+/**
+ * Allocate, charging the allocation to site if the profiler is running and
+ *   recording it if allocations are being traced (DMA buffers are traced
+ *   by kmalloc_dma() itself)
+ */
+static void *instrumented_alloc(kmem_type_t type, uint32_t size,
+                                const void *site)
+{
+    void *ret = heap_alloc(type, size);
+
+    if (unlikely(kprof_enabled)) {
+        kprof_alloc(site, ret, size);
+    }
+
+    if (unlikely(ktrace_enabled) && type == MEM_GEN) {
+        ktrace_record(KTRACE_ALLOC, ret, size);
+    }
+
+    return ret;
+}
+
+void *kmalloc(kmem_type_t type, uint32_t size)
+{
+    return instrumented_alloc(type, size, __builtin_return_address(0));
 }
 
 void kfree(void *address)
@@ -263,52 +475,142 @@ void kfree(void *address)
         return;
     }
 
-    if (check_dma_address((unsigned long)address)) {
+    if (unlikely(kprof_enabled)) {
+        kprof_free(address);
+    }
+
+    if (check_dma_address(get_physical((unsigned long)address))) {
         kfree_dma(address);
         return;
     }
 
+    if (unlikely(ktrace_enabled)) {
+        ktrace_record(KTRACE_FREE, address, 0);
+    }
+
+    if (is_vmalloc_addr(address)) {
+        vfree(address);
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
     struct chunk *chunk = CHUNK_PTR(address);
+    stats.live_bytes -= chunk_size(chunk);
+
+    struct chunk *next = next_phys(chunk);
+    if (chunk_is_free(next)) {
+        merge_chunks(chunk, next);
+    }
+
+    struct chunk *prev = chunk->prev_phys;
+    if (prev && chunk_is_free(prev)) {
+        remove_free(prev);
+        prev->size += chunk_size(chunk) + CHUNK_HEADER;
+        next_phys(prev)->prev_phys = prev;
+        chunk = prev;
+    }
+
+    if (chunk_is_region(chunk)
+        && stats.idle_pages + region_pages(chunk) > HEAP_IDLE_PAGES)
+    {
+        release_region(chunk);
+    }
+    else {
+        insert_free(chunk);
+    }
 
-    chunk->next = NULL;
-    chunk->prev = NULL;
-    add_chunk(&free, chunk);
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 void *kcalloc(kmem_type_t type, uint32_t num, uint32_t size)
 {
-    void *ret = kmalloc(type, size * num);
-    memset(ret, 0, size * num);
+    void *ret = instrumented_alloc(type, size * num,
+                                   __builtin_return_address(0));
+    if (ret) {
+        memset(ret, 0, size * num);
+    }
+
     return ret;
 }
 
 void *kzalloc(kmem_type_t type, uint32_t size)
 {
-    void *ret = kcalloc(type, 1, size);
+    void *ret = instrumented_alloc(type, size, __builtin_return_address(0));
+    if (ret) {
+        memset(ret, 0, size);
+    }
+
     return ret;
 }
 
+void kheap_get_stats(struct kheap_stats *out)
+{
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    out->large_pages = vmalloc_used_pages();
+}
+
+/**
+ * Reserve pages of heap address space for an allocator that maps its own
+ *   pages (slabs, zram and DMA), sharing the heap's holes
+ */
+unsigned long kheap_reserve(unsigned long pages)
+{
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    unsigned long start = reserve_region(pages);
+    spin_unlock_irqrestore(&heap_lock, flags);
+
+    return start;
+}
+
+/**
+ * Give back address space from kheap_reserve(), once its pages are unmapped
+ */
+void kheap_unreserve(unsigned long start, unsigned long pages)
+{
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    unreserve_region(start, pages);
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void print_chunk_list(void)
+{
+    for (int fl = 0; fl < HEAP_FL_COUNT; ++fl) {
+        for (int sl = 0; sl < HEAP_SL_COUNT; ++sl) {
+            for (struct chunk *chunk = free_lists[fl][sl];
+                 chunk;
+                 chunk = chunk->next_free)
+            {
+                printf("free chunk %x: %u bytes\n", chunk, chunk_size(chunk));
+            }
+        }
+    }
+}
+
 void init_kheap(void)
 {
     puts("Initializing kernel heap...\n");
     kheap_top = align((unsigned long)ld_heap_start, PAGE_SIZE);
-    
-    int err = alloc_page(kheap_top, 0, 1);
-    if (err < 0) {
-        PANIC("Unable to allocate pages for the kernel heap!");
-    }
 
-    struct chunk *chunk = (struct chunk *)kheap_top;
-    chunk->size = PAGE_SIZE - sizeof(unsigned long);
-    chunk->next = NULL;
-    chunk->prev = NULL;
+    nholes = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    memset(free_lists, 0, sizeof(free_lists));
 
-    free = NULL;
     dma = NULL;
     free_dma = NULL;
 
-    add_chunk(&free, chunk);
-    kheap_top += PAGE_SIZE;
+    struct chunk *chunk = grow_heap(PAGE_SIZE - 2 * CHUNK_HEADER);
+    if (!chunk) {
+        PANIC("Unable to allocate pages for the kernel heap!");
+    }
+
+    insert_free(chunk);
 
     puts("Initialized kernel heap!\n");
 }
@@ -0,0 +1,280 @@
+#include "memory/kprof.h"
+
+#include "algorithm.h"
+#include "cpu.h"
+#include "macros.h"
+#include "printf.h"
+#include "string.h"
+
+#include "device/timer.h"
+#include "fs/devfs.h"
+#include "memory/memory.h"
+
+/**
+ * Two open-addressed hash tables with linear probing: call sites, which are
+ *   only ever added until the next reset, and live blocks, which remember
+ *   the site and size of each block so kfree() can credit them back. Live
+ *   blocks are removed by shifting the rest of their probe run back, so no
+ *   tombstones are needed. Anything that doesn't fit is counted as dropped.
+ */
+struct kprof_site {
+    uint32_t site;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+    uint32_t total_bytes;
+};
+
+struct kprof_block {
+    uint32_t ptr;
+    uint32_t site; // index into sites, valid while ptr is set
+    uint32_t size;
+};
+
+bool kprof_enabled;
+
+static struct kprof_site sites[KPROF_MAX_SITES];
+static struct kprof_block live[KPROF_MAX_LIVE];
+static uint32_t nsites;
+static uint32_t nlive;
+static uint32_t dropped;
+static uint32_t start_ticks;
+
+static uint32_t hash(uint32_t key)
+{
+    return (key >> 3) * 2654435761U;
+}
+
+static struct kprof_site *find_site(uint32_t site)
+{
+    uint32_t i = hash(site) % KPROF_MAX_SITES;
+
+    for (uint32_t n = 0; n < KPROF_MAX_SITES; ++n) {
+        if (sites[i].site == site) {
+            return &sites[i];
+        }
+
+        if (!sites[i].site) {
+            if (nsites == KPROF_MAX_SITES - 1) {
+                return NULL;
+            }
+
+            ++nsites;
+            sites[i].site = site;
+            return &sites[i];
+        }
+
+        i = (i + 1) % KPROF_MAX_SITES;
+    }
+
+    return NULL;
+}
+
+static struct kprof_block *find_block(uint32_t ptr)
+{
+    uint32_t i = hash(ptr) % KPROF_MAX_LIVE;
+
+    while (live[i].ptr) {
+        if (live[i].ptr == ptr) {
+            return &live[i];
+        }
+
+        i = (i + 1) % KPROF_MAX_LIVE;
+    }
+
+    return NULL;
+}
+
+static bool add_block(uint32_t ptr, uint32_t site, uint32_t size)
+{
+    if (nlive == KPROF_MAX_LIVE - 1) {
+        return false;
+    }
+
+    uint32_t i = hash(ptr) % KPROF_MAX_LIVE;
+    while (live[i].ptr) {
+        i = (i + 1) % KPROF_MAX_LIVE;
+    }
+
+    live[i].ptr = ptr;
+    live[i].site = site;
+    live[i].size = size;
+    ++nlive;
+
+    return true;
+}
+
+static void remove_block(struct kprof_block *block)
+{
+    uint32_t hole = block - live;
+    uint32_t i = hole;
+
+    for (;;) {
+        i = (i + 1) % KPROF_MAX_LIVE;
+        if (!live[i].ptr) {
+            break;
+        }
+
+        // Move the entry back into the hole unless its home slot lies
+        //   cyclically between the hole and where it sits now
+        uint32_t home = hash(live[i].ptr) % KPROF_MAX_LIVE;
+        if ((i > hole && (home <= hole || home > i))
+            || (i < hole && home <= hole && home > i))
+        {
+            live[hole] = live[i];
+            hole = i;
+        }
+    }
+
+    live[hole].ptr = 0;
+    --nlive;
+}
+
+void kprof_alloc(const void *site, const void *ptr, uint32_t size)
+{
+    if (!ptr) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+
+    struct kprof_site *s = find_site((uint32_t)site);
+    if (!s || !add_block((uint32_t)ptr, s - sites, size)) {
+        ++dropped;
+        irq_restore(flags);
+        return;
+    }
+
+    ++s->allocs;
+    s->total_bytes += size;
+    s->live_bytes += size;
+    if (s->live_bytes > s->peak_bytes) {
+        s->peak_bytes = s->live_bytes;
+    }
+
+    irq_restore(flags);
+}
+
+void kprof_free(const void *ptr)
+{
+    uint32_t flags = irq_save();
+
+    // Blocks allocated before profiling started aren't tracked
+    struct kprof_block *block = find_block((uint32_t)ptr);
+    if (block) {
+        struct kprof_site *s = &sites[block->site];
+        ++s->frees;
+        s->live_bytes -= block->size;
+        remove_block(block);
+    }
+
+    irq_restore(flags);
+}
+
+static void kprof_reset(void)
+{
+    memset(sites, 0, sizeof(sites));
+    memset(live, 0, sizeof(live));
+    nsites = 0;
+    nlive = 0;
+    dropped = 0;
+    start_ticks = ticks;
+}
+
+static uint32_t kprof_read(file_t __unused *file, uint32_t *offset,
+                           uint32_t size, void *buf)
+{
+    static char text[16384];
+    static uint8_t order[KPROF_MAX_SITES];
+
+    uint32_t flags = irq_save();
+
+    // Sort the sites by live bytes, then peak bytes
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < KPROF_MAX_SITES; ++i) {
+        if (!sites[i].site) {
+            continue;
+        }
+
+        uint32_t j = n++;
+        for (; j > 0; --j) {
+            struct kprof_site *prev = &sites[order[j - 1]];
+            if (prev->live_bytes > sites[i].live_bytes
+                || (prev->live_bytes == sites[i].live_bytes
+                    && prev->peak_bytes >= sites[i].peak_bytes))
+            {
+                break;
+            }
+
+            order[j] = order[j - 1];
+        }
+
+        order[j] = i;
+    }
+
+    uint32_t elapsed = ticks - start_ticks;
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "enabled %u\n"
+                            "elapsed_ticks %u\n"
+                            "tick_hz %u\n"
+                            "live_blocks %u\n"
+                            "dropped %u\n"
+                            "site live_bytes peak_bytes total_bytes "
+                            "allocs frees allocs_per_sec\n",
+                            kprof_enabled, elapsed, TIMER_HZ,
+                            nlive, dropped);
+
+    for (uint32_t i = 0; i < n && len < sizeof(text); ++i) {
+        struct kprof_site *s = &sites[order[i]];
+        uint32_t rate = elapsed ? s->allocs * TIMER_HZ / elapsed : 0;
+
+        len += snprintf(text + len, sizeof(text) - len,
+                        "%x %u %u %u %u %u %u\n",
+                        s->site, s->live_bytes, s->peak_bytes,
+                        s->total_bytes, s->allocs, s->frees, rate);
+    }
+
+    irq_restore(flags);
+
+    return devfs_read_text(text, min(len, sizeof(text) - 1), offset,
+                           size, buf);
+}
+
+static uint32_t kprof_write(file_t __unused *file, uint32_t __unused *offset,
+                            uint32_t size, void *buf)
+{
+    uint32_t flags = irq_save();
+
+    if (size >= 2 && !strncmp(buf, "on", 2)) {
+        if (!kprof_enabled) {
+            kprof_reset();
+            kprof_enabled = true;
+        }
+    }
+    else if (size >= 3 && !strncmp(buf, "off", 3)) {
+        kprof_enabled = false;
+    }
+    else if (size >= 5 && !strncmp(buf, "reset", 5)) {
+        kprof_reset();
+    }
+
+    irq_restore(flags);
+
+    return size;
+}
+
+static struct file_ops kprof_fops = {
+    .read = kprof_read,
+    .write = kprof_write,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_kprof(void)
+{
+    if (create_device_file(&kprof_fops, "kprof", 0x666) < 0) {
+        PANIC("Unable to create kprof device file!");
+    }
+}
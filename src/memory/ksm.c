@@ -0,0 +1,497 @@
+#include "memory/ksm.h"
+
+#include "compiler.h"
+#include "cpu.h"
+#include "errno.h"
+#include "ldsymbol.h"
+#include "macros.h"
+#include "printf.h"
+#include "task.h"
+
+#include "fs/devfs.h"
+#include "memory/kheap.h"
+#include "memory/memory.h"
+#include "memory/vmm.h"
+
+#define KSM_HASH_BITS 8
+#define KSM_HASH_SIZE (1 << KSM_HASH_BITS)
+#define KSM_UNSTABLE_MAX 512
+#define KSM_NONE 0xFFFF
+
+extern ldsymbol ld_virtual_offset;
+
+/**
+ * Same-page merging
+ *
+ * While the system is idle, user pages are hashed and compared against
+ *   each other. Identical pages are collapsed onto a single frame that is
+ *   mapped read-only (with PG_KSM set) into every address space that had a
+ *   copy. The first write to a merged page faults, and ksm_fault() gives
+ *   the writer its own copy back.
+ *
+ * Merged frames are tracked in the stable table, indexed both by content
+ *   hash (to find merge targets) and by frame (to find the node on a write
+ *   fault or unmap). Pages seen during the current pass that haven't been
+ *   merged yet go in the unstable table, which is thrown away at the end of
+ *   each full pass as its contents may have changed since.
+ */
+struct ksm_node {
+    struct ksm_node *next_hash;
+    struct ksm_node *next_frame;
+    uint32_t frame;
+    uint32_t hash;
+    uint32_t refs;
+};
+
+struct ksm_candidate {
+    address_space_t *as;
+    uint32_t virtual;
+    uint32_t frame;
+    uint32_t hash;
+    uint16_t next;
+};
+
+static struct ksm_node *stable_hash[KSM_HASH_SIZE];
+static struct ksm_node *stable_frame[KSM_HASH_SIZE];
+
+static struct ksm_candidate unstable[KSM_UNSTABLE_MAX];
+static uint16_t unstable_hash[KSM_HASH_SIZE];
+static uint32_t nunstable;
+
+static struct {
+    uint32_t shared;
+    uint32_t sharing;
+    uint32_t scanned;
+    uint32_t passes;
+    uint32_t merges;
+    uint32_t cow_breaks;
+} kstat;
+
+static uint32_t hash_page(const uint32_t *page)
+{
+    uint32_t h = 2166136261u;
+
+    for (uint32_t i = 0; i < PAGE_SIZE / 4; ++i) {
+        h = (h ^ page[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+static uint32_t bucket(uint32_t key)
+{
+    return (key ^ (key >> KSM_HASH_BITS) ^ (key >> 16)) & (KSM_HASH_SIZE - 1);
+}
+
+static bool frames_equal(uint32_t a, const void *page)
+{
+    uint32_t virtual = map_physical(a);
+    bool equal = memcmp((void *)virtual, page, PAGE_SIZE) == 0;
+    unmap_page(virtual);
+
+    return equal;
+}
+
+/**
+ * Page table entry access for address spaces that may not be current
+ */
+static uint32_t read_pte(address_space_t *as, uint32_t virtual)
+{
+    uint32_t pde = (uint32_t)as->pgdir[DIRINDEX(virtual)];
+    if (!PG_IS_PRESENT(pde)) {
+        return 0;
+    }
+
+    uint32_t *pt = (uint32_t *)map_physical(PG_FRAME(pde));
+    uint32_t pte = pt[TBLINDEX(virtual)];
+    unmap_page((uint32_t)pt);
+
+    return pte;
+}
+
+static void write_pte(address_space_t *as, uint32_t virtual, uint32_t pte)
+{
+    uint32_t pde = (uint32_t)as->pgdir[DIRINDEX(virtual)];
+    uint32_t *pt = (uint32_t *)map_physical(PG_FRAME(pde));
+    pt[TBLINDEX(virtual)] = pte;
+    unmap_page((uint32_t)pt);
+
+    if (current_task && current_task->as == as) {
+        flush_tlb(virtual);
+    }
+}
+
+static uint32_t merged_pte(uint32_t frame)
+{
+    return frame | PG_KSM | PG_USER | PG_PRESENT;
+}
+
+static struct ksm_node *find_frame(uint32_t frame)
+{
+    struct ksm_node *node = stable_frame[bucket(frame >> 12)];
+
+    while (node && node->frame != frame) {
+        node = node->next_frame;
+    }
+
+    return node;
+}
+
+static void insert_node(struct ksm_node *node)
+{
+    uint32_t h = bucket(node->hash);
+    uint32_t f = bucket(node->frame >> 12);
+
+    node->next_hash = stable_hash[h];
+    stable_hash[h] = node;
+
+    node->next_frame = stable_frame[f];
+    stable_frame[f] = node;
+
+    ++kstat.shared;
+}
+
+static void remove_node(struct ksm_node *node)
+{
+    struct ksm_node **pp = &stable_hash[bucket(node->hash)];
+    while (*pp != node) {
+        pp = &(*pp)->next_hash;
+    }
+    *pp = node->next_hash;
+
+    pp = &stable_frame[bucket(node->frame >> 12)];
+    while (*pp != node) {
+        pp = &(*pp)->next_frame;
+    }
+    *pp = node->next_frame;
+
+    --kstat.shared;
+    kfree(node);
+}
+
+/**
+ * Drop one reference to a merged frame, freeing the frame along with the
+ *   last reference unless keep is set (the last user keeps the frame as its
+ *   private copy).
+ */
+static void put_node(struct ksm_node *node, bool keep)
+{
+    if (--node->refs > 0) {
+        --kstat.sharing;
+        return;
+    }
+
+    if (!keep) {
+        uint32_t virtual = map_physical(node->frame);
+        free_frame(virtual);
+        unmap_page(virtual);
+    }
+
+    remove_node(node);
+}
+
+static struct ksm_node *find_stable(uint32_t hash, const void *page)
+{
+    for (struct ksm_node *node = stable_hash[bucket(hash)];
+         node;
+         node = node->next_hash)
+    {
+        if (node->hash == hash && frames_equal(node->frame, page)) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static uint16_t *find_unstable(uint32_t hash, uint32_t frame, const void *page)
+{
+    uint16_t *pi = &unstable_hash[bucket(hash)];
+
+    while (*pi != KSM_NONE) {
+        struct ksm_candidate *c = &unstable[*pi];
+
+        if (c->hash == hash && c->frame != frame) {
+            uint32_t pte = read_pte(c->as, c->virtual);
+
+            if (PG_IS_PRESENT(pte) && !(pte & PG_KSM)
+                && PG_FRAME(pte) == c->frame
+                && frames_equal(c->frame, page))
+            {
+                return pi;
+            }
+        }
+
+        pi = &c->next;
+    }
+
+    return NULL;
+}
+
+static void add_unstable(address_space_t *as, uint32_t virtual,
+                         uint32_t frame, uint32_t hash)
+{
+    if (nunstable == KSM_UNSTABLE_MAX) {
+        return;
+    }
+
+    struct ksm_candidate *c = &unstable[nunstable];
+    c->as = as;
+    c->virtual = virtual;
+    c->frame = frame;
+    c->hash = hash;
+    c->next = unstable_hash[bucket(hash)];
+
+    unstable_hash[bucket(hash)] = nunstable++;
+}
+
+/**
+ * Try to merge one present, writeable user page. Runs with interrupts off.
+ */
+static void merge_page(address_space_t *as, uint32_t virtual, uint32_t pte)
+{
+    uint32_t frame = PG_FRAME(pte);
+    uint32_t page = map_physical(frame);
+    uint32_t hash = hash_page((uint32_t *)page);
+
+    ++kstat.scanned;
+
+    struct ksm_node *node = find_stable(hash, (void *)page);
+    if (node) {
+        write_pte(as, virtual, merged_pte(node->frame));
+        free_frame(page);
+
+        ++node->refs;
+        ++kstat.sharing;
+        ++kstat.merges;
+        goto out;
+    }
+
+    uint16_t *pi = find_unstable(hash, frame, (void *)page);
+    if (!pi) {
+        add_unstable(as, virtual, frame, hash);
+        goto out;
+    }
+
+    node = kzalloc(MEM_GEN, sizeof(*node));
+    if (!node) {
+        goto out;
+    }
+
+    struct ksm_candidate *c = &unstable[*pi];
+    *pi = c->next; // unlinked, the slot is reclaimed at the end of the pass
+
+    node->frame = c->frame;
+    node->hash = hash;
+    node->refs = 2;
+    insert_node(node);
+
+    write_pte(c->as, c->virtual, merged_pte(c->frame));
+    write_pte(as, virtual, merged_pte(c->frame));
+    free_frame(page);
+
+    ++kstat.sharing;
+    ++kstat.merges;
+
+ out:
+    unmap_page(page);
+}
+
+/**
+ * Scan up to budget pages of an address space, starting at *virtual and
+ *   leaving *virtual where the next scan should pick up (ld_virtual_offset
+ *   once the whole address space has been covered).
+ */
+uint32_t ksm_scan(address_space_t *as, uint32_t *virtual, uint32_t budget)
+{
+    uint32_t end = (uint32_t)ld_virtual_offset;
+    uint32_t scanned = 0;
+
+    while (*virtual < end && scanned < budget) {
+        uint32_t pde = (uint32_t)as->pgdir[DIRINDEX(*virtual)];
+        if (!PG_IS_PRESENT(pde)) {
+            *virtual = align(*virtual + 1, 0x400000);
+            continue;
+        }
+
+        uint32_t flags = irq_save();
+        uint32_t pte = read_pte(as, *virtual);
+
+        if (PG_IS_PRESENT(pte) && PG_IS_USERMODE(pte)
+            && PG_IS_WRITEABLE(pte) && !(pte & PG_KSM))
+        {
+            merge_page(as, *virtual, pte);
+            ++scanned;
+        }
+
+        irq_restore(flags);
+        *virtual += PAGE_SIZE;
+    }
+
+    return scanned;
+}
+
+/**
+ * Forget the unstable candidates once every address space has been covered
+ */
+void ksm_end_pass(void)
+{
+    uint32_t flags = irq_save();
+
+    for (uint32_t i = 0; i < KSM_HASH_SIZE; ++i) {
+        unstable_hash[i] = KSM_NONE;
+    }
+    nunstable = 0;
+    ++kstat.passes;
+
+    irq_restore(flags);
+}
+
+/**
+ * Forget any candidates from an address space that's going away
+ */
+void ksm_forget(address_space_t *as)
+{
+    uint32_t flags = irq_save();
+
+    for (uint32_t i = 0; i < KSM_HASH_SIZE; ++i) {
+        uint16_t *pi = &unstable_hash[i];
+
+        while (*pi != KSM_NONE) {
+            if (unstable[*pi].as == as) {
+                *pi = unstable[*pi].next;
+            }
+            else {
+                pi = &unstable[*pi].next;
+            }
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Write fault on a merged page: give the current address space a private,
+ *   writeable copy. Returns 0 if the fault was handled.
+ */
+int ksm_fault(uint32_t virtual)
+{
+    if (virtual >= (uint32_t)ld_virtual_offset) {
+        return -EFAULT;
+    }
+
+    uint32_t **pde = get_page_directory_entry(virtual);
+    if (!PG_IS_PRESENT((uint32_t)*pde)) {
+        return -EFAULT;
+    }
+
+    uint32_t *page = get_page(virtual);
+    if (!PG_IS_PRESENT(*page) || !(*page & PG_KSM)) {
+        return -EFAULT;
+    }
+
+    int err = 0;
+    uint32_t flags = irq_save();
+    uint32_t frame = PG_FRAME(*page);
+    struct ksm_node *node = find_frame(frame);
+
+    if (node && node->refs > 1) {
+        uint32_t new = alloc_frame();
+        if (!new) {
+            err = -ENOMEM;
+            goto out;
+        }
+
+        uint32_t vnew = map_physical(new);
+        memcpy((void *)vnew, (void *)align_down(virtual, PAGE_SIZE), PAGE_SIZE);
+        unmap_page(vnew);
+
+        put_node(node, false);
+        frame = new;
+    }
+    else if (node) {
+        put_node(node, true);
+    }
+
+    *page = frame | PG_WRITEABLE | PG_USER | PG_PRESENT;
+    flush_tlb(virtual);
+    ++kstat.cow_breaks;
+
+ out:
+    irq_restore(flags);
+    return err;
+}
+
+/**
+ * A merged page is being mapped into another address space (fork)
+ */
+uint32_t ksm_share(uint32_t pte)
+{
+    uint32_t flags = irq_save();
+
+    struct ksm_node *node = find_frame(PG_FRAME(pte));
+    if (node) {
+        ++node->refs;
+        ++kstat.sharing;
+    }
+
+    irq_restore(flags);
+    return pte;
+}
+
+/**
+ * A merged page is being unmapped
+ */
+void ksm_unshare(uint32_t pte)
+{
+    uint32_t flags = irq_save();
+
+    struct ksm_node *node = find_frame(PG_FRAME(pte));
+    if (node) {
+        put_node(node, false);
+    }
+
+    irq_restore(flags);
+}
+
+static uint32_t ksm_read(file_t __unused *file, uint32_t *offset,
+                         uint32_t size, void *buf)
+{
+    static char text[256];
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "pages_shared %u\n"
+                            "pages_sharing %u\n"
+                            "pages_scanned %u\n"
+                            "full_scans %u\n"
+                            "merges %u\n"
+                            "cow_breaks %u\n",
+                            kstat.shared,
+                            kstat.sharing,
+                            kstat.scanned,
+                            kstat.passes,
+                            kstat.merges,
+                            kstat.cow_breaks);
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+static struct file_ops ksm_fops = {
+    .read = ksm_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_ksm(void)
+{
+    for (uint32_t i = 0; i < KSM_HASH_SIZE; ++i) {
+        unstable_hash[i] = KSM_NONE;
+    }
+
+    if (create_device_file(&ksm_fops, "ksm", 0x444) < 0) {
+        PANIC("Unable to create ksm device file!");
+    }
+
+    printf("Initialized same-page merging\n");
+}
@@ -0,0 +1,117 @@
+#include "memory/ktrace.h"
+
+#include "algorithm.h"
+#include "compiler.h"
+#include "cpu.h"
+#include "macros.h"
+#include "string.h"
+
+#include "fs/devfs.h"
+#include "memory/memory.h"
+#include "memory/vmalloc.h"
+
+bool ktrace_enabled;
+
+/* head and tail run freely; records live at their value mod KTRACE_RECORDS */
+static struct ktrace_record *ring;
+static uint32_t head;
+static uint32_t tail;
+static uint32_t lost;
+
+static void push(enum ktrace_op op, uint32_t ptr, uint32_t size)
+{
+    struct ktrace_record *record = &ring[head++ % KTRACE_RECORDS];
+
+    record->timestamp = rdtsc();
+    record->ptr = ptr;
+    record->size = size;
+    record->op = op;
+}
+
+void ktrace_record(enum ktrace_op op, const void *ptr, uint32_t size)
+{
+    if (!ptr || !ring) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+
+    // Leave room to say how many records were lost before this one
+    if (head - tail > KTRACE_RECORDS - (lost ? 2 : 1)) {
+        ++lost;
+    }
+    else {
+        if (lost) {
+            push(KTRACE_LOST, 0, lost);
+            lost = 0;
+        }
+
+        push(op, (uint32_t)ptr, size);
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Hand out as many whole records as fit in buf, removing them from the ring
+ */
+static uint32_t ktrace_read(file_t __unused *file, uint32_t __unused *offset,
+                            uint32_t size, void *buf)
+{
+    if (!ring) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+
+    uint32_t n = min(size / sizeof(struct ktrace_record), head - tail);
+    struct ktrace_record *out = buf;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        out[i] = ring[tail++ % KTRACE_RECORDS];
+    }
+
+    irq_restore(flags);
+
+    return n * sizeof(struct ktrace_record);
+}
+
+static uint32_t ktrace_write(file_t __unused *file,
+                             uint32_t __unused *offset,
+                             uint32_t size, void *buf)
+{
+    if (size >= 2 && !strncmp(buf, "on", 2)) {
+        if (!ring) {
+            ring = vmalloc(KTRACE_RECORDS * sizeof(struct ktrace_record));
+            if (!ring) {
+                return 0;
+            }
+        }
+
+        uint32_t flags = irq_save();
+        head = 0;
+        tail = 0;
+        lost = 0;
+        ktrace_enabled = true;
+        irq_restore(flags);
+    }
+    else if (size >= 3 && !strncmp(buf, "off", 3)) {
+        ktrace_enabled = false;
+    }
+
+    return size;
+}
+
+static struct file_ops ktrace_fops = {
+    .read = ktrace_read,
+    .write = ktrace_write,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_ktrace(void)
+{
+    if (create_device_file(&ktrace_fops, "ktrace", 0x666) < 0) {
+        PANIC("Unable to create ktrace device file!");
+    }
+}
@@ -6,6 +6,7 @@
 #include "macros.h"
 #include "mboot.h"
 #include "printf.h"
+#include "spinlock.h"
 #include <stdint.h>
 #include "task.h"
 
@@ -13,8 +14,10 @@
 #include "device/interrupt.h"
 #include "device/terminal.h"
 #include "memory/kheap.h"
+#include "memory/ksm.h"
 #include "memory/memory.h"
 #include "memory/vmm.h"
+#include "memory/zram.h"
 
 #define for_each_mmap_entry(entry, end, mboot)                                  \
     for (entry = (memory_map_t *)(mboot->mmap_addr),                            \
@@ -33,11 +36,20 @@
 #define PMM_DMA_SIZE 1 * MBYTE
 #define PMM_DMA_NPAGES (PMM_DMA_SIZE / PAGE_SIZE)
 
+#define CR0_WP (1 << 16)
+
 extern ldsymbol ld_virtual_offset;
 extern ldsymbol ld_virtual_end;
 extern ldsymbol ld_physical_end;
 
+/*
+ * Every CPU comes here for page faults, forks and the heap, so the frame
+ *   allocator gets a queue lock. Interrupt handlers allocate frames too.
+ */
+static DEFINE_MCS_LOCK(pmm_lock);
+
 static uint32_t free_stack_top;
+static uint32_t nr_free_frames;
 static uint32_t dma_bitmap[PMM_DMA_NPAGES / 32];
 
 /**
@@ -137,22 +149,33 @@ bool check_dma_address(uint32_t physical)
 
 uint32_t dma_alloc_frames(uint32_t n)
 {
+    struct mcs_node node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+    uint32_t ret = 0;
+
     for (uint32_t physical = dma_start();
          physical < dma_end();
          physical += PAGE_SIZE)
     {
         if (dma_frames_are_free(physical, n)) {
             dma_set_frames(physical, n, true);
-            return physical;
+            ret = physical;
+            break;
         }
     }
 
-    return 0;
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+    return ret;
 }
 
 void dma_free_frames(uint32_t physical, uint32_t n)
 {
+    struct mcs_node node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+
     dma_set_frames(physical, n, false);
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
 }
 
 /**
@@ -165,10 +188,20 @@ void dma_free_frames(uint32_t physical, uint32_t n)
  */
 uint32_t alloc_frame()
 {
+    struct mcs_node node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+
     uint32_t ret = free_stack_top;
+    if (!ret) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+        return 0;
+    }
 
     uint32_t virtual = map_physical(ret);
     memcpy(&free_stack_top, (void *)virtual, sizeof(free_stack_top));
+    --nr_free_frames;
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
 
     // TODO: this probably could be zeroed somewhere better,
     // it's unlikely we need to zero it every time we allocate a frame
@@ -180,8 +213,19 @@ uint32_t alloc_frame()
 
 void free_frame(uint32_t virtual)
 {
+    struct mcs_node node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+
     memcpy((void *)virtual, &free_stack_top, sizeof(free_stack_top));
     free_stack_top = get_physical(virtual);
+    ++nr_free_frames;
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+}
+
+uint32_t pmm_free_frames(void)
+{
+    return nr_free_frames;
 }
 
 /**
@@ -257,6 +301,9 @@ static uint32_t init_pmm_general(multiboot_info_t *mboot)
     stack -= ((uint32_t)ld_virtual_offset / sizeof(uint32_t));
     *stack = 0;
 
+    uint32_t *nfree = &nr_free_frames;
+    nfree -= ((uint32_t)ld_virtual_offset / sizeof(uint32_t));
+
     uint32_t count = 0;
 
     for (uint32_t address = dma_end();
@@ -270,6 +317,7 @@ static uint32_t init_pmm_general(multiboot_info_t *mboot)
         }
     }
 
+    *nfree = count;
     return count;
 }
 
@@ -299,6 +347,14 @@ static void page_fault_handler(registers_t *regs)
     uint32_t address;
     asm volatile ("mov %%cr2, %0" : "=r"(address) : : );
 
+    if (!(regs->error & 0x1) && zram_fault(address) == 0) {
+        return;
+    }
+
+    if ((regs->error & 0x3) == 0x3 && ksm_fault(address) == 0) {
+        return;
+    }
+
     if (current_task) {
         printf("[PAGE FAULT] current_task: %d\n", current_task->pid);
     }
@@ -340,4 +396,11 @@ static void page_fault_handler(registers_t *regs)
 void init_paging()
 {
     register_interrupt_handler(0x0E, &page_fault_handler);
+
+    // Make kernel writes honour read-only user pages, so writes through
+    //   user pointers to merged pages fault and get copied too
+    uint32_t cr0;
+    asm volatile ("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_WP;
+    asm volatile ("mov %0, %%cr0" : : "r"(cr0));
 }
@@ -0,0 +1,177 @@
+#include "memory/slab.h"
+
+#include "algorithm.h"
+#include "compiler.h"
+#include "internal.h"
+#include "macros.h"
+
+#include "memory/memory.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+#define SLAB_NO_OBJ 0xFF
+
+/**
+ * Slab allocator
+ *
+ * Each slab is one page: a header followed by the objects. Free objects are
+ *   chained by index through the header rather than through the objects
+ *   themselves, so constructed objects are left intact while free. Slabs
+ *   are kept on their cache's partial, full and empty lists, and an object
+ *   finds its slab by rounding its address down to the page.
+ *
+ * Slab pages are reserved from the kernel heap's address space. When an
+ *   empty slab is given back its frame is freed and its address returned
+ *   to the heap.
+ */
+struct slab {
+    struct list list;
+    struct kmem_cache *cache;
+    uint8_t free;
+    uint8_t inuse;
+    uint8_t next[SLAB_MAX_OBJS];
+};
+
+#define SLAB_HEADER align(sizeof(struct slab), SLAB_ALIGN)
+
+static void *slab_obj(struct slab *slab, uint32_t i)
+{
+    return (void *)slab + SLAB_HEADER + i * slab->cache->size;
+}
+
+static void setup_cache(struct kmem_cache *cache)
+{
+    cache->size = align(cache->size, SLAB_ALIGN);
+    if (cache->size > PAGE_SIZE - SLAB_HEADER) {
+        PANIC("Slab cache object too large!");
+    }
+
+    cache->objs_per_slab = min((PAGE_SIZE - SLAB_HEADER) / cache->size,
+                               (uint32_t)SLAB_MAX_OBJS);
+}
+
+static struct slab *alloc_slab(struct kmem_cache *cache)
+{
+    uint32_t virtual = kheap_reserve(1);
+
+    if (alloc_page(virtual, 0, 1) < 0) {
+        kheap_unreserve(virtual, 1);
+        return NULL;
+    }
+
+    struct slab *slab = (struct slab *)virtual;
+    slab->cache = cache;
+    slab->free = 0;
+    slab->inuse = 0;
+
+    for (uint32_t i = 0; i < cache->objs_per_slab; ++i) {
+        slab->next[i] = (i + 1 < cache->objs_per_slab) ? i + 1 : SLAB_NO_OBJ;
+
+        if (cache->ctor) {
+            cache->ctor(slab_obj(slab, i));
+        }
+    }
+
+    ++cache->nslabs;
+    return slab;
+}
+
+static void free_slab(struct slab *slab)
+{
+    uint32_t virtual = (uint32_t)slab;
+
+    --slab->cache->nslabs;
+    free_page(virtual);
+    kheap_unreserve(virtual, 1);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (!cache->objs_per_slab) {
+        setup_cache(cache);
+    }
+
+    struct slab *slab;
+
+    if (cache->partial.next != &cache->partial) {
+        slab = LIST_ENTRY(cache->partial.next, struct slab, list);
+    }
+    else if (cache->empty.next != &cache->empty) {
+        slab = LIST_ENTRY(cache->empty.next, struct slab, list);
+        list_remove(&slab->list);
+        list_insert(&cache->partial, &slab->list);
+        --cache->nempty;
+    }
+    else {
+        slab = alloc_slab(cache);
+        if (!slab) {
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return NULL;
+        }
+
+        list_insert(&cache->partial, &slab->list);
+    }
+
+    void *obj = slab_obj(slab, slab->free);
+    slab->free = slab->next[slab->free];
+
+    if (++slab->inuse == cache->objs_per_slab) {
+        list_remove(&slab->list);
+        list_insert(&cache->full, &slab->list);
+    }
+
+    ++cache->active;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache)
+{
+    void *obj = kmem_cache_alloc(cache);
+    if (obj) {
+        memset(obj, 0, cache->size);
+    }
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    if (!obj) {
+        return;
+    }
+
+    struct slab *slab = (struct slab *)align_down((uint32_t)obj, PAGE_SIZE);
+    if (slab->cache != cache) {
+        PANIC("Object freed to the wrong slab cache!");
+    }
+
+    uint32_t i = ((uint32_t)obj - (uint32_t)slab_obj(slab, 0)) / cache->size;
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+
+    slab->next[i] = slab->free;
+    slab->free = i;
+    --cache->active;
+
+    if (slab->inuse-- == cache->objs_per_slab) {
+        list_remove(&slab->list);
+        list_insert(&cache->partial, &slab->list);
+    }
+
+    if (slab->inuse == 0) {
+        list_remove(&slab->list);
+
+        if (cache->nempty < SLAB_MAX_EMPTY) {
+            list_insert(&cache->empty, &slab->list);
+            ++cache->nempty;
+        }
+        else {
+            free_slab(slab);
+        }
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
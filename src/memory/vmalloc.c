@@ -0,0 +1,286 @@
+#include "memory/vmalloc.h"
+
+#include "algorithm.h"
+#include "compiler.h"
+#include "cpu.h"
+#include "errno.h"
+#include "macros.h"
+#include "rbtree.h"
+
+#include "memory/memory.h"
+#include "memory/pmm.h"
+#include "memory/slab.h"
+#include "memory/vmm.h"
+
+/**
+ * The vmalloc range is carved into areas, allocated and free alike, kept in
+ *   one red-black tree ordered by address. Each node also caches the size
+ *   of the largest free area in its subtree, so the lowest free area big
+ *   enough for a request is found in a single walk down the tree.
+ *
+ * An area's size includes its guard page. Freed areas are merged with free
+ *   neighbours straight away, so free areas are never adjacent.
+ */
+struct vm_area {
+    struct rb_node node;
+    uint32_t start;
+    uint32_t size;
+    bool free;
+    uint32_t max_free; // largest free area in this subtree
+};
+
+#define AREA(n) RB_ENTRY(n, struct vm_area, node)
+
+static void area_augment(struct rb_node *node);
+
+static struct rb_root areas = RB_ROOT_AUGMENTED(area_augment);
+static uint32_t used_pages;
+
+static DEFINE_KMEM_CACHE(area_cache, struct vm_area, NULL);
+
+static uint32_t subtree_max_free(struct rb_node *node)
+{
+    return node ? AREA(node)->max_free : 0;
+}
+
+static void area_augment(struct rb_node *node)
+{
+    struct vm_area *area = AREA(node);
+
+    area->max_free = max(subtree_max_free(node->left),
+                         subtree_max_free(node->right));
+    if (area->free) {
+        area->max_free = max(area->max_free, area->size);
+    }
+}
+
+static void insert_area(struct vm_area *area)
+{
+    struct rb_node **link = &areas.node;
+    struct rb_node *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        link = area->start < AREA(parent)->start
+            ? &parent->left
+            : &parent->right;
+    }
+
+    rb_link_node(&area->node, parent, link);
+    rb_insert_color(&area->node, &areas);
+}
+
+static void remove_area(struct vm_area *area)
+{
+    rb_erase(&area->node, &areas);
+    kmem_cache_free(&area_cache, area);
+}
+
+/**
+ * Find the lowest free area of at least size bytes
+ */
+static struct vm_area *find_free(uint32_t size)
+{
+    struct rb_node *node = areas.node;
+
+    while (node) {
+        struct vm_area *area = AREA(node);
+
+        if (subtree_max_free(node->left) >= size) {
+            node = node->left;
+        }
+        else if (area->free && area->size >= size) {
+            return area;
+        }
+        else if (subtree_max_free(node->right) >= size) {
+            node = node->right;
+        }
+        else {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static struct vm_area *find_area(uint32_t start)
+{
+    struct rb_node *node = areas.node;
+
+    while (node) {
+        struct vm_area *area = AREA(node);
+
+        if (start == area->start) {
+            return area;
+        }
+
+        node = start < area->start ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+/**
+ * Mark an area free again, merging it with the free areas either side
+ */
+static void release_area(struct vm_area *area)
+{
+    area->free = true;
+
+    struct rb_node *next = rb_next(&area->node);
+    if (next && AREA(next)->free) {
+        area->size += AREA(next)->size;
+        remove_area(AREA(next));
+    }
+
+    struct rb_node *prev = rb_prev(&area->node);
+    if (prev && AREA(prev)->free) {
+        AREA(prev)->size += area->size;
+        remove_area(area);
+        area = AREA(prev);
+    }
+
+    rb_augment_path(&area->node, &areas);
+}
+
+static void unmap_area(struct vm_area *area, uint32_t pages)
+{
+    for (uint32_t i = 1; i <= pages; ++i) {
+        free_page(area->start + i * PAGE_SIZE);
+    }
+}
+
+/**
+ * Take the lowest free area of at least need bytes, splitting off the rest
+ */
+static struct vm_area *alloc_area(uint32_t need)
+{
+    struct vm_area *area = find_free(need);
+    if (!area) {
+        return NULL;
+    }
+
+    if (area->size > need) {
+        struct vm_area *rest = kmem_cache_alloc(&area_cache);
+        if (!rest) {
+            return NULL;
+        }
+
+        rest->start = area->start + need;
+        rest->size = area->size - need;
+        rest->free = true;
+
+        area->size = need;
+        area->free = false;
+        rb_augment_path(&area->node, &areas);
+        insert_area(rest);
+    }
+    else {
+        area->free = false;
+        rb_augment_path(&area->node, &areas);
+    }
+
+    return area;
+}
+
+void *vmalloc(uint32_t size)
+{
+    if (size == 0 || size > VMALLOC_END - VMALLOC_START - PAGE_SIZE) {
+        return NULL;
+    }
+
+    uint32_t pages = align(size, PAGE_SIZE) / PAGE_SIZE;
+    uint32_t need = (pages + 1) * PAGE_SIZE;
+
+    uint32_t flags = irq_save();
+
+    struct vm_area *area = alloc_area(need);
+    if (!area) {
+        goto error;
+    }
+
+    for (uint32_t i = 1; i <= pages; ++i) {
+        if (alloc_page(area->start + i * PAGE_SIZE, 0, 1) < 0) {
+            unmap_area(area, i - 1);
+            release_area(area);
+            goto error;
+        }
+    }
+
+    used_pages += pages;
+
+    irq_restore(flags);
+    return (void *)(area->start + PAGE_SIZE);
+
+ error:
+    irq_restore(flags);
+    errno = ENOMEM;
+    return NULL;
+}
+
+void vfree(void *address)
+{
+    if (!address) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+
+    struct vm_area *area = find_area((uint32_t)address - PAGE_SIZE);
+    if (!area || area->free) {
+        PANIC("vfree of an address vmalloc didn't hand out!");
+    }
+
+    uint32_t pages = area->size / PAGE_SIZE - 1;
+    unmap_area(area, pages);
+    used_pages -= pages;
+
+    release_area(area);
+
+    irq_restore(flags);
+}
+
+/**
+ * Map size bytes of device registers at physical into the vmalloc range.
+ *   The mapping is for good: device memory isn't ours to vfree().
+ */
+void *ioremap(uint32_t physical, uint32_t size)
+{
+    uint32_t offset = physical & (PAGE_SIZE - 1);
+    uint32_t pages = align(offset + size, PAGE_SIZE) / PAGE_SIZE;
+
+    uint32_t flags = irq_save();
+
+    struct vm_area *area = alloc_area((pages + 1) * PAGE_SIZE);
+    if (!area) {
+        irq_restore(flags);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < pages; ++i) {
+        map_page(area->start + (i + 1) * PAGE_SIZE,
+                 PG_FRAME(physical) + i * PAGE_SIZE, 0, 1);
+    }
+
+    irq_restore(flags);
+    return (void *)(area->start + PAGE_SIZE + offset);
+}
+
+uint32_t vmalloc_used_pages(void)
+{
+    return used_pages;
+}
+
+void init_vmalloc(void)
+{
+    struct vm_area *area = kmem_cache_alloc(&area_cache);
+    if (!area) {
+        PANIC("Unable to allocate initial vmalloc area!");
+    }
+
+    area->start = VMALLOC_START;
+    area->size = VMALLOC_END - VMALLOC_START;
+    area->free = true;
+
+    insert_area(area);
+}
@@ -1,19 +1,31 @@
 #include "memory/vmm.h"
 
+#include "cpu.h"
 #include "errno.h"
 #include "ldsymbol.h"
 #include "macros.h"
 #include "printf.h"
 
-
 #include "memory/memory.h"
 #include "memory/pmm.h"
+#include "memory/zram.h"
 
+extern ldsymbol ld_virtual_offset;
 extern ldsymbol ld_temp_pages;
 extern ldsymbol ld_temp_pages_end;
 
-static int map_page(uint32_t virtual, uint32_t physical,
-                    uint8_t readonly, uint8_t kernel);
+/**
+ * Kernel page tables are shared by every CPU, but invlpg only flushes the
+ *   TLB of the CPU it runs on. So unmapping a kernel page bumps
+ *   kernel_tlb_gen, and each CPU flushes its whole TLB when it next takes
+ *   the kernel lock, if it's behind (see smp.c). Kernel code only runs
+ *   under the kernel lock, so no CPU uses a stale kernel mapping.
+ *
+ * Temporary mappings don't count: map_page() flushes the page on the CPU
+ *   that maps it, and only that CPU uses it before it's unmapped again.
+ */
+static uint32_t kernel_tlb_gen;
+static uint32_t cpu_tlb_gen[NR_CPUS];
 
 /**
  * The following three functions return information associated with
@@ -74,6 +86,31 @@ void flush_tlb(uint32_t virtual)
     asm volatile ("invlpg (%0)" : : "r"(virtual) : );
 }
 
+void flush_tlb_all(void)
+{
+    uint32_t cr3;
+
+    asm volatile ("mov %%cr3, %0\n\t"
+                  "mov %0, %%cr3\n\t"
+                  : "=r"(cr3) : : "memory");
+}
+
+static bool is_temp_page(uint32_t virtual)
+{
+    return virtual >= (uint32_t)ld_temp_pages
+        && virtual < (uint32_t)ld_temp_pages_end;
+}
+
+void sync_kernel_tlb(void)
+{
+    uint32_t cpu = cpu_id();
+
+    if (cpu_tlb_gen[cpu] != kernel_tlb_gen) {
+        cpu_tlb_gen[cpu] = kernel_tlb_gen;
+        flush_tlb_all();
+    }
+}
+
 void unmap_page(uint32_t virtual)
 {
     uint32_t **direntry = get_page_directory_entry(virtual);
@@ -90,6 +127,11 @@ void unmap_page(uint32_t virtual)
 
     *page = 0;
     flush_tlb(virtual);
+
+    if (virtual >= (uint32_t)ld_virtual_offset && !is_temp_page(virtual)) {
+        ++kernel_tlb_gen;
+        cpu_tlb_gen[cpu_id()] = kernel_tlb_gen;
+    }
 }
 
 static void unmap_pages(uint32_t virtual, uint32_t n)
@@ -112,8 +154,8 @@ void set_page_attributes(uint32_t *page, bool present,
     else *page &= ~PG_PRESENT;
 }
 
-static int map_page(uint32_t virtual, uint32_t physical,
-                    uint8_t readonly, uint8_t kernel)
+int map_page(uint32_t virtual, uint32_t physical,
+             uint8_t readonly, uint8_t kernel)
 {
     uint32_t **direntry = get_page_directory_entry(virtual);
 
@@ -216,6 +258,11 @@ bool check_user_ptr(const void __user *ptr)
     }
 
     uint32_t *page = get_page((uint32_t)ptr);
+    if (ZRAM_PTE_IS_STORED(*page)) {
+        // Faulted back in when the kernel touches it
+        return PG_IS_USERMODE(*page);
+    }
+
     if (!PG_IS_PRESENT(*page) || !PG_IS_USERMODE(*page)) {
         return false;
     }
@@ -0,0 +1,274 @@
+#include "memory/wss.h"
+
+#include "algorithm.h"
+#include "compiler.h"
+#include "cpu.h"
+#include "ldsymbol.h"
+#include "macros.h"
+#include "preempt.h"
+#include "printf.h"
+#include "smp.h"
+#include "task.h"
+#include "workqueue.h"
+
+#include "device/timer.h"
+#include "fs/devfs.h"
+#include "memory/kheap.h"
+#include "memory/memory.h"
+#include "memory/vmm.h"
+#include "memory/zram.h"
+
+extern ldsymbol ld_virtual_offset;
+
+/**
+ * Working-set estimation
+ *
+ * Every WSS_SCAN_TICKS the accessed bits of each address space's user pages
+ *   are sampled and cleared. A page's age counts the scans since it was last
+ *   seen accessed, so the pages with an age under WSS_WINDOW make up the
+ *   working set, and the rest are candidates for reclaim (see zram.c).
+ *
+ * The scans are started by a timer and run on the workqueue, so they keep
+ *   going however busy the CPUs are. Each pass gives the CPU up between
+ *   address spaces if it's wanted.
+ */
+static void wss_timer_fn(struct timer *timer);
+static void wss_work_fn(struct work *work);
+
+static struct timer wss_timer;
+static DEFINE_WORK(wss_work, wss_work_fn);
+
+static uint32_t wss_pass;
+
+static uint32_t age_bucket(uint32_t age)
+{
+    uint32_t bucket = 0;
+
+    while (age && bucket < WSS_NBUCKETS - 1) {
+        age >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+static void scan_table(uint32_t *pt, uint8_t *ages, uint32_t base,
+                       bool current, struct wss_stats *stats)
+{
+    for (uint32_t i = 0; i < PAGE_SIZE / 4; ++i) {
+        uint32_t pte = pt[i];
+
+        if (ZRAM_PTE_IS_STORED(pte)) {
+            ages[i] = min(ages[i] + 1, 0xFF);
+            ++stats->mapped;
+            continue;
+        }
+
+        if (!PG_IS_PRESENT(pte) || !PG_IS_USERMODE(pte)) {
+            ages[i] = 0;
+            continue;
+        }
+
+        if (PG_IS_ACCESSED(pte)) {
+            pt[i] = pte & ~PG_ACCESSED;
+            ages[i] = 0;
+
+            if (current) {
+                flush_tlb(base + i * PAGE_SIZE);
+            }
+        }
+        else {
+            ages[i] = min(ages[i] + 1, 0xFF);
+        }
+
+        ++stats->mapped;
+        ++stats->resident;
+        ++stats->hist[age_bucket(ages[i])];
+
+        if (ages[i] < WSS_WINDOW) {
+            ++stats->wss;
+        }
+
+        if (PG_IS_DIRTY(pte)) {
+            ++stats->dirty;
+        }
+    }
+}
+
+/**
+ * Sample and clear the accessed bits of an address space, aging the pages
+ *   that weren't touched since the last scan
+ */
+void wss_scan(address_space_t *as)
+{
+    if (!as || !as->pgdir) {
+        return;
+    }
+
+    if (!as->wss) {
+        as->wss = kzalloc(MEM_GEN, sizeof(*as->wss));
+        if (!as->wss) {
+            return;
+        }
+    }
+
+    struct wss *wss = as->wss;
+    struct wss_stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    // Live in our page tables, for the task running here or a kernel
+    //   thread running on its tables
+    bool current = this_cpu()->as == as;
+
+    for (uint32_t dir = 0; dir < DIRINDEX((uint32_t)ld_virtual_offset); ++dir) {
+        uint32_t pde = (uint32_t)as->pgdir[dir];
+        if (!PG_IS_PRESENT(pde)) {
+            continue;
+        }
+
+        if (!wss->ages[dir]) {
+            wss->ages[dir] = kzalloc(MEM_GEN, PAGE_SIZE / 4);
+            if (!wss->ages[dir]) {
+                continue;
+            }
+        }
+
+        uint32_t flags = irq_save();
+        uint32_t *pt = (uint32_t *)map_physical(PG_FRAME(pde));
+
+        scan_table(pt, wss->ages[dir], dir << 22, current, &stats);
+
+        unmap_page((uint32_t)pt);
+        irq_restore(flags);
+    }
+
+    ++wss->scans;
+    wss->stats = stats;
+}
+
+/**
+ * Number of scans since the page at virtual was last seen accessed, or 0 if
+ *   it hasn't been scanned yet
+ */
+uint32_t wss_page_age(const address_space_t *as, uint32_t virtual)
+{
+    if (!as->wss || !as->wss->ages[DIRINDEX(virtual)]) {
+        return 0;
+    }
+
+    return as->wss->ages[DIRINDEX(virtual)][TBLINDEX(virtual)];
+}
+
+void wss_free(address_space_t *as)
+{
+    if (!as->wss) {
+        return;
+    }
+
+    for (uint32_t dir = 0; dir < 1024; ++dir) {
+        kfree(as->wss->ages[dir]);
+    }
+
+    kfree(as->wss);
+    as->wss = NULL;
+}
+
+static bool scanned_this_pass(address_space_t *as)
+{
+    return as->wss && as->wss->pass == wss_pass;
+}
+
+/**
+ * Sample every task's address space. Tasks can exit while we're switched
+ *   out, so the walk goes by pid, picking up after the last task it got to;
+ *   address spaces shared by tasks this pass has already done are skipped.
+ *   A task whose scan couldn't allocate is passed over until the next pass.
+ */
+static void wss_work_fn(struct work __unused *work)
+{
+    uint32_t flags = irq_save();
+    uint32_t pid = 0;
+    struct task *task;
+
+    ++wss_pass;
+
+    while ((task = task_next_by_pid(pid))) {
+        pid = task->pid;
+
+        if (task_skip_scan(task) || scanned_this_pass(task->as)) {
+            continue;
+        }
+
+        wss_scan(task->as);
+        if (task->as->wss) {
+            task->as->wss->pass = wss_pass;
+        }
+
+        cond_resched();
+    }
+
+    irq_restore(flags);
+}
+
+static void wss_timer_fn(struct timer *timer)
+{
+    queue_work(&wss_work);
+    timer_add(timer, ticks + WSS_SCAN_TICKS);
+}
+
+static uint32_t wss_read(file_t __unused *file, uint32_t *offset,
+                         uint32_t size, void *buf)
+{
+    struct devfs_text text = DEVFS_TEXT_INIT(*offset, size, buf);
+
+    devfs_printf(&text,
+                 "scan_interval_ticks %u\n"
+                 "window_scans %u\n"
+                 "pid mapped resident wss dirty "
+                 "age0 age1 age2-3 age4-7 age8-15 age16-31 "
+                 "age32-63 age64+\n",
+                 WSS_SCAN_TICKS, WSS_WINDOW);
+
+    uint32_t flags = irq_save();
+
+    for (struct task *task = task_first(); task; task = task_next(task)) {
+        if (!task->as || !task->as->wss) {
+            continue;
+        }
+
+        struct wss_stats *stats = &task->as->wss->stats;
+
+        devfs_printf(&text, "%u %u %u %u %u",
+                     task->pid, stats->mapped, stats->resident,
+                     stats->wss, stats->dirty);
+
+        for (uint32_t i = 0; i < WSS_NBUCKETS; ++i) {
+            devfs_printf(&text, " %u", stats->hist[i]);
+        }
+
+        devfs_printf(&text, "\n");
+    }
+
+    irq_restore(flags);
+
+    return devfs_text_done(&text, offset);
+}
+
+static struct file_ops wss_fops = {
+    .read = wss_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_wss(void)
+{
+    if (create_device_file(&wss_fops, "wss", 0x444) < 0) {
+        PANIC("Unable to create wss device file!");
+    }
+
+    timer_setup(&wss_timer, wss_timer_fn);
+    timer_add(&wss_timer, ticks + WSS_SCAN_TICKS);
+
+    printf("Initialized working-set estimation\n");
+}
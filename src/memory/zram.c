@@ -0,0 +1,495 @@
+#include "memory/zram.h"
+
+#include "compiler.h"
+#include "cpu.h"
+#include "errno.h"
+#include "internal.h"
+#include "ldsymbol.h"
+#include "list.h"
+#include "lzf.h"
+#include "macros.h"
+#include "printf.h"
+#include "task.h"
+
+#include "device/clock.h"
+#include "fs/devfs.h"
+#include "memory/kheap.h"
+#include "memory/memory.h"
+#include "memory/vmm.h"
+#include "memory/wss.h"
+
+#define ZRAM_MAX_STORE (PAGE_SIZE * 3 / 4)
+#define ZRAM_CLASS_SIZE 64
+#define ZRAM_NCLASSES (ZRAM_MAX_STORE / ZRAM_CLASS_SIZE)
+#define ZRAM_NO_ENTRY 0xFFFFFFFF
+
+extern ldsymbol ld_virtual_offset;
+
+/**
+ * Compressed in-memory swap
+ *
+ * Cold user pages are compressed into a pool and their frames returned to
+ *   the PMM. The page table entry is left not-present with PG_ZRAM set (see
+ *   zram.h), so the next touch faults and zram_fault() decompresses the page
+ *   into a fresh frame.
+ *
+ * The pool is made of pages that each hold objects of a single size class,
+ *   ZRAM_CLASS_SIZE bytes apart. Free objects are threaded into a list
+ *   through their first word. Pool pages are reserved from the kernel heap's
+ *   address space, and when every object in one is freed its frame goes
+ *   back to the PMM and its address to the heap.
+ *
+ * Pages that don't compress to within ZRAM_MAX_STORE bytes stay resident.
+ */
+struct zpage {
+    struct list list;
+    uint32_t virtual;
+    void *free;
+    uint32_t nfree;
+};
+
+struct zclass {
+    uint32_t size;
+    struct list partial;
+    struct list full;
+};
+
+struct zram_entry {
+    struct zpage *page;
+    void *obj;
+    uint32_t len; // index of the next free entry while unused
+};
+
+static struct zclass classes[ZRAM_NCLASSES];
+
+static struct zram_entry *entries;
+static uint32_t nentries;
+static uint32_t free_entries = ZRAM_NO_ENTRY;
+
+static uint8_t zbuf[ZRAM_MAX_STORE];
+
+static struct {
+    uint32_t stored;
+    uint32_t compr_bytes;
+    uint32_t pool_pages;
+    uint32_t swapouts;
+    uint32_t swapins;
+    uint32_t rejected;
+    uint32_t decomp_avg_ns;
+    uint32_t decomp_max_ns;
+} zstat;
+
+static struct zclass *zclass_of(uint32_t len)
+{
+    return &classes[(len - 1) / ZRAM_CLASS_SIZE];
+}
+
+static struct zpage *zpage_alloc(struct zclass *class)
+{
+    struct zpage *zp = kzalloc(MEM_GEN, sizeof(*zp));
+    if (!zp) {
+        return NULL;
+    }
+
+    zp->virtual = kheap_reserve(1);
+
+    if (alloc_page(zp->virtual, 0, 1) < 0) {
+        kheap_unreserve(zp->virtual, 1);
+        kfree(zp);
+        return NULL;
+    }
+
+    zp->free = NULL;
+    zp->nfree = 0;
+
+    for (uint32_t off = 0; off + class->size <= PAGE_SIZE; off += class->size) {
+        void *obj = (void *)(zp->virtual + off);
+        *(void **)obj = zp->free;
+        zp->free = obj;
+        ++zp->nfree;
+    }
+
+    list_insert(&class->partial, &zp->list);
+    ++zstat.pool_pages;
+
+    return zp;
+}
+
+static void *zpool_alloc(uint32_t len, struct zpage **page)
+{
+    struct zclass *class = zclass_of(len);
+    struct zpage *zp;
+
+    if (class->partial.next != &class->partial) {
+        zp = LIST_ENTRY(class->partial.next, struct zpage, list);
+    }
+    else {
+        zp = zpage_alloc(class);
+        if (!zp) {
+            return NULL;
+        }
+    }
+
+    void *obj = zp->free;
+    zp->free = *(void **)obj;
+
+    if (--zp->nfree == 0) {
+        list_remove(&zp->list);
+        list_insert(&class->full, &zp->list);
+    }
+
+    *page = zp;
+    return obj;
+}
+
+static void zpool_free(struct zpage *zp, void *obj, uint32_t len)
+{
+    struct zclass *class = zclass_of(len);
+
+    *(void **)obj = zp->free;
+    zp->free = obj;
+
+    if (zp->nfree++ == 0) {
+        list_remove(&zp->list);
+        list_insert(&class->partial, &zp->list);
+    }
+
+    if (zp->nfree == PAGE_SIZE / class->size) {
+        list_remove(&zp->list);
+        free_page(zp->virtual);
+        kheap_unreserve(zp->virtual, 1);
+        kfree(zp);
+        --zstat.pool_pages;
+    }
+}
+
+static uint32_t alloc_entry(void)
+{
+    if (free_entries == ZRAM_NO_ENTRY) {
+        uint32_t n = nentries ? nentries * 2 : 256;
+        if (n > ZRAM_MAX_ENTRIES) {
+            n = ZRAM_MAX_ENTRIES;
+        }
+
+        if (n == nentries) {
+            return ZRAM_NO_ENTRY;
+        }
+
+        struct zram_entry *new = kmalloc(MEM_GEN, n * sizeof(*new));
+        if (!new) {
+            return ZRAM_NO_ENTRY;
+        }
+
+        memcpy(new, entries, nentries * sizeof(*new));
+        kfree(entries);
+
+        for (uint32_t i = nentries; i < n; ++i) {
+            new[i].page = NULL;
+            new[i].len = (i + 1 < n) ? i + 1 : ZRAM_NO_ENTRY;
+        }
+
+        free_entries = nentries;
+        entries = new;
+        nentries = n;
+    }
+
+    uint32_t handle = free_entries;
+    free_entries = entries[handle].len;
+
+    return handle;
+}
+
+static void release_entry(uint32_t handle)
+{
+    entries[handle].page = NULL;
+    entries[handle].len = free_entries;
+    free_entries = handle;
+}
+
+/**
+ * Compress the page mapped by *pte into the pool, and replace the entry
+ *   with a zram entry. The caller is responsible for flushing the TLB.
+ */
+static int zram_store(uint32_t *pte)
+{
+    uint32_t virtual = map_physical(PG_FRAME(*pte));
+    if (!virtual) {
+        return -ENOMEM;
+    }
+
+    int err = 0;
+    uint32_t len = lzf_compress((void *)virtual, PAGE_SIZE,
+                                zbuf, ZRAM_MAX_STORE);
+    if (!len) {
+        ++zstat.rejected;
+        err = -EINVAL;
+        goto out;
+    }
+
+    uint32_t handle = alloc_entry();
+    if (handle == ZRAM_NO_ENTRY) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    struct zpage *zp;
+    void *obj = zpool_alloc(len, &zp);
+    if (!obj) {
+        release_entry(handle);
+        err = -ENOMEM;
+        goto out;
+    }
+
+    memcpy(obj, zbuf, len);
+    entries[handle].page = zp;
+    entries[handle].obj = obj;
+    entries[handle].len = len;
+
+    *pte = ZRAM_PTE(handle, *pte);
+    free_frame(virtual);
+
+    ++zstat.stored;
+    ++zstat.swapouts;
+    zstat.compr_bytes += len;
+
+ out:
+    unmap_page(virtual);
+    return err;
+}
+
+static struct zram_entry *pte_entry(uint32_t pte)
+{
+    uint32_t handle = ZRAM_PTE_HANDLE(pte);
+    if (!ZRAM_PTE_IS_STORED(pte) || handle >= nentries
+        || !entries[handle].page)
+    {
+        return NULL;
+    }
+
+    return &entries[handle];
+}
+
+static void drop_entry(uint32_t pte)
+{
+    struct zram_entry *entry = pte_entry(pte);
+
+    --zstat.stored;
+    zstat.compr_bytes -= entry->len;
+
+    zpool_free(entry->page, entry->obj, entry->len);
+    release_entry(ZRAM_PTE_HANDLE(pte));
+}
+
+/**
+ * Decompress the page for a zram entry into a new frame, and point the
+ *   entry back at it.
+ */
+static int zram_load(uint32_t *pte)
+{
+    struct zram_entry *entry = pte_entry(*pte);
+    if (!entry) {
+        return -EINVAL;
+    }
+
+    uint32_t frame = alloc_frame();
+    if (!frame) {
+        return -ENOMEM;
+    }
+
+    uint32_t virtual = map_physical(frame);
+
+    uint64_t start = rdtsc();
+    uint32_t len = lzf_decompress(entry->obj, entry->len,
+                                  (void *)virtual, PAGE_SIZE);
+    uint32_t ns = cycles_to_ns(rdtsc() - start);
+
+    unmap_page(virtual);
+
+    if (len != PAGE_SIZE) {
+        PANIC("zram: corrupt compressed page!");
+    }
+
+    drop_entry(*pte);
+    *pte = frame | (*pte & (PG_WRITEABLE | PG_USER)) | PG_PRESENT;
+
+    ++zstat.swapins;
+    zstat.decomp_avg_ns = zstat.decomp_avg_ns - zstat.decomp_avg_ns / 8
+        + ns / 8;
+    if (ns > zstat.decomp_max_ns) {
+        zstat.decomp_max_ns = ns;
+    }
+
+    return 0;
+}
+
+/**
+ * Page fault hook: bring back a page of the current address space that was
+ *   compressed. Returns 0 if the fault was handled.
+ */
+int zram_fault(uint32_t virtual)
+{
+    if (virtual >= (uint32_t)ld_virtual_offset) {
+        return -EFAULT;
+    }
+
+    uint32_t **pde = get_page_directory_entry(virtual);
+    if (!PG_IS_PRESENT((uint32_t)*pde)) {
+        return -EFAULT;
+    }
+
+    uint32_t *page = get_page(virtual);
+    if (!ZRAM_PTE_IS_STORED(*page)) {
+        return -EFAULT;
+    }
+
+    uint32_t flags = irq_save();
+    int err = zram_load(page);
+    irq_restore(flags);
+
+    flush_tlb(virtual);
+    return err;
+}
+
+/**
+ * Release the compressed copy of a page whose mapping is being torn down
+ */
+void zram_free_pte(uint32_t pte)
+{
+    if (!pte_entry(pte)) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    drop_entry(pte);
+    irq_restore(flags);
+}
+
+bool zram_under_pressure(void)
+{
+    return pmm_free_frames() < ZRAM_LOW_WATERMARK;
+}
+
+/**
+ * Compress up to nr cold pages of an address space.
+ *
+ * Coldness comes from the working-set scanner: pages that have gone
+ *   ZRAM_COLD_AGE scans without being accessed are compressed.
+ */
+uint32_t zram_reclaim(address_space_t *as, uint32_t nr)
+{
+    if (!as || !as->pgdir) {
+        return 0;
+    }
+
+    bool current = current_task && current_task->as == as;
+    uint32_t done = 0;
+
+    for (uint32_t dir = 0;
+         dir < DIRINDEX((uint32_t)ld_virtual_offset) && done < nr;
+         ++dir)
+    {
+        uint32_t pde = (uint32_t)as->pgdir[dir];
+        if (!PG_IS_PRESENT(pde)) {
+            continue;
+        }
+
+        uint32_t flags = irq_save();
+        uint32_t *pt = (uint32_t *)map_physical(PG_FRAME(pde));
+
+        for (uint32_t i = 0; i < PAGE_SIZE / 4 && done < nr; ++i) {
+            uint32_t virtual = (dir << 22) | (i << 12);
+
+            // Merged pages are shared between address spaces, leave them be
+            if (!PG_IS_PRESENT(pt[i]) || !PG_IS_USERMODE(pt[i])
+                || (pt[i] & PG_KSM))
+            {
+                continue;
+            }
+
+            if (PG_IS_ACCESSED(pt[i])
+                || wss_page_age(as, virtual) < ZRAM_COLD_AGE)
+            {
+                continue;
+            }
+
+            if (zram_store(&pt[i]) == 0) {
+                ++done;
+
+                if (current) {
+                    flush_tlb(virtual);
+                }
+            }
+        }
+
+        unmap_page((uint32_t)pt);
+        irq_restore(flags);
+    }
+
+    return done;
+}
+
+static uint32_t ratio_x100(uint32_t orig_kb, uint32_t compr_bytes)
+{
+    if (!compr_bytes) {
+        return 0;
+    }
+
+    if (orig_kb < 40000) {
+        return orig_kb * KBYTE * 100 / compr_bytes;
+    }
+
+    return orig_kb * 100 / (compr_bytes / KBYTE);
+}
+
+static uint32_t zram_read(file_t __unused *file, uint32_t *offset,
+                          uint32_t size, void *buf)
+{
+    static char text[512];
+
+    uint32_t ratio = ratio_x100(zstat.stored * (PAGE_SIZE / KBYTE),
+                                zstat.compr_bytes);
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "stored_pages %u\n"
+                            "compressed_bytes %u\n"
+                            "pool_pages %u\n"
+                            "compression_ratio %u.%u%u\n"
+                            "swapouts %u\n"
+                            "swapins %u\n"
+                            "incompressible %u\n"
+                            "decompress_ns_avg %u\n"
+                            "decompress_ns_max %u\n",
+                            zstat.stored,
+                            zstat.compr_bytes,
+                            zstat.pool_pages,
+                            ratio / 100, (ratio / 10) % 10, ratio % 10,
+                            zstat.swapouts,
+                            zstat.swapins,
+                            zstat.rejected,
+                            zstat.decomp_avg_ns,
+                            zstat.decomp_max_ns);
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+static struct file_ops zram_fops = {
+    .read = zram_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_zram(void)
+{
+    for (uint32_t i = 0; i < ZRAM_NCLASSES; ++i) {
+        classes[i].size = (i + 1) * ZRAM_CLASS_SIZE;
+        list_init(&classes[i].partial);
+        list_init(&classes[i].full);
+    }
+
+    if (create_device_file(&zram_fops, "zram", 0x444) < 0) {
+        PANIC("Unable to create zram device file!");
+    }
+
+    printf("Initialized zram\n");
+}
@@ -12,18 +12,30 @@ char *strerror(int err)
     case ENOENT:
         strncpy(buf, "Operation not permitted", 80);
         break;
+    case ESRCH:
+        strncpy(buf, "No such process", 80);
+        break;
     case EIO:
         strncpy(buf, "No such device or address", 80);
         break;
     case EBADF:
         strncpy(buf, "Bad file descriptor", 80);
         break;
+    case EAGAIN:
+        strncpy(buf, "Resource temporarily unavailable", 80);
+        break;
     case ENOMEM:
         strncpy(buf, "Cannot allocate memory", 80);
         break;
     case EFAULT:
         strncpy(buf, "Bad address", 80);
         break;
+    case EBUSY:
+        strncpy(buf, "Device or resource busy", 80);
+        break;
+    case ENODEV:
+        strncpy(buf, "No such device", 80);
+        break;
     case ENODIR:
         strncpy(buf, "Not a directory", 80);
         break;
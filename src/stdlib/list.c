@@ -21,6 +21,11 @@ void list_remove(struct list *entry)
     entry->prev->next = entry->next;
 }
 
+int list_empty(const struct list *list)
+{
+    return list->next == list;
+}
+
 int list_size(struct list *list)
 {
     struct list *entry;
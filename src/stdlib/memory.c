@@ -19,3 +19,17 @@ void *memcpy(void *dest, const void *src, size_t sz)
 
     return dest;
 }
+
+int memcmp(const void *a, const void *b, size_t sz)
+{
+    const unsigned char *x = a;
+    const unsigned char *y = b;
+
+    for (size_t i = 0; i < sz; ++i) {
+        if (x[i] != y[i]) {
+            return x[i] - y[i];
+        }
+    }
+
+    return 0;
+}
@@ -55,3 +55,104 @@ void printf(const char *format, ...)
 
     va_end(args);
 }
+
+/**
+ * Buffer versions of the above. These support the same conversions as
+ * printf(), and always null-terminate the output (truncating if needed).
+ * Returns the number of characters written, not including the terminator.
+ */
+struct outbuf {
+    char *buf;
+    unsigned int size;
+    unsigned int len;
+};
+
+static void outbuf_putc(struct outbuf *out, char c)
+{
+    if (out->len + 1 < out->size) {
+        out->buf[out->len++] = c;
+    }
+}
+
+static void outbuf_puts(struct outbuf *out, const char *s)
+{
+    while (*s) {
+        outbuf_putc(out, *s++);
+    }
+}
+
+static void outbuf_putui(struct outbuf *out, unsigned int u, unsigned int base)
+{
+    char string[11];
+    int pos = 10;
+
+    string[pos] = '\0';
+
+    do {
+        unsigned int digit = u % base;
+        string[--pos] = (digit < 10) ? digit + '0' : digit - 10 + 'A';
+        u /= base;
+    } while (u);
+
+    outbuf_puts(out, string + pos);
+}
+
+int vsnprintf(char *buf, unsigned int size, const char *format, va_list args)
+{
+    struct outbuf out = { .buf = buf, .size = size, .len = 0 };
+    char c;
+    int i;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    while ((c = *format++)) {
+        if (c != '%') {
+            outbuf_putc(&out, c);
+        }
+        else {
+            c = *format++;
+            switch(c) {
+            case 'c':
+                outbuf_putc(&out, (char)va_arg(args, int));
+                break;
+            case 'd':
+                i = va_arg(args, int);
+                if (i < 0) {
+                    outbuf_putc(&out, '-');
+                    i = -i;
+                }
+                outbuf_putui(&out, (unsigned int)i, 10);
+                break;
+            case 'x':
+                outbuf_puts(&out, "0x");
+                outbuf_putui(&out, va_arg(args, unsigned int), 16);
+                break;
+            case 's':
+                outbuf_puts(&out, va_arg(args, char *));
+                break;
+            case 'u':
+                outbuf_putui(&out, va_arg(args, unsigned int), 10);
+                break;
+            case '%':
+                outbuf_putc(&out, c);
+                break;
+            }
+        }
+    }
+
+    out.buf[out.len] = '\0';
+    return out.len;
+}
+
+int snprintf(char *buf, unsigned int size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    int ret = vsnprintf(buf, size, format, args);
+
+    va_end(args);
+    return ret;
+}
@@ -0,0 +1,328 @@
+#include "rbtree.h"
+
+static void augment(struct rb_root *root, struct rb_node *node)
+{
+    if (root->augment) {
+        root->augment(node);
+    }
+}
+
+static void replace_child(struct rb_root *root, struct rb_node *parent,
+                          struct rb_node *old, struct rb_node *new)
+{
+    if (!parent) {
+        root->node = new;
+    }
+    else if (parent->left == old) {
+        parent->left = new;
+    }
+    else {
+        parent->right = new;
+    }
+}
+
+static void rotate_left(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->right;
+
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+
+    y->left = x;
+    x->parent = y;
+
+    augment(root, x);
+    augment(root, y);
+}
+
+static void rotate_right(struct rb_root *root, struct rb_node *x)
+{
+    struct rb_node *y = x->left;
+
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+
+    y->right = x;
+    x->parent = y;
+
+    augment(root, x);
+    augment(root, y);
+}
+
+static int is_red(const struct rb_node *node)
+{
+    return node && node->red;
+}
+
+void rb_link_node(struct rb_node *node, struct rb_node *parent,
+                  struct rb_node **link)
+{
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = 1;
+
+    *link = node;
+}
+
+void rb_augment_path(struct rb_node *node, struct rb_root *root)
+{
+    if (!root->augment) {
+        return;
+    }
+
+    for (; node; node = node->parent) {
+        root->augment(node);
+    }
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+    rb_augment_path(node, root);
+
+    struct rb_node *parent;
+
+    while ((parent = node->parent) && parent->red) {
+        struct rb_node *grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            struct rb_node *uncle = grandparent->right;
+
+            if (is_red(uncle)) {
+                parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = 0;
+            grandparent->red = 1;
+            rotate_right(root, grandparent);
+        }
+        else {
+            struct rb_node *uncle = grandparent->left;
+
+            if (is_red(uncle)) {
+                parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = 0;
+            grandparent->red = 1;
+            rotate_left(root, grandparent);
+        }
+    }
+
+    root->node->red = 0;
+}
+
+static void erase_fixup(struct rb_node *node, struct rb_node *parent,
+                        struct rb_root *root)
+{
+    while (node != root->node && !is_red(node)) {
+        if (node == parent->left) {
+            struct rb_node *sibling = parent->right;
+
+            if (sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rotate_left(root, parent);
+                sibling = parent->right;
+            }
+
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = 1;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!is_red(sibling->right)) {
+                sibling->left->red = 0;
+                sibling->red = 1;
+                rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->red = parent->red;
+            parent->red = 0;
+            sibling->right->red = 0;
+            rotate_left(root, parent);
+            node = root->node;
+        }
+        else {
+            struct rb_node *sibling = parent->left;
+
+            if (sibling->red) {
+                sibling->red = 0;
+                parent->red = 1;
+                rotate_right(root, parent);
+                sibling = parent->left;
+            }
+
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = 1;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!is_red(sibling->left)) {
+                sibling->right->red = 0;
+                sibling->red = 1;
+                rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->red = parent->red;
+            parent->red = 0;
+            sibling->left->red = 0;
+            rotate_right(root, parent);
+            node = root->node;
+        }
+    }
+
+    if (node) {
+        node->red = 0;
+    }
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *child;
+    struct rb_node *parent;
+    int red;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        red = node->red;
+
+        if (child) {
+            child->parent = parent;
+        }
+
+        replace_child(root, parent, node, child);
+    }
+    else {
+        // Splice the successor out and put it in node's place
+        struct rb_node *next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+
+        child = next->right;
+        red = next->red;
+
+        if (next->parent == node) {
+            parent = next;
+        }
+        else {
+            parent = next->parent;
+            parent->left = child;
+            if (child) {
+                child->parent = parent;
+            }
+
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+
+        next->parent = node->parent;
+        replace_child(root, node->parent, node, next);
+        next->red = node->red;
+    }
+
+    rb_augment_path(parent, root);
+
+    if (!red) {
+        erase_fixup(child, parent, root);
+    }
+}
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+
+    while (node && node->left) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+struct rb_node *rb_last(const struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+
+    while (node && node->right) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+
+        return (struct rb_node *)node;
+    }
+
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node)
+{
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+
+        return (struct rb_node *)node;
+    }
+
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
@@ -0,0 +1,50 @@
+#include "condvar.h"
+#include "task.h"
+#include "internal.h"
+
+#include "mutex.h"
+
+/**
+ * Condition variables. A waiter joins the queue before releasing the
+ *   mutex, so a signal sent by the next holder of the mutex can't be
+ *   missed.
+ */
+void cond_init(struct condvar *cond)
+{
+    *cond = (struct condvar)CONDVAR_INIT(*cond);
+}
+
+void cond_wait(struct condvar *cond, struct mutex *mutex)
+{
+    struct waiter waiter = { .task = current_task };
+
+    uint32_t flags = spin_lock_irqsave(&cond->lock);
+    list_insert(cond->waiters.prev, &waiter.list);
+    spin_unlock_irqrestore(&cond->lock, flags);
+
+    mutex_unlock(mutex);
+
+    flags = spin_lock_irqsave(&cond->lock);
+    flags = wait_woken(&waiter, &cond->lock, flags);
+    spin_unlock_irqrestore(&cond->lock, flags);
+
+    mutex_lock(mutex);
+}
+
+void cond_signal(struct condvar *cond)
+{
+    uint32_t flags = spin_lock_irqsave(&cond->lock);
+    wake_first_waiter(&cond->waiters);
+    spin_unlock_irqrestore(&cond->lock, flags);
+}
+
+void cond_broadcast(struct condvar *cond)
+{
+    uint32_t flags = spin_lock_irqsave(&cond->lock);
+
+    while (!list_empty(&cond->waiters)) {
+        wake_first_waiter(&cond->waiters);
+    }
+
+    spin_unlock_irqrestore(&cond->lock, flags);
+}
@@ -2,6 +2,7 @@
 #include "internal.h"
 
 #include "errno.h"
+#include "fpu.h"
 #include "ldsymbol.h"
 
 #include "device/descriptor_tables.h"
@@ -12,6 +13,18 @@
 
 extern ldsymbol ld_virtual_offset;
 
+/**
+ * Free our address space, taking it from the task first so the background
+ *   scans don't find it half freed if we're switched out meanwhile
+ */
+static void drop_address_space(void)
+{
+    address_space_t *as = current_task->as;
+
+    current_task->as = NULL;
+    free_address_space(as);
+}
+
 int exec(const char *path)
 {
     int err = 0;
@@ -38,7 +51,7 @@ int exec(const char *path)
     /* 	printf("    %x\n", ((uint32_t*)data)[i]); */
     /* } */
 
-    free_address_space(current_task->as);
+    drop_address_space();
     current_task->as = alloc_address_space();
     if (!current_task->as) {
         err = -ENOMEM;
@@ -46,7 +59,7 @@ int exec(const char *path)
     }
 
     // Set up the stack as if an interrupt had just occured *right* where
-    //   we want the task to begin, so switch_context() can iret smoothly
+    //   we want the task to begin, so return_to_user() can iret smoothly
     // See Intel developer's manual 6.4.1 (page 6-9)
     uint32_t stack[] = {
         0x23, // DS, ES, FS, GS
@@ -74,22 +87,26 @@ int exec(const char *path)
         goto error_kstack;
     }
 
+    close_file(binary);
+    fpu_release(current_task);
+
     /* printf("switching address space\n"); */
     switch_address_space(NULL, current_task->as);
+    this_cpu()->as = current_task->as;
     /* printf("switching context\n"); */
-    switch_context(current_task);
+    return_to_user(current_task);
 
  error_kstack:
-    free_kstack(current_task->esp0);
+    free_kstack(current_task->kstack);
 
  error_as:
-    free_address_space(current_task->as);
+    drop_address_space();
 
  error_filedata:
     kfree(data);
 
  error_file:
-    vfs_close(binary);
+    close_file(binary);
 
  error:
     return err;
@@ -8,24 +8,13 @@
 
 static void kill_task(struct task *task);
 
-static void kill_children_on_queue(struct task **queue, struct task *task)
-{
-    if (*queue == NULL) {
-	return;
-    }
-	
-    for (struct task *curr = *queue; curr; curr = curr->next) {
-	if (curr->parent == task) {
-	    kill_task(curr);
-	}
-    }
-}
-
 static void kill_children(struct task *task)
 {
-    kill_children_on_queue(&running, task);
-    kill_children_on_queue(&blocked, task);
-    kill_children_on_queue(&zombies, task);
+    struct list *elem;
+
+    LIST_FOR_EACH(&task->children, elem) {
+	kill_task(LIST_ENTRY(elem, struct task, children_list));
+    }
 }
 
 static void kill_task(struct task *task)
@@ -35,25 +24,35 @@ static void kill_task(struct task *task)
     for (int i = 0; i < TASK_MAX_FILES; ++i) {
 	if (task->files[i]) {
 	    printf("closing process file %d\n", i);
-	    vfs_close(task->files[i]);
+	    close_file(task->files[i]);
+	    task->files[i] = NULL;
 	}
     }
 
-    task_queue_remove_safe(&running, task);
-    task_queue_remove_safe(&blocked, task);
-    task_queue_remove_safe(&zombies, task);
+    task_set_state(task, TASK_FINISHED);
+    sched_exit(task);
 }
 
-void exit(int code)
+/**
+ * End a task with the given exit code and let its parent know. A task
+ *   only dies once: killing one that's already finished does nothing, so
+ *   it keeps its first exit code and its parent is only woken once.
+ */
+void task_exit(struct task *task, int code)
 {
-    printf("exiting process %u with code %d\n", current_task->pid, code);
+    if (task->status == TASK_FINISHED) {
+        return;
+    }
 
-    current_task->exit_code = code;
-    current_task->status = TASK_FINISHED;
+    printf("exiting process %u with code %d\n", task->pid, code);
 
-    if (current_task->parent->status == TASK_BLOCKED) {
-	wake(current_task->parent->pid);
-    }
+    task->exit_code = code;
+    kill_task(task);
 
-    kill_task(current_task);
+    wake_up(&task->parent->child_exit);
+}
+
+void exit(int code)
+{
+    task_exit(current_task, code);
 }
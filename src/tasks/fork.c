@@ -3,23 +3,38 @@
 
 #include "compiler.h"
 #include "errno.h"
+#include "fpu.h"
 
 #include "memory/address-space.h"
-#include "memory/kheap.h"
 #include "memory/memory.h"
 
-static uint32_t clone_kstack(uint32_t esp0)
+/**
+ * Give the child a copy of our kernel stack, switched out as if it were
+ *   about to return from the syscall we're in: the first switch to it goes
+ *   to ret_from_fork, which returns to user mode through its copy of our
+ *   syscall frame
+ */
+static int clone_kstack(struct task *child)
 {
-    uint32_t stack_start = align_down(esp0, PAGE_SIZE);
-    uint32_t stack_offset = esp0 - stack_start;
-
-    void *new = kmalloc(MEM_GEN, PAGE_SIZE);
-    if (!new) {
-        return 0;
+    child->kstack = alloc_kstack();
+    if (!child->kstack) {
+        return -ENOMEM;
     }
 
-    memcpy(new, (void *)stack_start, PAGE_SIZE);
-    return (uint32_t)new + stack_offset;
+    memcpy((void *)child->kstack, (void *)current_task->kstack, KSTACK_SIZE);
+
+    uint32_t *stack = (uint32_t *)task_regs(child);
+
+    *--stack = (uint32_t)&ret_from_fork;
+    *--stack = 0; // ebp
+    *--stack = 0; // ebx
+    *--stack = 0; // esi
+    *--stack = 0; // edi
+
+    child->esp = (uint32_t)stack;
+    child->lock_depth = 0;
+    task_regs(child)->eax = 0;
+    return 0;
 }
 
 int fork(void)
@@ -38,19 +53,21 @@ int fork(void)
         goto error;
     }
 
-    child->esp0 = clone_kstack(current_task->esp0);
-    if (!child->esp0) {
-        err = -ENOMEM;
+    err = fpu_fork(child, current_task);
+    if (err < 0) {
         goto error;
     }
 
-    registers_t *child_regs = (registers_t *)child->esp0;
-    child_regs->eax = 0;
+    err = clone_kstack(child);
+    if (err < 0) {
+        goto error;
+    }
 
     child->parent = current_task;
     list_insert(&current_task->children, &child->children_list);
 
-    task_queue_add(&running, child);
+    sched_fork(child, current_task);
+    task_set_state(child, TASK_RUNNING);
 
     return child->pid;
 
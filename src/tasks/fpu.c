@@ -0,0 +1,271 @@
+#include "fpu.h"
+#include "task.h"
+#include "internal.h"
+
+#include "bool.h"
+#include "cpu.h"
+#include "errno.h"
+#include "macros.h"
+#include "printf.h"
+#include "smp.h"
+
+#include "device/interrupt.h"
+#include "memory/slab.h"
+
+/**
+ * Lazy FPU switching. Every CPU runs with CR0.TS set, so the first x87 or
+ *   SSE instruction a task runs after being switched in traps to #NM. Only
+ *   then is its state loaded, and only if the registers don't still hold
+ *   it from the last time it ran here; a task that's never used the FPU
+ *   gets a freshly initialised one. From then until it's switched out, TS
+ *   is clear and the task has the FPU to itself.
+ *
+ * A task that used the FPU has its state saved as it's switched out, as
+ *   it might run on another CPU next, but the registers keep it too: if
+ *   it comes back to the same CPU with nobody else having used the FPU in
+ *   between, the trap just clears TS. Switching between tasks that never
+ *   touch the FPU costs nothing.
+ *
+ * The kernel itself doesn't use the FPU.
+ */
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+#define FPU_INTERRUPT 7
+
+/* What fninit leaves, with every exception masked */
+#define FCW_DEFAULT 0x37F
+#define MXCSR_DEFAULT 0x1F80
+
+static DEFINE_KMEM_CACHE(fpu_cache, struct fpu_state, NULL);
+
+static uint32_t cpu_features;
+
+bool fpu_fail_alloc;
+
+static inline void clts(void)
+{
+    asm volatile ("clts" : : : "memory");
+}
+
+static inline void stts(void)
+{
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(struct fpu_state *state)
+{
+    asm volatile ("fxsave %0" : "=m"(*state));
+}
+
+static inline void fxrstor(struct fpu_state *state)
+{
+    asm volatile ("fxrstor %0" : : "m"(*state));
+}
+
+static uint32_t read_cr4(void)
+{
+    uint32_t cr4;
+
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static void write_cr4(uint32_t cr4)
+{
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+/**
+ * Save the state of a task that's used the FPU since it was switched in,
+ *   leaving it in the registers. Called on the task's CPU.
+ */
+static void fpu_save(struct task *task)
+{
+    if (task->fpu_live) {
+        fxsave(task->fpu);
+    }
+}
+
+/**
+ * Called with the task the CPU's switching away from. Only a task that's
+ *   used the FPU while it ran has anything to save, and it's the only way
+ *   TS comes to be clear.
+ */
+void fpu_switch_out(struct task *prev)
+{
+    if (!prev->fpu_live) {
+        return;
+    }
+
+    fpu_save(prev);
+    prev->fpu_live = false;
+    stts();
+}
+
+/**
+ * Give the child a copy of its parent's FPU state, if it has one
+ */
+int fpu_fork(struct task *child, struct task *parent)
+{
+    if (!parent->fpu) {
+        return 0;
+    }
+
+    child->fpu = kmem_cache_alloc(&fpu_cache);
+    if (!child->fpu) {
+        return -ENOMEM;
+    }
+
+    fpu_save(parent);
+    *child->fpu = *parent->fpu;
+    return 0;
+}
+
+/**
+ * Throw away a task's FPU state: it's exiting, or exec()ing something that
+ *   starts with the FPU untouched
+ */
+void fpu_release(struct task *task)
+{
+    uint32_t cpu;
+
+    for_each_cpu(cpu) {
+        if (cpus[cpu].fpu_owner == task) {
+            cpus[cpu].fpu_owner = NULL;
+        }
+    }
+
+    if (task->fpu_live) {
+        task->fpu_live = false;
+        stts();
+    }
+
+    if (task->fpu) {
+        kmem_cache_free(&fpu_cache, task->fpu);
+        task->fpu = NULL;
+    }
+}
+
+/**
+ * Give a task the FPU for the first time since it was switched in onto
+ *   this CPU, loading its state if the registers don't hold it already.
+ *   Fails, leaving TS set, if the FPU can't be used or the task has no
+ *   state and there's no memory for one.
+ */
+int fpu_first_use(struct task *task)
+{
+    struct cpu *cpu = this_cpu();
+    bool fresh = !task->fpu;
+
+    if (!(cpu_features & CPUID_FXSR)) {
+        return -ENOSYS;
+    }
+
+    if (fresh) {
+        if (fpu_fail_alloc) {
+            fpu_fail_alloc = false;
+            return -ENOMEM;
+        }
+
+        task->fpu = kmem_cache_zalloc(&fpu_cache);
+        if (!task->fpu) {
+            return -ENOMEM;
+        }
+
+        task->fpu->fcw = FCW_DEFAULT;
+        task->fpu->mxcsr = MXCSR_DEFAULT;
+    }
+
+    clts();
+
+    if (fresh || cpu->fpu_owner != task || task->fpu_cpu != cpu_id()) {
+        fxrstor(task->fpu);
+    }
+
+    cpu->fpu_owner = task;
+    task->fpu_cpu = cpu_id();
+    task->fpu_live = true;
+    return 0;
+}
+
+/**
+ * #NM: the running task has used the FPU for the first time since it was
+ *   switched in. A task that can't have it is killed; going back to the
+ *   instruction would only trap again, so it's switched out for good.
+ */
+static void fpu_trap(registers_t *regs)
+{
+    struct task *task = current_task;
+
+    if (!task || !(regs->cs & 0x3)) {
+        PANIC("FPU used in the kernel!");
+    }
+
+    int err = fpu_first_use(task);
+    if (err == 0) {
+        return;
+    }
+
+    if (err == -ENOSYS) {
+        printf("task %u used the FPU, which isn't supported\n", task->pid);
+    }
+    else {
+        printf("task %u: no memory for its FPU state\n", task->pid);
+    }
+
+    task_exit(task, err);
+    schedule();
+
+    PANIC("A task killed in the FPU trap ran again!");
+}
+
+/**
+ * Turn on FXSAVE and SSE if the CPU has them, and set TS so the first
+ *   task to use the FPU traps. Without FXSAVE the FPU is left off, and a
+ *   task using it is killed.
+ */
+void fpu_init_cpu(void)
+{
+    uint32_t cr0 = read_cr0() | CR0_MP | CR0_NE | CR0_TS;
+
+    if (!(cpu_features & CPUID_FXSR)) {
+        write_cr0(cr0 | CR0_EM);
+        return;
+    }
+
+    uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+    if (cpu_features & CPUID_SSE) {
+        cr4 |= CR4_OSXMMEXCPT;
+    }
+
+    write_cr4(cr4);
+    write_cr0(cr0 & ~CR0_EM);
+}
+
+void init_fpu(void)
+{
+    printf("Initializing FPU...\n");
+
+    uint32_t eax = 1;
+    uint32_t ebx;
+    uint32_t ecx;
+
+    asm volatile ("cpuid"
+                  : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(cpu_features));
+
+    if (!(cpu_features & CPUID_FXSR)) {
+        printf("[ERROR] No FXSAVE support, floating point disabled\n");
+    }
+
+    fpu_init_cpu();
+    register_interrupt_handler(FPU_INTERRUPT, &fpu_trap);
+}
@@ -1,27 +1,127 @@
 #ifndef __TASK_INTERNAL_H_
 #define __TASK_INTERNAL_H_
 
+#include "bool.h"
+#include "spinlock.h"
+#include "wait-queue.h"
+
+#include "device/interrupt.h"
+#include "memory/memory.h"
+
 struct task *alloc_task();
 void free_task(struct task *task);
 
+#define KSTACK_SIZE PAGE_SIZE
+
 uint32_t alloc_kstack();
-void free_kstack(uint32_t esp0);
+void free_kstack(uint32_t kstack);
+
+int attach_pid(struct task *task);
+void detach_pid(struct task *task);
+struct task *pid_task(uint32_t pid);
+
+/**
+ * Scheduling classes decide which runnable task runs next. Each sees tasks
+ *   as they become runnable (enqueue) and stop being runnable (dequeue),
+ *   and is told when one of its tasks comes off the CPU (put_prev). Every
+ *   class's tick is called on every timer tick, with whichever task is
+ *   running; wakeup only when a task of the class wakes while another of
+ *   the same class runs. Both return true when the running task should be
+ *   preempted.
+ *
+ * Deadline tasks come first, then fixed-priority real-time tasks, then the
+ *   normal class, which is picked at build time (make SCHED=fair or
+ *   SCHED=rr).
+ *
+ * Each class keeps separate queues for each CPU: a task is queued on
+ *   task->cpu's, and pick_next picks from the calling CPU's. migrate, if a
+ *   class has it, adjusts a task that isn't queued for moving to another
+ *   CPU, before task->cpu changes.
+ */
+struct sched_class {
+    const char *name;
+    void (*enqueue)(struct task *task, bool wakeup);
+    void (*dequeue)(struct task *task);
+    struct task *(*pick_next)(void);
+    void (*put_prev)(struct task *task);
+    bool (*tick)(struct task *curr);
+    bool (*wakeup)(struct task *curr, struct task *task);
+    void (*migrate)(struct task *task, uint32_t cpu);
+};
+
+/* Guards the task queues and the scheduling classes' run queues */
+extern spinlock_t sched_lock;
+
+extern const struct sched_class sched_dl;
+extern const struct sched_class sched_rt;
+extern const struct sched_class sched_fair;
+extern const struct sched_class sched_rr;
+extern const struct sched_class *sched;
 
-void task_queue_add(struct task **queue, struct task *task);
-void task_queue_remove(struct task **queue, struct task *task);
-struct task *task_queue_find(struct task **queue, uint32_t pid);
-void task_queue_remove_safe(struct task **queue, struct task *task);
+const struct sched_class *task_sched_class(struct task *task);
+void sched_enqueue(struct task *task, bool wakeup);
+void sched_dequeue(struct task *task);
+struct task *sched_pick_next(void);
+void sched_put_prev(struct task *task);
+void sched_switched_in(struct task *task);
+
+uint32_t sched_charge(struct task *task);
+void sched_fork(struct task *child, struct task *parent);
+int sched_pin(struct task *task, uint32_t cpu);
+void sched_unpin(struct task *task);
+void sched_exit(struct task *task);
+void sched_tick(void);
+void sched_update_tick(void);
+uint32_t nice_to_weight(int nice);
+
+void sched_boost(struct task *task, struct task *waiter);
+void sched_unboost(struct task *task);
+
+int dl_admit(struct task *task, uint32_t runtime, uint32_t period);
+void dl_release(struct task *task);
+uint32_t dl_next_event(uint32_t cpu);
+
+uint32_t wait_woken(struct waiter *waiter, spinlock_t *lock, uint32_t flags);
+struct task *wake_first_waiter(struct list *waiters);
+
+void task_set_state(struct task *task, enum status status);
+struct task *task_queue_first(struct list *queue);
+struct task *task_find(uint32_t pid);
 
 unsigned long setup_stack(struct task *task, void *data, unsigned long size);
+struct task *create_idle_task(void);
+
+extern struct list running;
+extern struct list blocked;
+extern struct list zombies;
+
+/**
+ * The frame a user task's interrupts and syscalls push at the top of its
+ *   kernel stack, which it goes back to user mode from
+ */
+static inline registers_t *task_regs(struct task *task)
+{
+    return (registers_t *)(task->kstack + KSTACK_SIZE) - 1;
+}
 
-extern struct task *running;
-extern struct task *blocked;
-extern struct task *idle;
-extern struct task *zombies;
+void switch_stacks(uint32_t *save, uint32_t load);
+void ret_from_fork(void);
+void idle_main(void *data);
 
-#define switch_context(new) do {                                        \
-    set_esp0(new->esp0);                                                \
+/**
+ * Leave the kernel for the task's user mode, through the frame at the top
+ *   of its kernel stack, never to come back to the caller. Once we're on
+ *   the task's stack, nothing of the old one's is needed, so that's where
+ *   the kernel lock is dropped (see smp.c).
+ */
+#define return_to_user(new) do {                                        \
+    uint32_t drop = kernel_lock_handoff(new);                           \
+    set_esp0(new->kstack + KSTACK_SIZE);                                \
     asm volatile ("movl %0, %%esp\n\t"                                  \
+                  "test %1, %1\n\t"                                     \
+                  "jz 1f\n\t"                                           \
+                  "call kernel_lock_drop\n\t"                           \
+                  "1:\n\t"                                              \
                   "pop %%eax\n\t"                                       \
                   "mov %%ax, %%ds\n\t"                                  \
                   "mov %%ax, %%es\n\t"                                  \
@@ -30,9 +130,9 @@ extern struct task *zombies;
                   "popa\n\t"                                            \
                   "add $8, %%esp\n\t"                                   \
                   "iret\n\t"                                            \
-                  :							\
-                  : "g"(new->esp0)                                      \
-                  : "ebx", "ecx", "edx", "esi", "edi");			\
+                  :                                                     \
+                  : "r"(task_regs(new)), "r"(drop)                      \
+                  : "memory");                                          \
     } while (0);
 
 
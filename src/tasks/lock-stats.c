@@ -0,0 +1,126 @@
+#include "spinlock.h"
+
+#include "compiler.h"
+#include "macros.h"
+#include "printf.h"
+
+#include "device/clock.h"
+#include "fs/devfs.h"
+
+/**
+ * /dev/locks: for each lock taken since boot, how many times it's been
+ *   taken and how many of those it was already held, then the total time
+ *   spent waiting for it, the total time it's been held and its longest
+ *   hold, in units of 1024ns (roughly microseconds). Locks are only counted
+ *   in kernels built with LOCK_STAT=1.
+ */
+#if CONFIG_LOCK_STAT
+
+/* Every lock taken so far, most recently first taken first */
+static struct lock_stat *volatile lock_stats;
+
+static uint32_t cycles_to_units(uint64_t cycles)
+{
+    return cycles_to_ns(cycles) >> 10;
+}
+
+/**
+ * Called with the lock just taken, and wait_start the time we started
+ *   waiting for it if it was held (0 if it wasn't)
+ */
+void lock_stat_acquired(struct lock_stat *stat, uint64_t wait_start)
+{
+    uint64_t now = rdtsc();
+
+    // Unnamed locks may live on a stack, and be gone before we're read
+    if (!stat->name) {
+        return;
+    }
+
+    if (!stat->listed) {
+        struct lock_stat *head;
+
+        do {
+            head = lock_stats;
+            stat->next = head;
+        } while (!__sync_bool_compare_and_swap(&lock_stats, head, stat));
+
+        stat->listed = true;
+    }
+
+    ++stat->acquired;
+
+    if (wait_start) {
+        ++stat->contended;
+        stat->wait_cycles += now - wait_start;
+    }
+
+    stat->since = now;
+}
+
+/**
+ * Called with the lock still held, just before it's released
+ */
+void lock_stat_released(struct lock_stat *stat)
+{
+    if (!stat->name) {
+        return;
+    }
+
+    uint64_t held = rdtsc() - stat->since;
+
+    stat->hold_cycles += held;
+    if (held > stat->max_hold_cycles) {
+        stat->max_hold_cycles = held;
+    }
+}
+
+static uint32_t locks_read(file_t __unused *file, uint32_t *offset,
+                           uint32_t size, void *buf)
+{
+    static char text[4096];
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "name acquired contended wait hold max_hold\n");
+
+    for (struct lock_stat *stat = lock_stats;
+         stat && len < sizeof(text) - 1;
+         stat = stat->next)
+    {
+        len += snprintf(text + len, sizeof(text) - len,
+                        "%s %u %u %u %u %u\n",
+                        stat->name,
+                        stat->acquired, stat->contended,
+                        cycles_to_units(stat->wait_cycles),
+                        cycles_to_units(stat->hold_cycles),
+                        cycles_to_units(stat->max_hold_cycles));
+    }
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+#else
+
+static uint32_t locks_read(file_t __unused *file, uint32_t *offset,
+                           uint32_t size, void *buf)
+{
+    static const char text[] = "lock statistics off (build with LOCK_STAT=1)\n";
+
+    return devfs_read_text(text, sizeof(text) - 1, offset, size, buf);
+}
+
+#endif
+
+static struct file_ops locks_fops = {
+    .read = locks_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_lock_stats(void)
+{
+    if (create_device_file(&locks_fops, "locks", 0x444) < 0) {
+        PANIC("Unable to create locks device file!");
+    }
+}
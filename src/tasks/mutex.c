@@ -0,0 +1,172 @@
+#include "mutex.h"
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+#include "smp.h"
+
+/**
+ * Mutexes. owner is the lock itself, taken with a compare-and-swap when
+ *   it's free, so a waiter never finds it locked with no holder to boost;
+ *   the queue of waiters is only touched when it isn't free.
+ *
+ * A mutex released with tasks waiting stays locked, and passes to the
+ *   first of them, so a task spinning or newly arrived can't take it ahead
+ *   of those already queued.
+ *
+ * Each task keeps a list of the mutexes it holds, so that on releasing one
+ *   it can go back to the priority of whoever's waiting on the rest. Only
+ *   the holder touches its list, apart from a mutex being handed to a
+ *   waiter, which is added to the waiter's list before it can run.
+ */
+
+/* How many times to check on a running holder before going to sleep */
+#define MUTEX_SPIN_LIMIT 1000
+
+void mutex_init(struct mutex *mutex)
+{
+    *mutex = (struct mutex)MUTEX_INIT(*mutex);
+}
+
+static void add_held(struct mutex *mutex, struct task *task)
+{
+    if (task) {
+        list_insert(&task->mutexes, &mutex->held);
+    }
+}
+
+bool mutex_trylock(struct mutex *mutex)
+{
+    struct task *task = current_task;
+
+    if (!__sync_bool_compare_and_swap(&mutex->owner, 0,
+                                      (uint32_t)task | MUTEX_LOCKED))
+    {
+        return false;
+    }
+
+    add_held(mutex, task);
+    return true;
+}
+
+/**
+ * Whether the holder is on another CPU right now, and so may well release
+ *   the mutex in less time than it'd take us to sleep and be woken
+ */
+static bool owner_running(struct mutex *mutex)
+{
+    struct task *owner = mutex_owner(mutex);
+
+    return owner && owner->cpu != cpu_id() && cpus[owner->cpu].task == owner;
+}
+
+void mutex_lock(struct mutex *mutex)
+{
+    if (mutex_trylock(mutex)) {
+        return;
+    }
+
+    for (uint32_t spins = 0;
+         spins < MUTEX_SPIN_LIMIT && owner_running(mutex)
+             && list_empty(&mutex->waiters);
+         ++spins)
+    {
+        cpu_relax();
+
+        if (!mutex->owner && mutex_trylock(mutex)) {
+            return;
+        }
+    }
+
+    uint32_t flags = spin_lock_irqsave(&mutex->wait_lock);
+
+    // Released while we spun, with no one else waiting for it
+    if (mutex_trylock(mutex)) {
+        spin_unlock_irqrestore(&mutex->wait_lock, flags);
+        return;
+    }
+
+    struct waiter waiter = { .task = current_task };
+    list_insert(mutex->waiters.prev, &waiter.list);
+
+    if (mutex_owner(mutex)) {
+        sched_boost(mutex_owner(mutex), current_task);
+    }
+
+    // Whoever wakes us has made us the owner
+    flags = wait_woken(&waiter, &mutex->wait_lock, flags);
+    spin_unlock_irqrestore(&mutex->wait_lock, flags);
+}
+
+/**
+ * Go back to our own priority, or that of the highest priority task still
+ *   waiting on a mutex we hold. Their wait locks are all held while we do,
+ *   so no new waiter's boost can be lost in between.
+ */
+static void unboost(struct task *task)
+{
+    struct list *l, *w;
+
+    if (!task->se.pi_boosted) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+
+    LIST_FOR_EACH(&task->mutexes, l) {
+        struct mutex *mutex = LIST_ENTRY(l, struct mutex, held);
+        spin_lock(&mutex->wait_lock);
+    }
+
+    sched_unboost(task);
+
+    LIST_FOR_EACH(&task->mutexes, l) {
+        struct mutex *mutex = LIST_ENTRY(l, struct mutex, held);
+
+        LIST_FOR_EACH(&mutex->waiters, w) {
+            struct waiter *waiter = LIST_ENTRY(w, struct waiter, list);
+            sched_boost(task, waiter->task);
+        }
+    }
+
+    LIST_FOR_EACH(&task->mutexes, l) {
+        struct mutex *mutex = LIST_ENTRY(l, struct mutex, held);
+        spin_unlock(&mutex->wait_lock);
+    }
+
+    irq_restore(flags);
+    preempt_check_resched();
+}
+
+void mutex_unlock(struct mutex *mutex)
+{
+    uint32_t flags = spin_lock_irqsave(&mutex->wait_lock);
+    struct task *next = wake_first_waiter(&mutex->waiters);
+
+    if (mutex_owner(mutex)) {
+        list_remove(&mutex->held);
+    }
+
+    if (next) {
+        struct list *l;
+
+        mutex->owner = (uint32_t)next | MUTEX_LOCKED;
+        add_held(mutex, next);
+
+        // The new holder takes on the priority of whoever's left waiting
+        LIST_FOR_EACH(&mutex->waiters, l) {
+            struct waiter *waiter = LIST_ENTRY(l, struct waiter, list);
+            sched_boost(next, waiter->task);
+        }
+    }
+    else {
+        asm volatile ("" : : : "memory");
+        mutex->owner = 0;
+    }
+
+    spin_unlock_irqrestore(&mutex->wait_lock, flags);
+
+    if (current_task) {
+        unboost(current_task);
+    }
+}
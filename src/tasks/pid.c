@@ -0,0 +1,109 @@
+#include "task.h"
+#include "internal.h"
+
+#include "bits.h"
+#include "cpu.h"
+#include "errno.h"
+
+/**
+ * Pid allocation and lookup.
+ *
+ * Pids in use are marked in a bitmap. New pids are handed out in order,
+ *   wrapping around past PID_MAX to reuse freed ones, so a pid isn't reused
+ *   straight after its task is freed.
+ *
+ * Every task with a pid is on a chain in a hash table, so any task can be
+ *   found by pid in constant time, including from interrupt handlers.
+ */
+#define PID_MAX 32768
+#define PID_HASH_SIZE 1024
+
+static uint32_t pid_bitmap[PID_MAX / 32];
+static uint32_t last_pid = PID_MAX - 1;
+
+static struct task *pid_hash[PID_HASH_SIZE];
+
+static uint32_t pid_bucket(uint32_t pid)
+{
+    return pid % PID_HASH_SIZE;
+}
+
+/**
+ * Find the first clear bit at or after pid, or PID_MAX if there isn't one
+ */
+static uint32_t find_free_pid(uint32_t pid)
+{
+    while (pid < PID_MAX) {
+        uint32_t free = ~pid_bitmap[pid / 32] & (0xFFFFFFFF << (pid % 32));
+        if (free) {
+            return (pid & ~31) + __builtin_ctz(free);
+        }
+
+        pid = (pid & ~31) + 32;
+    }
+
+    return PID_MAX;
+}
+
+/**
+ * Give the task a pid and make it findable by it
+ */
+int attach_pid(struct task *task)
+{
+    uint32_t flags = irq_save();
+
+    uint32_t pid = find_free_pid(last_pid + 1);
+    if (pid == PID_MAX) {
+        pid = find_free_pid(0);
+    }
+
+    if (pid == PID_MAX) {
+        irq_restore(flags);
+        return -EAGAIN;
+    }
+
+    SET_BIT(pid_bitmap[pid / 32], pid % 32);
+    last_pid = pid;
+
+    task->pid = pid;
+    task->pid_next = pid_hash[pid_bucket(pid)];
+    pid_hash[pid_bucket(pid)] = task;
+
+    irq_restore(flags);
+    return 0;
+}
+
+void detach_pid(struct task *task)
+{
+    uint32_t flags = irq_save();
+
+    for (struct task **curr = &pid_hash[pid_bucket(task->pid)];
+         *curr;
+         curr = &(*curr)->pid_next)
+    {
+        if (*curr == task) {
+            *curr = task->pid_next;
+            CLR_BIT(pid_bitmap[task->pid / 32], task->pid % 32);
+            break;
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Find the task with a pid, whatever its state
+ */
+struct task *pid_task(uint32_t pid)
+{
+    for (struct task *task = pid_hash[pid_bucket(pid)];
+         task;
+         task = task->pid_next)
+    {
+        if (task->pid == pid) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
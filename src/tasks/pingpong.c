@@ -0,0 +1,110 @@
+#include "task.h"
+#include "internal.h"
+
+#include "compiler.h"
+#include "cpu.h"
+#include "macros.h"
+#include "printf.h"
+#include "semaphore.h"
+#include "smp.h"
+
+#include "device/clock.h"
+#include "fs/devfs.h"
+
+/**
+ * /dev/pingpong: the round trip time of a kernel context switch. Reading it
+ *   bounces between the reader and a kernel thread over a pair of
+ *   semaphores, each waking the other and going to sleep, and shows the
+ *   number of round trips with the cycles and nanoseconds each took. A
+ *   round trip is two switches, both made inside the kernel.
+ *
+ * Each CPU gets its own thread, started on the first read there and
+ *   pinned to it, and the reader is pinned to it too while it times the
+ *   rounds, so neither is woken onto another CPU or pulled away by
+ *   balancing. The CPU each side last ran on is shown too.
+ */
+#define PINGPONG_SHIFT 10
+#define PINGPONG_ROUNDS (1 << PINGPONG_SHIFT)
+
+struct pingpong {
+    struct semaphore ping;
+    struct semaphore pong;
+    struct task *ponger;
+    uint32_t pong_cpu;
+};
+
+static struct pingpong pingpongs[NR_CPUS];
+
+static void pong_main(void *data)
+{
+    struct pingpong *pp = data;
+
+    while (true) {
+        down(&pp->ping);
+        pp->pong_cpu = cpu_id();
+        up(&pp->pong);
+    }
+}
+
+static uint32_t pingpong_read(file_t __unused *file, uint32_t *offset,
+                              uint32_t size, void *buf)
+{
+    static char text[128];
+    static uint32_t len;
+
+    // Time a fresh set of rounds for each read from the start
+    if (*offset == 0) {
+        uint32_t cpu = cpu_id();
+        struct pingpong *pp = &pingpongs[cpu];
+
+        if (!pp->ponger) {
+            sema_init(&pp->ping, 0);
+            sema_init(&pp->pong, 0);
+
+            pp->ponger = kthread_run_on(&pong_main, pp, cpu);
+            if (!pp->ponger) {
+                return 0;
+            }
+        }
+
+        // We're running here, so this can't fail
+        bool pinned = current_task->pinned;
+        sched_pin(current_task, cpu);
+
+        uint64_t start = rdtsc();
+
+        for (uint32_t i = 0; i < PINGPONG_ROUNDS; ++i) {
+            up(&pp->ping);
+            down(&pp->pong);
+        }
+
+        uint64_t cycles = rdtsc() - start;
+
+        if (!pinned) {
+            sched_unpin(current_task);
+        }
+
+        len = snprintf(text, sizeof(text),
+                       "rounds cycles ns cpu pong_cpu\n%u %u %u %u %u\n",
+                       PINGPONG_ROUNDS,
+                       (uint32_t)(cycles >> PINGPONG_SHIFT),
+                       (uint32_t)(cycles_to_ns(cycles) >> PINGPONG_SHIFT),
+                       cpu_id(), pp->pong_cpu);
+    }
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+static struct file_ops pingpong_fops = {
+    .read = pingpong_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_pingpong(void)
+{
+    if (create_device_file(&pingpong_fops, "pingpong", 0x444) < 0) {
+        PANIC("Unable to create pingpong device file!");
+    }
+}
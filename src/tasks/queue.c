@@ -0,0 +1,120 @@
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+
+/**
+ * Task queues. Every task is on the queue for its status: runnable tasks on
+ *   running (the one at the front is on the CPU, or next to be), blocked
+ *   tasks on blocked, and finished ones waiting to be reaped on zombies. The
+ *   idle task and tasks being set up or torn down aren't on any.
+ *
+ * The queues are circular intrusive lists, so moving a task between them,
+ *   or to the back of its own, takes constant time.
+ */
+struct list running = LIST_INIT(running);
+struct list blocked = LIST_INIT(blocked);
+struct list zombies = LIST_INIT(zombies);
+
+static struct list *status_queue(enum status status)
+{
+    switch (status) {
+    case TASK_RUNNING:
+        return &running;
+    case TASK_BLOCKED:
+        return &blocked;
+    case TASK_FINISHED:
+        return &zombies;
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Move a task to the back of the queue for status. Setting the status a
+ *   task already has just sends it to the back of its queue.
+ *
+ * The scheduler is told when a task starts or stops being runnable, and a
+ *   task woken from sleep may preempt the one running.
+ */
+void task_set_state(struct task *task, enum status status)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    enum status old = task->status;
+
+    if (old == TASK_RUNNING && status != TASK_RUNNING) {
+        sched_dequeue(task);
+    }
+
+    if (status_queue(old)) {
+        list_remove(&task->queue);
+    }
+
+    task->status = status;
+
+    struct list *queue = status_queue(status);
+    if (queue) {
+        list_insert(queue->prev, &task->queue);
+    }
+
+    if (status == TASK_RUNNING && old != TASK_RUNNING) {
+        sched_enqueue(task, old == TASK_BLOCKED);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+struct task *task_queue_first(struct list *queue)
+{
+    if (list_empty(queue)) {
+        return NULL;
+    }
+
+    return LIST_ENTRY(queue->next, struct task, queue);
+}
+
+/**
+ * Walk every task that's running or blocked, in no particular order. The
+ *   queues mustn't change under the walk, so callers keep interrupts off
+ *   and don't sleep between calls.
+ */
+static struct task *queued_task(struct list *queue, struct list *entry)
+{
+    if (entry != queue) {
+        return LIST_ENTRY(entry, struct task, queue);
+    }
+
+    if (queue == &running && !list_empty(&blocked)) {
+        return LIST_ENTRY(blocked.next, struct task, queue);
+    }
+
+    return NULL;
+}
+
+struct task *task_first(void)
+{
+    return queued_task(&running, running.next);
+}
+
+struct task *task_next(struct task *task)
+{
+    struct list *queue = task->status == TASK_BLOCKED ? &blocked : &running;
+
+    return queued_task(queue, task->queue.next);
+}
+
+/**
+ * Find a runnable or blocked task by pid
+ */
+struct task *task_find(uint32_t pid)
+{
+    struct task *task = pid_task(pid);
+
+    if (task && (task->status == TASK_RUNNING
+                 || task->status == TASK_BLOCKED))
+    {
+        return task;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,251 @@
+#include "task.h"
+#include "internal.h"
+
+#include "errno.h"
+
+#include "device/timer.h"
+
+/**
+ * Earliest-deadline-first scheduling (SCHED_DEADLINE), above every other
+ *   class. Each deadline task reserves a budget of runtime per period, and
+ *   of the tasks with budget left, the one whose deadline comes first runs.
+ *
+ * A task that uses up its budget is throttled until its next period, so
+ *   an overrunning task can't eat into anyone else's reservation. One that
+ *   wakes up after its period has ended starts a fresh one.
+ *
+ * Admission control keeps the deadline tasks' total bandwidth (the sum of
+ *   runtime / period) within DL_BW_MAX, which is what guarantees that EDF
+ *   meets every deadline on one CPU, and leaves some time over for
+ *   everything else. Bandwidths are fixed point, with DL_BW_SHIFT bits of
+ *   fraction. Everything here is in timer ticks.
+ *
+ * Each CPU has its own tree and throttled list, but admission control is
+ *   still for one CPU's worth of bandwidth: tasks are placed on a CPU as
+ *   they wake, not by their reservations, so that's all that's guaranteed.
+ */
+#define DL_BW_SHIFT 10
+#define DL_BW_MAX (95 * (1 << DL_BW_SHIFT) / 100)
+
+struct dl_rq {
+    struct rb_root tree;
+    struct list throttled;
+    struct task *curr;
+};
+
+static struct dl_rq rqs[NR_CPUS];
+static uint32_t total_bw;
+
+static struct dl_rq *cpu_rq(uint32_t cpu)
+{
+    struct dl_rq *rq = &rqs[cpu];
+
+    if (!rq->throttled.next) {
+        list_init(&rq->throttled);
+    }
+
+    return rq;
+}
+
+static uint32_t bandwidth(uint32_t runtime, uint32_t period)
+{
+    return (runtime << DL_BW_SHIFT) / period;
+}
+
+/**
+ * Reserve bandwidth for a task to have runtime ticks of every period,
+ *   in place of any it already has
+ */
+int dl_admit(struct task *task, uint32_t runtime, uint32_t period)
+{
+    uint32_t bw = bandwidth(runtime, period);
+    uint32_t old = task->se.policy == SCHED_DEADLINE
+        ? bandwidth(task->se.dl_runtime, task->se.dl_period)
+        : 0;
+
+    if (total_bw - old + bw > DL_BW_MAX) {
+        return -EBUSY;
+    }
+
+    total_bw = total_bw - old + bw;
+    return 0;
+}
+
+void dl_release(struct task *task)
+{
+    total_bw -= bandwidth(task->se.dl_runtime, task->se.dl_period);
+}
+
+/**
+ * Ticks until the next throttled task on a CPU is due its budget, for
+ *   stopping the tick while idle
+ */
+uint32_t dl_next_event(uint32_t cpu)
+{
+    struct dl_rq *rq = cpu_rq(cpu);
+    uint32_t next = UINT32_MAX;
+    struct list *entry;
+
+    LIST_FOR_EACH(&rq->throttled, entry) {
+        struct task *task = LIST_ENTRY(entry, struct task, se.rt_node);
+        uint32_t wait = time_before(ticks, task->se.next_period)
+            ? task->se.next_period - ticks : 0;
+
+        if (wait < next) {
+            next = wait;
+        }
+    }
+
+    return next;
+}
+
+static struct task *leftmost(struct dl_rq *rq)
+{
+    struct rb_node *node = rb_first(&rq->tree);
+    return node ? RB_ENTRY(node, struct task, se.node) : NULL;
+}
+
+static void insert(struct dl_rq *rq, struct task *task)
+{
+    struct rb_node **link = &rq->tree.node;
+    struct rb_node *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        link = time_before(task->se.deadline,
+                      RB_ENTRY(parent, struct task, se.node)->se.deadline)
+            ? &parent->left : &parent->right;
+    }
+
+    rb_link_node(&task->se.node, parent, link);
+    rb_insert_color(&task->se.node, &rq->tree);
+}
+
+static void start_period(struct task *task)
+{
+    task->se.deadline = ticks + task->se.dl_deadline;
+    task->se.next_period = ticks + task->se.dl_period;
+    task->se.budget = task->se.dl_runtime;
+}
+
+/**
+ * Queue a task to run, or throttle it if its budget is spent
+ */
+static void queue_task(struct dl_rq *rq, struct task *task)
+{
+    if (task->se.budget) {
+        insert(rq, task);
+    }
+    else {
+        list_insert(rq->throttled.prev, &task->se.rt_node);
+    }
+}
+
+static void dl_enqueue(struct task *task, bool __unused wakeup)
+{
+    if (!time_before(ticks, task->se.next_period)) {
+        start_period(task);
+    }
+
+    queue_task(cpu_rq(task->cpu), task);
+}
+
+static void dl_dequeue(struct task *task)
+{
+    struct dl_rq *rq = cpu_rq(task->cpu);
+
+    if (task == rq->curr) {
+        rq->curr = NULL;
+    }
+    else if (task->se.budget) {
+        rb_erase(&task->se.node, &rq->tree);
+    }
+    else {
+        list_remove(&task->se.rt_node);
+    }
+}
+
+static struct task *dl_pick_next(void)
+{
+    struct dl_rq *rq = cpu_rq(cpu_id());
+    struct task *task = leftmost(rq);
+
+    if (task) {
+        rb_erase(&task->se.node, &rq->tree);
+        rq->curr = task;
+    }
+
+    return task;
+}
+
+static void dl_put_prev(struct task *task)
+{
+    struct dl_rq *rq = cpu_rq(cpu_id());
+
+    sched_charge(task);
+
+    if (task != rq->curr) {
+        return;
+    }
+
+    rq->curr = NULL;
+    queue_task(rq, task);
+}
+
+/**
+ * Replenish the throttled tasks whose next period has come, and charge the
+ *   running task a tick of its budget
+ */
+static bool dl_tick(struct task *task)
+{
+    struct dl_rq *rq = cpu_rq(cpu_id());
+    bool preempt = false;
+    struct list *entry = rq->throttled.next;
+
+    while (entry != &rq->throttled) {
+        struct task *waiting = LIST_ENTRY(entry, struct task, se.rt_node);
+        entry = entry->next;
+
+        if (!time_before(ticks, waiting->se.next_period)) {
+            list_remove(&waiting->se.rt_node);
+            start_period(waiting);
+            insert(rq, waiting);
+
+            if (task->se.policy != SCHED_DEADLINE
+                || time_before(waiting->se.deadline, task->se.deadline))
+            {
+                preempt = true;
+            }
+        }
+    }
+
+    if (task != rq->curr) {
+        return preempt
+            || (task->se.policy != SCHED_DEADLINE && leftmost(rq));
+    }
+
+    if (task->se.budget) {
+        --task->se.budget;
+    }
+
+    struct task *next = leftmost(rq);
+
+    return preempt || !task->se.budget
+        || (next && time_before(next->se.deadline, task->se.deadline));
+}
+
+static bool dl_wakeup(struct task *task, struct task *woken)
+{
+    return task == rqs[task->cpu].curr
+        && time_before(woken->se.deadline, task->se.deadline);
+}
+
+const struct sched_class sched_dl = {
+    .name = "deadline",
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .put_prev = dl_put_prev,
+    .tick = dl_tick,
+    .wakeup = dl_wakeup,
+};
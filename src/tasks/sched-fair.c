@@ -0,0 +1,211 @@
+#include "task.h"
+#include "internal.h"
+
+/**
+ * Fair-share scheduling. Each task's runtime is weighted by its nice level
+ *   into a virtual runtime, and the runnable task that has had the least
+ *   runs next, so over time every task gets CPU in proportion to its weight.
+ *
+ * Runnable tasks wait in a red-black tree ordered by vruntime; the one on
+ *   the CPU (curr) is taken out while it runs and charged as it goes.
+ *   min_vruntime only moves forward, tracking the smallest vruntime among
+ *   runnable tasks.
+ *
+ * A task waking from sleep is placed no more than FAIR_SLEEPER_CREDIT
+ *   behind min_vruntime, so sleeping earns it a little head start but can't
+ *   bank CPU time to monopolise it later. It preempts the running task if
+ *   that one is more than FAIR_WAKEUP_GRANULARITY ahead of it; on a tick,
+ *   the running task is preempted once it's more than FAIR_GRANULARITY ahead
+ *   of the leftmost waiting task. All three are in sched clock units, so
+ *   roughly microseconds.
+ *
+ * Each CPU has its own tree and min_vruntime. A task moving between CPUs
+ *   keeps its place relative to min_vruntime, rather than its vruntime,
+ *   since the CPUs' virtual clocks run at their own rates.
+ */
+#define NICE_0_WEIGHT 1024
+
+#define FAIR_GRANULARITY 4000
+#define FAIR_WAKEUP_GRANULARITY 1000
+#define FAIR_SLEEPER_CREDIT 3000
+
+struct fair_rq {
+    struct rb_root tree;
+    struct task *curr;
+    uint64_t min_vruntime;
+};
+
+static struct fair_rq rqs[NR_CPUS];
+
+static struct task *leftmost(struct fair_rq *rq)
+{
+    struct rb_node *node = rb_first(&rq->tree);
+    return node ? RB_ENTRY(node, struct task, se.node) : NULL;
+}
+
+static void insert(struct fair_rq *rq, struct task *task)
+{
+    struct rb_node **link = &rq->tree.node;
+    struct rb_node *parent = NULL;
+
+    // Equal keys go right, so tasks with the same vruntime run in turn
+    while (*link) {
+        parent = *link;
+        link = task->se.vruntime < RB_ENTRY(parent, struct task, se.node)->se.vruntime
+            ? &parent->left : &parent->right;
+    }
+
+    rb_link_node(&task->se.node, parent, link);
+    rb_insert_color(&task->se.node, &rq->tree);
+}
+
+static void update_min_vruntime(struct fair_rq *rq)
+{
+    struct task *curr = rq->curr;
+    struct task *left = leftmost(rq);
+    uint64_t vruntime;
+
+    if (curr && left) {
+        vruntime = curr->se.vruntime < left->se.vruntime
+            ? curr->se.vruntime : left->se.vruntime;
+    }
+    else if (curr) {
+        vruntime = curr->se.vruntime;
+    }
+    else if (left) {
+        vruntime = left->se.vruntime;
+    }
+    else {
+        return;
+    }
+
+    if (vruntime > rq->min_vruntime) {
+        rq->min_vruntime = vruntime;
+    }
+}
+
+/**
+ * Charge the running task for its time on the CPU so far
+ */
+static void update_curr(struct fair_rq *rq)
+{
+    struct task *curr = rq->curr;
+
+    if (!curr) {
+        return;
+    }
+
+    uint32_t delta = sched_charge(curr);
+
+    curr->se.vruntime += delta * NICE_0_WEIGHT / curr->se.weight;
+    update_min_vruntime(rq);
+}
+
+static void fair_enqueue(struct task *task, bool wakeup)
+{
+    struct fair_rq *rq = &rqs[task->cpu];
+
+    update_curr(rq);
+
+    uint64_t floor = rq->min_vruntime;
+    if (wakeup) {
+        floor = floor > FAIR_SLEEPER_CREDIT ? floor - FAIR_SLEEPER_CREDIT : 0;
+    }
+
+    if (task->se.vruntime < floor) {
+        task->se.vruntime = floor;
+    }
+
+    insert(rq, task);
+}
+
+static void fair_dequeue(struct task *task)
+{
+    struct fair_rq *rq = &rqs[task->cpu];
+
+    if (task == rq->curr) {
+        update_curr(rq);
+        rq->curr = NULL;
+    }
+    else {
+        rb_erase(&task->se.node, &rq->tree);
+    }
+}
+
+static struct task *fair_pick_next(void)
+{
+    struct fair_rq *rq = &rqs[cpu_id()];
+    struct task *task = leftmost(rq);
+
+    if (task) {
+        rb_erase(&task->se.node, &rq->tree);
+        rq->curr = task;
+    }
+
+    return task;
+}
+
+static void fair_put_prev(struct task *task)
+{
+    struct fair_rq *rq = &rqs[cpu_id()];
+
+    if (task != rq->curr) {
+        // The idle task, or one that's just stopped being runnable
+        sched_charge(task);
+        return;
+    }
+
+    update_curr(rq);
+    rq->curr = NULL;
+    insert(rq, task);
+}
+
+static bool fair_tick(struct task *task)
+{
+    struct fair_rq *rq = &rqs[cpu_id()];
+
+    if (task != rq->curr) {
+        return false;
+    }
+
+    update_curr(rq);
+
+    struct task *left = leftmost(rq);
+    return left && task->se.vruntime > left->se.vruntime + FAIR_GRANULARITY;
+}
+
+static bool fair_wakeup(struct task *task, struct task *woken)
+{
+    struct fair_rq *rq = &rqs[task->cpu];
+
+    if (task != rq->curr) {
+        return false;
+    }
+
+    update_curr(rq);
+    return task->se.vruntime > woken->se.vruntime + FAIR_WAKEUP_GRANULARITY;
+}
+
+static void fair_migrate(struct task *task, uint32_t cpu)
+{
+    uint64_t from = rqs[task->cpu].min_vruntime;
+    uint64_t to = rqs[cpu].min_vruntime;
+
+    if (task->se.vruntime > from) {
+        task->se.vruntime = to + (task->se.vruntime - from);
+    }
+    else {
+        task->se.vruntime = to;
+    }
+}
+
+const struct sched_class sched_fair = {
+    .name = "fair",
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .put_prev = fair_put_prev,
+    .tick = fair_tick,
+    .wakeup = fair_wakeup,
+    .migrate = fair_migrate,
+};
@@ -0,0 +1,98 @@
+#include "task.h"
+#include "internal.h"
+
+#include "device/timer.h"
+
+/**
+ * Round-robin scheduling: runnable tasks take turns from the front of the
+ *   run queue, each running for up to RR_SLICE_MS before going to the back.
+ *   The task on the CPU is off the queue while it runs. Each CPU has its
+ *   own queue, initialised on first use.
+ */
+#define RR_SLICE_MS 100
+#define RR_SLICE_TICKS (MSECS_TO_TICKS(RR_SLICE_MS) ?: 1)
+
+struct rr_rq {
+    struct list queue;
+    struct task *curr;
+    uint32_t slice;
+};
+
+static struct rr_rq rqs[NR_CPUS];
+
+static struct rr_rq *cpu_rq(uint32_t cpu)
+{
+    struct rr_rq *rq = &rqs[cpu];
+
+    if (!rq->queue.next) {
+        list_init(&rq->queue);
+    }
+
+    return rq;
+}
+
+static void rr_enqueue(struct task *task, bool __unused wakeup)
+{
+    struct rr_rq *rq = cpu_rq(task->cpu);
+    list_insert(rq->queue.prev, &task->se.rt_node);
+}
+
+static void rr_dequeue(struct task *task)
+{
+    struct rr_rq *rq = cpu_rq(task->cpu);
+
+    if (task == rq->curr) {
+        rq->curr = NULL;
+    }
+    else {
+        list_remove(&task->se.rt_node);
+    }
+}
+
+static struct task *rr_pick_next(void)
+{
+    struct rr_rq *rq = cpu_rq(cpu_id());
+
+    if (list_empty(&rq->queue)) {
+        return NULL;
+    }
+
+    rq->curr = LIST_ENTRY(rq->queue.next, struct task, se.rt_node);
+    list_remove(&rq->curr->se.rt_node);
+    rq->slice = 0;
+
+    return rq->curr;
+}
+
+static void rr_put_prev(struct task *task)
+{
+    struct rr_rq *rq = cpu_rq(cpu_id());
+
+    sched_charge(task);
+
+    if (task == rq->curr) {
+        rq->curr = NULL;
+        rr_enqueue(task, false);
+    }
+}
+
+static bool rr_tick(struct task *task)
+{
+    struct rr_rq *rq = cpu_rq(cpu_id());
+    return task == rq->curr && ++rq->slice >= RR_SLICE_TICKS;
+}
+
+static bool rr_wakeup(struct task __unused *curr, struct task __unused *task)
+{
+    return false;
+}
+
+const struct sched_class sched_rr = {
+    .name = "rr",
+    .enqueue = rr_enqueue,
+    .dequeue = rr_dequeue,
+    .pick_next = rr_pick_next,
+    .put_prev = rr_put_prev,
+    .tick = rr_tick,
+    .wakeup = rr_wakeup,
+};
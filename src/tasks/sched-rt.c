@@ -0,0 +1,150 @@
+#include "task.h"
+#include "internal.h"
+
+#include "device/timer.h"
+
+/**
+ * Fixed-priority real-time scheduling (SCHED_FIFO and SCHED_RR). The
+ *   highest priority runnable task always runs, ahead of every normal task;
+ *   tasks of equal priority take turns in the order they became runnable.
+ *
+ * A SCHED_FIFO task runs until it blocks or a higher priority task wakes.
+ *   A SCHED_RR task also goes to the back of its queue after
+ *   RT_RR_SLICE_MS. A task that's preempted keeps its place at the front.
+ *
+ * There's one queue per priority, with a bitmap of the non-empty ones, so
+ *   finding the next task doesn't depend on how many there are. A queue is
+ *   only initialised as it becomes non-empty. Each CPU has its own set.
+ */
+#define RT_RR_SLICE_MS 100
+#define RT_RR_SLICE_TICKS (MSECS_TO_TICKS(RT_RR_SLICE_MS) ?: 1)
+
+#define RT_BITMAP_WORDS ((RT_PRIO_MAX + 32) / 32)
+
+struct rt_rq {
+    struct list queues[RT_PRIO_MAX + 1];
+    uint32_t bitmap[RT_BITMAP_WORDS];
+    struct task *curr;
+};
+
+static struct rt_rq rqs[NR_CPUS];
+
+static int highest_priority(struct rt_rq *rq)
+{
+    for (int i = RT_BITMAP_WORDS - 1; i >= 0; --i) {
+        if (rq->bitmap[i]) {
+            return i * 32 + 31 - __builtin_clz(rq->bitmap[i]);
+        }
+    }
+
+    return -1;
+}
+
+static void queue_task(struct rt_rq *rq, struct task *task, bool head)
+{
+    uint32_t prio = task->se.rt_priority;
+    struct list *queue = &rq->queues[prio];
+
+    if (!(rq->bitmap[prio / 32] & (1 << (prio % 32)))) {
+        list_init(queue);
+        rq->bitmap[prio / 32] |= 1 << (prio % 32);
+    }
+
+    list_insert(head ? queue : queue->prev, &task->se.rt_node);
+}
+
+static void unqueue_task(struct rt_rq *rq, struct task *task)
+{
+    uint32_t prio = task->se.rt_priority;
+
+    list_remove(&task->se.rt_node);
+
+    if (list_empty(&rq->queues[prio])) {
+        rq->bitmap[prio / 32] &= ~(1 << (prio % 32));
+    }
+}
+
+static void rt_enqueue(struct task *task, bool __unused wakeup)
+{
+    queue_task(&rqs[task->cpu], task, false);
+}
+
+static void rt_dequeue(struct task *task)
+{
+    struct rt_rq *rq = &rqs[task->cpu];
+
+    if (task == rq->curr) {
+        rq->curr = NULL;
+    }
+    else {
+        unqueue_task(rq, task);
+    }
+}
+
+static struct task *rt_pick_next(void)
+{
+    struct rt_rq *rq = &rqs[cpu_id()];
+
+    int prio = highest_priority(rq);
+    if (prio < 0) {
+        return NULL;
+    }
+
+    struct task *task = LIST_ENTRY(rq->queues[prio].next,
+                                   struct task, se.rt_node);
+    unqueue_task(rq, task);
+
+    if (task->se.policy == SCHED_RR && !task->se.rt_slice) {
+        task->se.rt_slice = RT_RR_SLICE_TICKS;
+    }
+
+    rq->curr = task;
+    return task;
+}
+
+static void rt_put_prev(struct task *task)
+{
+    struct rt_rq *rq = &rqs[cpu_id()];
+
+    sched_charge(task);
+
+    if (task != rq->curr) {
+        return;
+    }
+
+    rq->curr = NULL;
+    queue_task(rq, task,
+               task->se.policy != SCHED_RR || task->se.rt_slice > 0);
+}
+
+static bool rt_tick(struct task *task)
+{
+    struct rt_rq *rq = &rqs[cpu_id()];
+
+    if (task != rq->curr) {
+        // Normal tasks make way as soon as there's an RT task to run
+        return task->se.policy == SCHED_NORMAL && highest_priority(rq) >= 0;
+    }
+
+    if (task->se.policy == SCHED_RR && --task->se.rt_slice == 0) {
+        return true;
+    }
+
+    return highest_priority(rq) > (int)task->se.rt_priority;
+}
+
+static bool rt_wakeup(struct task *task, struct task *woken)
+{
+    return task == rqs[task->cpu].curr
+        && woken->se.rt_priority > task->se.rt_priority;
+}
+
+const struct sched_class sched_rt = {
+    .name = "rt",
+    .enqueue = rt_enqueue,
+    .dequeue = rt_dequeue,
+    .pick_next = rt_pick_next,
+    .put_prev = rt_put_prev,
+    .tick = rt_tick,
+    .wakeup = rt_wakeup,
+};
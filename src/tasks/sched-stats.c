@@ -0,0 +1,93 @@
+#include "task.h"
+#include "internal.h"
+
+#include "compiler.h"
+#include "cpu.h"
+#include "macros.h"
+#include "printf.h"
+#include "smp.h"
+
+#include "device/timer.h"
+#include "fs/devfs.h"
+
+/**
+ * /dev/sched: the normal scheduling class in use; for each CPU, how many
+ *   tasks it has runnable and how long it's been idle; and each task's CPU,
+ *   policy, priority (RT priority, or nice for normal tasks), virtual
+ *   runtime, total runtime and longest wait from wakeup to running (in
+ *   sched clock units)
+ */
+static const char *policy_name(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+    case SCHED_DEADLINE:
+        return "deadline";
+    default:
+        return "normal";
+    }
+}
+
+static uint32_t sched_read(file_t __unused *file, uint32_t *offset,
+                           uint32_t size, void *buf)
+{
+    static char text[4096];
+
+    uint32_t flags = irq_save();
+
+    uint32_t len = snprintf(text, sizeof(text),
+                            "class %s\n"
+                            "hz %u\n"
+                            "tick %s\n"
+                            "cpu running idle\n",
+                            sched->name, TIMER_HZ,
+                            timer_tick_stopped() ? "stopped" : "periodic");
+
+    for (uint32_t cpu = 0; cpu < nr_cpus && len < sizeof(text) - 1; ++cpu) {
+        struct task *idle = cpus[cpu].idle;
+
+        len += snprintf(text + len, sizeof(text) - len, "%u %u %u\n",
+                        cpu, cpus[cpu].nr_running,
+                        idle ? (uint32_t)idle->se.sum_exec : 0);
+    }
+
+    if (len < sizeof(text) - 1) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        "pid cpu policy prio vruntime runtime latency\n");
+    }
+
+    for (struct task *task = task_next_by_pid(0);
+         task && len < sizeof(text) - 1;
+         task = task_next_by_pid(task->pid))
+    {
+        int prio = task->se.policy == SCHED_NORMAL
+            ? task->se.nice : (int)task->se.rt_priority;
+
+        len += snprintf(text + len, sizeof(text) - len, "%u %u %s %d %u %u %u\n",
+                        task->pid, task->cpu, policy_name(task->se.policy), prio,
+                        (uint32_t)task->se.vruntime,
+                        (uint32_t)task->se.sum_exec,
+                        task->se.max_latency);
+    }
+
+    irq_restore(flags);
+
+    return devfs_read_text(text, len, offset, size, buf);
+}
+
+static struct file_ops sched_fops = {
+    .read = sched_read,
+    .write = NULL,
+    .open = devfs_open,
+    .close = NULL,
+};
+
+void init_sched_stats(void)
+{
+    if (create_device_file(&sched_fops, "sched", 0x444) < 0) {
+        PANIC("Unable to create sched device file!");
+    }
+}
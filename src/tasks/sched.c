@@ -0,0 +1,706 @@
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+#include "errno.h"
+#include "smp.h"
+
+#include "device/clock.h"
+#include "device/timer.h"
+
+/**
+ * Scheduler core: dispatch to the scheduling classes, runtime accounting,
+ *   nice levels and scheduling policies.
+ *
+ * Runtime is measured with the monotonic clock, in sched clock units of
+ *   1024ns (about a microsecond). Each charge is capped at SCHED_MAX_CHARGE,
+ *   which keeps weighted runtimes within 32-bit arithmetic.
+ *
+ * Every CPU has its own run queues. A task becoming runnable goes to the
+ *   CPU with the fewest runnable tasks, preferring the one it last ran on.
+ *   Every BALANCE_MS, and whenever a CPU runs out of tasks, it pulls normal
+ *   tasks from the busiest CPU until the two are even.
+ */
+#define SCHED_CLOCK_SHIFT 10
+#define SCHED_MAX_CHARGE ((1 << 22) - 1)
+
+#define BALANCE_MS 50
+#define BALANCE_TICKS (MSECS_TO_TICKS(BALANCE_MS) ?: 1)
+
+/* Longest SCHED_DEADLINE runtime, deadline or period, in milliseconds */
+#define DL_MAX_MS 1000000
+
+#ifndef CONFIG_SCHED
+#define CONFIG_SCHED sched_fair
+#endif
+
+const struct sched_class *sched = &CONFIG_SCHED;
+
+DEFINE_SPINLOCK(sched_lock);
+
+struct cpu cpus[NR_CPUS];
+uint32_t nr_cpus = 1;
+
+/* Each nice level is worth about 10% of CPU time against its neighbours */
+static const uint32_t nice_weights[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+};
+
+uint32_t nice_to_weight(int nice)
+{
+    return nice_weights[nice - NICE_MIN];
+}
+
+/**
+ * The classes in the order they're picked from: a lower rank goes first,
+ *   and preempts tasks of a higher one when it becomes runnable
+ */
+#define SCHED_NR_CLASSES 3
+
+static const struct sched_class *class_at(int rank)
+{
+    switch (rank) {
+    case 0:
+        return &sched_dl;
+    case 1:
+        return &sched_rt;
+    default:
+        return sched;
+    }
+}
+
+static int class_rank(const struct sched_class *class)
+{
+    for (int rank = 0; rank < SCHED_NR_CLASSES - 1; ++rank) {
+        if (class == class_at(rank)) {
+            return rank;
+        }
+    }
+
+    return SCHED_NR_CLASSES - 1;
+}
+
+const struct sched_class *task_sched_class(struct task *task)
+{
+    switch (task->se.policy) {
+    case SCHED_DEADLINE:
+        return &sched_dl;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return &sched_rt;
+    default:
+        return sched;
+    }
+}
+
+/**
+ * Flag a CPU's running task for preemption, interrupting the CPU if it
+ *   isn't this one
+ */
+static void resched_cpu(uint32_t cpu)
+{
+    if (cpus[cpu].resched) {
+        return;
+    }
+
+    cpus[cpu].resched = true;
+
+    if (cpu != cpu_id()) {
+        smp_send_reschedule(cpu);
+    }
+}
+
+/**
+ * Flag the task running on a CPU for preemption if a task that just became
+ *   runnable there should run instead
+ */
+static void check_preempt(struct task *task, bool wakeup)
+{
+    struct task *curr = cpus[task->cpu].task;
+
+    if (!curr) {
+        return;
+    }
+
+    if (curr == cpus[task->cpu].idle) {
+        resched_cpu(task->cpu);
+        return;
+    }
+
+    const struct sched_class *curr_class = task_sched_class(curr);
+    const struct sched_class *class = task_sched_class(task);
+
+    if (class_rank(class) < class_rank(curr_class)) {
+        resched_cpu(task->cpu);
+    }
+    else if (class == curr_class && wakeup && class->wakeup(curr, task)) {
+        resched_cpu(task->cpu);
+    }
+}
+
+/**
+ * Pick the CPU for a task that's becoming runnable. One that's pinned, or
+ *   that never left its CPU (woken before it could switch away), has to
+ *   stay there.
+ */
+static uint32_t select_cpu(struct task *task)
+{
+    uint32_t best = task->cpu;
+    uint32_t cpu;
+
+    if (task->pinned || cpus[best].task == task) {
+        return best;
+    }
+
+    for_each_cpu(cpu) {
+        if (cpus[cpu].nr_running < cpus[best].nr_running) {
+            best = cpu;
+        }
+    }
+
+    return best;
+}
+
+static void set_task_cpu(struct task *task, uint32_t cpu)
+{
+    const struct sched_class *class = task_sched_class(task);
+
+    if (task->cpu != cpu && class->migrate) {
+        class->migrate(task, cpu);
+    }
+
+    task->cpu = cpu;
+}
+
+void sched_enqueue(struct task *task, bool wakeup)
+{
+    if (wakeup) {
+        task->se.wakeup_start = clock_ns();
+    }
+
+    set_task_cpu(task, select_cpu(task));
+    ++cpus[task->cpu].nr_running;
+
+    task_sched_class(task)->enqueue(task, wakeup);
+    check_preempt(task, wakeup);
+    sched_update_tick();
+}
+
+void sched_dequeue(struct task *task)
+{
+    --cpus[task->cpu].nr_running;
+    task_sched_class(task)->dequeue(task);
+}
+
+/**
+ * Move a runnable task that's waiting on one CPU's run queue to another's
+ */
+static void move_task(struct task *task, uint32_t cpu)
+{
+    const struct sched_class *class = task_sched_class(task);
+
+    class->dequeue(task);
+    --cpus[task->cpu].nr_running;
+
+    set_task_cpu(task, cpu);
+
+    ++cpus[cpu].nr_running;
+    class->enqueue(task, false);
+}
+
+/**
+ * Pull normal tasks from the busiest CPU to this one until it has at most
+ *   one more runnable task. Real-time and deadline tasks stay where they
+ *   were woken, pinned tasks stay on their CPU, and a CPU's running task
+ *   stays put. Returns true if any
+ *   tasks were pulled.
+ */
+static bool balance(void)
+{
+    uint32_t this = cpu_id();
+    uint32_t busiest = this;
+    uint32_t cpu;
+
+    for_each_cpu(cpu) {
+        if (cpus[cpu].nr_running > cpus[busiest].nr_running) {
+            busiest = cpu;
+        }
+    }
+
+    bool pulled = false;
+    struct list *entry = running.next;
+
+    while (entry != &running
+           && cpus[busiest].nr_running > cpus[this].nr_running + 1)
+    {
+        struct task *task = LIST_ENTRY(entry, struct task, queue);
+        entry = entry->next;
+
+        if (task->cpu == busiest && task != cpus[busiest].task
+            && !task->pinned && task->se.policy == SCHED_NORMAL)
+        {
+            move_task(task, this);
+            pulled = true;
+        }
+    }
+
+    return pulled;
+}
+
+static struct task *pick_next(void)
+{
+    for (int rank = 0; rank < SCHED_NR_CLASSES; ++rank) {
+        struct task *task = class_at(rank)->pick_next();
+        if (task) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Pick this CPU's next task, pulling some from another CPU if it has none
+ */
+struct task *sched_pick_next(void)
+{
+    struct task *task = pick_next();
+
+    if (!task && nr_cpus > 1 && balance()) {
+        task = pick_next();
+    }
+
+    return task;
+}
+
+void sched_put_prev(struct task *task)
+{
+    task_sched_class(task)->put_prev(task);
+}
+
+/**
+ * Start charging a task that's just been given the CPU, and note how long
+ *   it waited for it if it's just woken up
+ */
+void sched_switched_in(struct task *task)
+{
+    uint64_t now = clock_ns();
+
+    task->se.exec_start = now;
+
+    if (task->se.wakeup_start) {
+        uint64_t latency = (now - task->se.wakeup_start) >> SCHED_CLOCK_SHIFT;
+
+        if (latency > task->se.max_latency) {
+            task->se.max_latency = latency > SCHED_MAX_CHARGE
+                ? SCHED_MAX_CHARGE : latency;
+        }
+
+        task->se.wakeup_start = 0;
+    }
+
+    sched_update_tick();
+}
+
+/**
+ * Charge a task for the time since it was last charged, returning the
+ *   time charged
+ */
+uint32_t sched_charge(struct task *task)
+{
+    uint64_t now = clock_ns();
+    uint64_t delta = (now - task->se.exec_start) >> SCHED_CLOCK_SHIFT;
+
+    task->se.exec_start = now;
+    if (delta > SCHED_MAX_CHARGE) {
+        delta = SCHED_MAX_CHARGE;
+    }
+
+    task->se.sum_exec += delta;
+    return delta;
+}
+
+/**
+ * A forked child inherits its parent's nice level, fixed priority and
+ *   virtual runtime, so forking doesn't earn a task any extra CPU time.
+ *   Deadline bandwidth is reserved per task, so the child of a deadline
+ *   task starts out normal.
+ */
+void sched_fork(struct task *child, struct task *parent)
+{
+    child->cpu = parent->cpu;
+    child->se.nice = parent->se.nice;
+    child->se.weight = parent->se.weight;
+    child->se.vruntime = parent->se.vruntime;
+
+    if (parent->se.pi_boosted) {
+        child->se.policy = parent->se.pi_policy;
+        child->se.rt_priority = parent->se.pi_priority;
+    }
+    else if (parent->se.policy != SCHED_DEADLINE) {
+        child->se.policy = parent->se.policy;
+        child->se.rt_priority = parent->se.rt_priority;
+    }
+}
+
+/**
+ * Keep a task on one CPU from now on, moving it there first if it's
+ *   waiting on another's run queue. A task running on another CPU can't
+ *   be moved, so it isn't pinned, and -EBUSY is returned.
+ */
+int sched_pin(struct task *task, uint32_t cpu)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    int err = 0;
+
+    if (task->cpu != cpu) {
+        if (cpus[task->cpu].task == task) {
+            err = -EBUSY;
+        }
+        else if (task->status == TASK_RUNNING) {
+            move_task(task, cpu);
+        }
+        else {
+            set_task_cpu(task, cpu);
+        }
+    }
+
+    if (!err) {
+        task->pinned = true;
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return err;
+}
+
+void sched_unpin(struct task *task)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    task->pinned = false;
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/**
+ * Give back a finished task's deadline bandwidth
+ */
+void sched_exit(struct task *task)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    if (task->se.policy == SCHED_DEADLINE) {
+        dl_release(task);
+        task->se.policy = SCHED_NORMAL;
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/**
+ * Called on every timer tick of a CPU: flags its running task to be
+ *   preempted at the end of the interrupt if a class says its time is up,
+ *   or if the idle task is running while there's something to run
+ */
+void sched_tick(void)
+{
+    static uint32_t last_balance[NR_CPUS];
+
+    struct cpu *cpu = this_cpu();
+
+    if (!cpu->task) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    for (int rank = 0; rank < SCHED_NR_CLASSES; ++rank) {
+        if (class_at(rank)->tick(cpu->task)) {
+            cpu->resched = true;
+        }
+    }
+
+    if (nr_cpus > 1 && ticks - last_balance[cpu_id()] >= BALANCE_TICKS) {
+        last_balance[cpu_id()] = ticks;
+        balance();
+    }
+
+    if (cpu->task == cpu->idle && cpu->nr_running) {
+        cpu->resched = true;
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/**
+ * Stop the periodic tick when nothing needs it: while the idle task runs,
+ *   or while a single task has the CPU to itself (unless it's a deadline
+ *   task, whose budget is counted in ticks). The timer is still set for the
+ *   next deadline task due its budget. Restart it once another task becomes
+ *   runnable.
+ *
+ * Only the boot CPU's tick can stop. The others tick themselves, but keep
+ *   time by the boot CPU's, so it keeps ticking while any of them is busy.
+ */
+void sched_update_tick(void)
+{
+#if CONFIG_NO_HZ
+    struct cpu *boot = &cpus[0];
+
+    if (!boot->task) {
+        return;
+    }
+
+    bool need_tick = boot->task != boot->idle
+        && (boot->nr_running > 1 || boot->task->se.policy == SCHED_DEADLINE);
+
+    for (uint32_t cpu = 1; cpu < nr_cpus; ++cpu) {
+        if (cpus[cpu].task != cpus[cpu].idle) {
+            need_tick = true;
+        }
+    }
+
+    if (need_tick) {
+        timer_restart_tick();
+    }
+    else {
+        uint32_t next = dl_next_event(0);
+        uint32_t timer = timer_next_event();
+
+        timer_stop_tick(timer < next ? timer : next);
+    }
+#endif
+}
+
+int nice(int increment)
+{
+    int value = current_task->se.nice + increment;
+
+    if (value < NICE_MIN) {
+        value = NICE_MIN;
+    }
+    else if (value > NICE_MAX) {
+        value = NICE_MAX;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    current_task->se.nice = value;
+    current_task->se.weight = nice_to_weight(value);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    return value;
+}
+
+/**
+ * Move a task to another policy, and so possibly another class. A runnable
+ *   task is taken out of its old class and put in its new one, and the
+ *   running task is re-picked in case it should no longer run.
+ */
+static void set_policy(struct task *task, int policy, uint32_t priority)
+{
+    bool runnable = task->status == TASK_RUNNING;
+
+    if (runnable) {
+        task_sched_class(task)->dequeue(task);
+    }
+
+    if (task->se.policy == SCHED_DEADLINE && policy != SCHED_DEADLINE) {
+        dl_release(task);
+    }
+
+    task->se.policy = policy;
+    task->se.rt_priority = priority;
+    task->se.rt_slice = 0;
+
+    if (runnable) {
+        task_sched_class(task)->enqueue(task, false);
+        resched_cpu(task->cpu);
+    }
+}
+
+static struct task *policy_task(uint32_t pid)
+{
+    return pid ? task_find(pid) : current_task;
+}
+
+/**
+ * The fixed priority a task waiting on a lock lends its holder: its own if
+ *   it's SCHED_FIFO or SCHED_RR, the highest for a deadline task, and none
+ *   for a normal one
+ */
+static uint32_t inherited_priority(int policy, uint32_t priority)
+{
+    switch (policy) {
+    case SCHED_DEADLINE:
+        return RT_PRIO_MAX;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return priority;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t pi_priority(struct task *task)
+{
+    return inherited_priority(task->se.policy, task->se.rt_priority);
+}
+
+/**
+ * Priority inheritance: while waiter waits on a lock task holds, task runs
+ *   as SCHED_FIFO at waiter's priority if that's higher than its own, so
+ *   tasks of priorities in between can't keep it (and so waiter) off the
+ *   CPU. A deadline task holding the lock already outranks every waiter.
+ *
+ * Only the holder is boosted: if it's waiting on another lock in turn, that
+ *   lock's holder isn't.
+ */
+void sched_boost(struct task *task, struct task *waiter)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t priority = pi_priority(waiter);
+
+    if (task->se.policy != SCHED_DEADLINE && priority > pi_priority(task)) {
+        if (!task->se.pi_boosted) {
+            task->se.pi_boosted = true;
+            task->se.pi_policy = task->se.policy;
+            task->se.pi_priority = task->se.rt_priority;
+        }
+
+        set_policy(task, SCHED_FIFO, priority);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/**
+ * Drop any priority a task inherited, once it releases a lock. If it holds
+ *   others that tasks are waiting on, the caller boosts it again for each.
+ */
+void sched_unboost(struct task *task)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    if (task->se.pi_boosted) {
+        task->se.pi_boosted = false;
+        set_policy(task, task->se.pi_policy, task->se.pi_priority);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/**
+ * Set a task's policy to SCHED_NORMAL (priority 0), or SCHED_FIFO or
+ *   SCHED_RR at a fixed priority from RT_PRIO_MIN to RT_PRIO_MAX; higher
+ *   priorities run first. pid 0 is the calling task.
+ */
+int sched_setscheduler(uint32_t pid, int policy, uint32_t priority)
+{
+    switch (policy) {
+    case SCHED_NORMAL:
+        if (priority != 0) {
+            return -EINVAL;
+        }
+        break;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        if (priority < RT_PRIO_MIN || priority > RT_PRIO_MAX) {
+            return -EINVAL;
+        }
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    struct task *task = policy_task(pid);
+    if (task && task->se.pi_boosted
+        && inherited_priority(policy, priority) <= pi_priority(task))
+    {
+        // Keep the boost until the lock's released, then take this on
+        task->se.pi_policy = policy;
+        task->se.pi_priority = priority;
+    }
+    else if (task) {
+        task->se.pi_boosted = false;
+        set_policy(task, policy, priority);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return task ? 0 : -ESRCH;
+}
+
+static uint32_t ms_to_ticks(uint32_t ms, bool round_up)
+{
+    return (ms * TIMER_HZ + (round_up ? 999 : 0)) / 1000;
+}
+
+/**
+ * Make a task SCHED_DEADLINE: in every period it's guaranteed runtime_ms of
+ *   CPU time, by deadline_ms after the period starts. A period of 0 is the
+ *   same as the deadline. Times are rounded to timer ticks, runtime up and
+ *   the rest down.
+ *
+ * Fails with -EBUSY if the deadline tasks would need more CPU time between
+ *   them than the admission limit (see sched-dl.c).
+ */
+int sched_setdeadline(uint32_t pid, uint32_t runtime_ms, uint32_t deadline_ms,
+                      uint32_t period_ms)
+{
+    if (!period_ms) {
+        period_ms = deadline_ms;
+    }
+
+    if (runtime_ms > DL_MAX_MS || deadline_ms > DL_MAX_MS
+        || period_ms > DL_MAX_MS)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t runtime = ms_to_ticks(runtime_ms, true);
+    uint32_t deadline = ms_to_ticks(deadline_ms, false);
+    uint32_t period = ms_to_ticks(period_ms, false);
+
+    if (!runtime || runtime > deadline || deadline > period) {
+        return -EINVAL;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    struct task *task = policy_task(pid);
+    int err = task ? dl_admit(task, runtime, period) : -ESRCH;
+
+    if (!err) {
+        bool runnable = task->status == TASK_RUNNING;
+
+        if (runnable) {
+            task_sched_class(task)->dequeue(task);
+        }
+
+        task->se.dl_runtime = runtime;
+        task->se.dl_deadline = deadline;
+        task->se.dl_period = period;
+
+        // Start a new period as soon as it's enqueued
+        task->se.next_period = ticks;
+        task->se.budget = 0;
+
+        task->se.policy = SCHED_DEADLINE;
+        task->se.rt_priority = 0;
+        task->se.pi_boosted = false;
+
+        if (runnable) {
+            sched_dl.enqueue(task, false);
+            resched_cpu(task->cpu);
+        }
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return err;
+}
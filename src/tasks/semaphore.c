@@ -0,0 +1,54 @@
+#include "semaphore.h"
+#include "task.h"
+#include "internal.h"
+
+/**
+ * Semaphores. up() with tasks waiting hands its count straight to the
+ *   first of them rather than adding it to count, so count is only ever
+ *   non-zero while no one waits, and no newcomer can take it first.
+ */
+void sema_init(struct semaphore *sem, uint32_t count)
+{
+    *sem = (struct semaphore)SEMAPHORE_INIT(*sem, count);
+}
+
+void down(struct semaphore *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    if (sem->count) {
+        --sem->count;
+    }
+    else {
+        struct waiter waiter = { .task = current_task };
+
+        list_insert(sem->waiters.prev, &waiter.list);
+        flags = wait_woken(&waiter, &sem->lock, flags);
+    }
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+bool down_trylock(struct semaphore *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+    bool taken = sem->count > 0;
+
+    if (taken) {
+        --sem->count;
+    }
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+    return taken;
+}
+
+void up(struct semaphore *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    if (!wake_first_waiter(&sem->waiters)) {
+        ++sem->count;
+    }
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
@@ -0,0 +1,92 @@
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+#include "errno.h"
+
+#include "device/clock.h"
+#include "device/timer.h"
+#include "memory/vmm.h"
+
+/**
+ * Timed sleeps. A sleeping task arms a timer to wake it, then sleeps as
+ *   usual: whichever comes first, the timer or anything else, wakes it.
+ *
+ * Interrupts stay off from arming the timer until the task is switched
+ *   out, so the timer can't go off before the task is asleep and be lost.
+ */
+struct sleeper {
+    struct timer timer;
+    struct task *task;
+};
+
+static void wake_sleeper(struct timer *timer)
+{
+    struct sleeper *sleeper = TIMER_ENTRY(timer, struct sleeper, timer);
+
+    if (sleeper->task->status == TASK_BLOCKED) {
+        task_set_state(sleeper->task, TASK_RUNNING);
+    }
+}
+
+/**
+ * Sleep until woken, or until timeout ticks have passed. Returns the ticks
+ *   that were left, which is 0 if it timed out.
+ */
+uint32_t sleep_timeout(uint32_t timeout)
+{
+    struct sleeper sleeper = { .task = current_task };
+    uint32_t expires = ticks + timeout;
+
+    timer_setup(&sleeper.timer, wake_sleeper);
+
+    uint32_t flags = irq_save();
+    timer_add(&sleeper.timer, expires);
+    sleep();
+    timer_cancel(&sleeper.timer);
+    irq_restore(flags);
+
+    return time_before(ticks, expires) ? expires - ticks : 0;
+}
+
+/**
+ * Sleep until the monotonic clock reaches deadline (in nanoseconds).
+ *   Ticks don't line up with the clock, so each sleep is for a tick more
+ *   than the time left, and it sleeps again if it still woke up early.
+ */
+void sleep_until(uint64_t deadline)
+{
+    uint64_t now;
+
+    while ((now = clock_ns()) < deadline) {
+        sleep_timeout(ns_to_ticks(deadline - now) + 1);
+    }
+}
+
+int clock_nanosleep(int clock, int flags, const struct timespec __user *req,
+                    struct timespec __user *rem)
+{
+    if (!check_user_ptr(req) || (rem && !check_user_ptr(rem))) {
+        return -EFAULT;
+    }
+
+    if (clock != CLOCK_MONOTONIC || req->tv_nsec >= NSEC_PER_SEC) {
+        return -EINVAL;
+    }
+
+    uint64_t ns = timespec_to_ns(req);
+    sleep_until(flags & TIMER_ABSTIME ? ns : clock_ns() + ns);
+
+    // Nothing interrupts a sleep yet, so there's never any time left
+    if (rem) {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
+
+    return 0;
+}
+
+int nanosleep(const struct timespec __user *req, struct timespec __user *rem)
+{
+    return clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+}
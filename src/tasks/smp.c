@@ -0,0 +1,276 @@
+#include "smp.h"
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+#include "errno.h"
+#include "fpu.h"
+#include "ldsymbol.h"
+#include "printf.h"
+#include "spinlock.h"
+
+#include "device/apic.h"
+#include "device/clock.h"
+#include "device/descriptor_tables.h"
+#include "device/mp.h"
+#include "memory/memory.h"
+#include "memory/pmm.h"
+#include "memory/vmm.h"
+
+/**
+ * Multiprocessor support: starting the other CPUs, and the kernel lock.
+ *
+ * The kernel was written for one CPU, with interrupts off as its only
+ *   locking, so every CPU runs kernel code under a single recursive lock,
+ *   taken on entry from an interrupt or syscall. User code runs in
+ *   parallel; the kernel doesn't (yet).
+ *
+ * A task switched out inside the kernel keeps the lock across the switch,
+ *   holding it as deeply as it did, and the CPU drops it only when the task
+ *   it switches to wasn't holding it (see switch_to and return_to_user).
+ */
+#define TRAMPOLINE_BASE 0x8000
+
+/* How long a CPU gets to come up after its startup IPIs */
+#define START_TIMEOUT_US 100000
+#define START_POLL_US 100
+
+extern ldsymbol ld_virtual_offset;
+
+extern ldsymbol trampoline_start;
+extern ldsymbol trampoline_params;
+extern ldsymbol trampoline_end;
+
+/* Filled in for each CPU before it's started: see trampoline.s */
+struct trampoline_params {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t cpu;
+} __attribute__((packed));
+
+static DEFINE_SPINLOCK(kernel_lock);
+
+static volatile bool cpu_started;
+
+void lock_kernel(void)
+{
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+
+    if (cpu->lock_depth++ == 0) {
+        raw_spin_lock(&kernel_lock);
+
+        // Catch up on kernel mappings removed while we were out
+        sync_kernel_tlb();
+    }
+
+    irq_restore(flags);
+}
+
+void unlock_kernel(void)
+{
+    uint32_t flags = irq_save();
+    struct cpu *cpu = this_cpu();
+
+    if (--cpu->lock_depth == 0) {
+        raw_spin_unlock(&kernel_lock);
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * Take on the lock depth of the task we're switching to, returning true
+ *   if the lock should be dropped once we're off the old task's stack
+ */
+bool kernel_lock_handoff(struct task *next)
+{
+    struct cpu *cpu = this_cpu();
+
+    cpu->lock_depth = next->lock_depth;
+    return cpu->lock_depth == 0;
+}
+
+void kernel_lock_drop(void)
+{
+    raw_spin_unlock(&kernel_lock);
+}
+
+/**
+ * Get another CPU to re-pick its task. Its need_resched is already set,
+ *   so the interrupt has nothing to do but arrive.
+ */
+void smp_send_reschedule(uint32_t cpu)
+{
+    lapic_send_ipi(cpus[cpu].apic_id, RESCHEDULE_INTERRUPT);
+}
+
+/**
+ * Where each CPU but the boot one starts in the kernel, on its idle task's
+ *   stack and with its own page directory. Once it's told the boot CPU it's
+ *   up, it waits for the kernel lock and goes idle.
+ */
+static void ap_main(uint32_t cpu)
+{
+    load_descriptor_tables(cpu);
+    fpu_init_cpu();
+
+    // The trampoline is done with, so is its identity mapping
+    *get_page_directory_entry(0) = 0;
+    flush_tlb_all();
+
+    lapic_enable(false);
+    cpu_started = true;
+
+    lock_kernel();
+
+    printf("CPU %u up (APIC %u)\n", cpu, cpus[cpu].apic_id);
+    lapic_start_timer();
+
+    current_task = this_cpu()->idle;
+    sched_switched_in(current_task);
+    idle_main(NULL);
+}
+
+/**
+ * A page directory for another CPU: the kernel's page tables, its own
+ *   recursive mapping, and the identity mapped trampoline to turn on
+ *   paging from
+ */
+static uint32_t alloc_page_directory(uint32_t identity)
+{
+    uint32_t frame = alloc_frame();
+    if (!frame) {
+        return 0;
+    }
+
+    uint32_t *pgdir = (uint32_t *)map_physical(frame);
+    uint32_t last = PAGE_SIZE / sizeof(uint32_t) - 1;
+
+    memset(pgdir, 0, PAGE_SIZE);
+
+    for (uint32_t i = DIRINDEX((uint32_t)ld_virtual_offset); i < last; ++i) {
+        pgdir[i] = (uint32_t)*get_page_directory_entry(i << 22);
+    }
+
+    pgdir[0] = identity | PG_WRITEABLE | PG_PRESENT;
+    pgdir[last] = frame | PG_WRITEABLE | PG_PRESENT;
+
+    unmap_page((uint32_t)pgdir);
+    return frame;
+}
+
+static int start_cpu(uint32_t cpu, uint32_t apic_id,
+                     struct trampoline_params *params, uint32_t identity)
+{
+    struct task *idle = create_idle_task();
+    if (!idle) {
+        return -ENOMEM;
+    }
+
+    uint32_t pgdir = alloc_page_directory(identity);
+    if (!pgdir) {
+        free_task(idle);
+        return -ENOMEM;
+    }
+
+    idle->cpu = cpu;
+    cpus[cpu].apic_id = apic_id;
+    cpus[cpu].idle = idle;
+
+    params->cr0 = read_cr0();
+    params->cr3 = pgdir;
+    params->stack = idle->kstack + KSTACK_SIZE;
+    params->entry = (uint32_t)&ap_main;
+    params->cpu = cpu;
+
+    cpu_started = false;
+    lapic_start_ap(apic_id, TRAMPOLINE_BASE);
+
+    for (uint32_t waited = 0;
+         !cpu_started && waited < START_TIMEOUT_US;
+         waited += START_POLL_US)
+    {
+        udelay(START_POLL_US);
+    }
+
+    // A late starter may yet use its page directory and idle task, so
+    //   they're left alone
+    return cpu_started ? 0 : -ENODEV;
+}
+
+/**
+ * Find the other CPUs and start them, up to NR_CPUS in all. Runs before
+ *   the scheduler starts, so they sit waiting for the kernel lock until the
+ *   boot CPU first drops it.
+ */
+void init_smp(void)
+{
+    printf("Initializing SMP...\n");
+
+    struct mp_config config;
+
+    int err = mp_find_cpus(&config);
+    if (err < 0) {
+        printf("no multiprocessor tables, running on one CPU\n");
+        return;
+    }
+
+    err = init_lapic(config.lapic);
+    if (err < 0) {
+        printf("[ERROR] Unable to map local APIC (%s)\n", strerror(-err));
+        return;
+    }
+
+    lapic_enable(true);
+    cpus[0].apic_id = lapic_id();
+
+    uint32_t identity = alloc_frame();
+    if (!identity) {
+        printf("[ERROR] Unable to start other CPUs (%s)\n",
+               strerror(ENOMEM));
+        return;
+    }
+
+    uint32_t *table = (uint32_t *)map_physical(identity);
+    memset(table, 0, PAGE_SIZE);
+    table[TBLINDEX(TRAMPOLINE_BASE)] =
+        TRAMPOLINE_BASE | PG_WRITEABLE | PG_PRESENT;
+    unmap_page((uint32_t)table);
+
+    uint32_t trampoline = map_physical(TRAMPOLINE_BASE);
+    memcpy((void *)trampoline, trampoline_start,
+           trampoline_end - trampoline_start);
+
+    struct trampoline_params *params = (struct trampoline_params *)
+        (trampoline + (trampoline_params - trampoline_start));
+
+    for (uint32_t i = 0; i < config.nr_cpus && nr_cpus < NR_CPUS; ++i) {
+        if (config.apic_ids[i] == cpus[0].apic_id) {
+            continue;
+        }
+
+        err = start_cpu(nr_cpus, config.apic_ids[i], params, identity);
+        if (err < 0) {
+            printf("[ERROR] Unable to start CPU with APIC %u (%s)\n",
+                   config.apic_ids[i], strerror(-err));
+            break;
+        }
+
+        ++nr_cpus;
+    }
+
+    unmap_page(trampoline);
+
+    // Every CPU that came up has unmapped the trampoline; if one didn't,
+    //   it could still be using the table
+    if (!err) {
+        table = (uint32_t *)map_physical(identity);
+        free_frame((uint32_t)table);
+        unmap_page((uint32_t)table);
+    }
+
+    printf("%u of %u CPUs online\n", nr_cpus, config.nr_cpus);
+}
@@ -0,0 +1,49 @@
+        ;; switch.s - switching kernel stacks between tasks
+        ;;
+        ;; A task switched out is always inside switch_stacks, called from
+        ;; switch_to(), so all that needs saving is what the C calling
+        ;; convention says survives a call: ebx, esi, edi, ebp and the stack
+        ;; pointer. Everything else the task had is further up its stack.
+
+        [GLOBAL switch_stacks]
+        [GLOBAL ret_from_fork]
+
+        extern kernel_lock_drop
+
+        [SECTION .text]
+
+        ;; void switch_stacks(uint32_t *save, uint32_t load)
+switch_stacks:
+        mov eax, [esp + 4]
+        mov edx, [esp + 8]
+
+        push ebp
+        push ebx
+        push esi
+        push edi
+
+        mov [eax], esp
+        mov esp, edx
+
+        pop edi
+        pop esi
+        pop ebx
+        pop ebp
+        ret
+
+        ;; Where a forked child first runs, returning from switch_stacks
+        ;; onto the copy of its parent's syscall frame. It doesn't hold the
+        ;; kernel lock the CPU handed it (see switch_to), so drops it, then
+        ;; goes back to user mode as its parent will.
+ret_from_fork:
+        call kernel_lock_drop
+
+        pop eax
+        mov ds, ax
+        mov es, ax
+        mov fs, ax
+        mov gs, ax
+
+        popa
+        add esp, 8
+        iret
@@ -3,148 +3,235 @@
 
 #include "algorithm.h"
 #include "bool.h"
+#include "cpu.h"
 #include "errno.h"
+#include "fpu.h"
 #include "ldsymbol.h"
+#include "preempt.h"
 #include "printf.h"
+#include "smp.h"
+#include "workqueue.h"
 
+#include "device/apic.h"
 #include "device/descriptor_tables.h"
 #include "device/port.h"
 #include "device/timer.h"
 #include "fs/vfs.h"
 #include "memory/kheap.h"
+#include "memory/ksm.h"
 #include "memory/memory.h"
 #include "memory/pmm.h"
+#include "memory/slab.h"
+#include "memory/vmalloc.h"
 #include "memory/vmm.h"
+#include "memory/zram.h"
 
 extern ldsymbol ld_virtual_offset;
 
-static uint32_t next_pid;
-
-struct task *current_task;
-
-struct task *running;
-struct task *blocked;
-struct task *idle;
-struct task *zombies;
+static DEFINE_KMEM_CACHE(task_cache, struct task, NULL);
 
 /**
- * Task queue functions. Implemented with a simple doubly linked list.
- *
- * Removing doesn't work strictly as a queue - tasks can be found and
- * removed anywhere in the queue by pid.
+ * Management of task memory, pids and default files, etc. Kernel threads
+ *   have neither an address space nor files of their own.
  */
-void task_queue_add(struct task **queue, struct task *task)
+static struct task *alloc_kernel_task(void)
 {
+    struct task *task = kmem_cache_zalloc(&task_cache);
+
     if (!task) {
-        return;
+        errno = -ENOMEM;
+        return NULL;
     }
-    
-    struct task *curr = *queue;
 
-    if (!curr) {
-        *queue = task;
-        task->next = NULL;
-        task->prev = NULL;
-        return;
+    if (attach_pid(task) < 0) {
+        kmem_cache_free(&task_cache, task);
+        errno = -EAGAIN;
+        return NULL;
     }
 
-    while (curr->next) {
-        curr = curr->next;
-    }
+    list_init(&task->children);
+    list_init(&task->children_list);
+    wait_queue_init(&task->child_exit);
+    list_init(&task->mutexes);
 
-    curr->next = task;
-    task->prev = curr;
-    task->next = NULL;
+    task->se.weight = nice_to_weight(0);
+
+    return task;
 }
 
-void task_queue_remove(struct task **queue, struct task *task)
+struct task *alloc_task()
 {
+    struct task *task = alloc_kernel_task();
+
     if (!task) {
-        return;
+        return NULL;
     }
 
-    if (*queue == task) {
-        *queue = task->next;
+    task->as = alloc_address_space();
+
+    if (!task->as) {
+        free_task(task);
+        errno = -ENOMEM;
+        return NULL;
     }
 
-    if (task->prev) {
-        task->prev->next = task->next;
+    task->files[0] = open_path("/dev/tty", MODE_READ);
+    task->files[1] = open_path("/dev/tty", MODE_WRITE);
+    task->files[2] = open_path("/dev/tty", MODE_WRITE);
+
+    return task;
+}
+
+void free_task(struct task *task)
+{
+    task_set_state(task, TASK_NEW);
+    detach_pid(task);
+    fpu_release(task);
+    free_address_space(task->as);
+    free_kstack(task->kstack);
+    kmem_cache_free(&task_cache, task);
+}
+
+/**
+ * Whether the background scans of user pages (below, and in wss.c) should
+ *   leave a task alone. Kernel threads have no user pages to scan. A task
+ *   whose address space is live on another CPU, because it's running there
+ *   or a kernel thread is running on its page tables, may be cached in that
+ *   CPU's TLB, so it's skipped until it's switched out.
+ */
+bool task_skip_scan(struct task *task)
+{
+    uint32_t cpu;
+
+    if (!task->as) {
+        return true;
     }
 
-    if (task->next) {
-        task->next->prev = task->prev;
+    for_each_cpu(cpu) {
+        if (cpu != cpu_id()
+            && (cpus[cpu].task == task || cpus[cpu].as == task->as))
+        {
+            return true;
+        }
     }
+
+    return false;
 }
 
-struct task *task_queue_find(struct task **queue, uint32_t pid)
+/**
+ * Compress cold pages of every task into zram while free memory is low.
+ *   Interrupts are only off while each task is looked up and scanned, and
+ *   the walk goes by pid so it can pick up again after a switch.
+ */
+static void reclaim_memory(void)
 {
-    for (struct task *task = *queue; task; task = task->next) {
-        if (task->pid == pid) {
-            return task;
+    uint32_t pid = 0;
+
+    while (zram_under_pressure()) {
+        uint32_t flags = irq_save();
+
+        struct task *task = task_next_by_pid(pid);
+        if (task) {
+            pid = task->pid;
+
+            if (!task_skip_scan(task)) {
+                zram_reclaim(task->as, ZRAM_RECLAIM_BATCH);
+            }
         }
-    }
 
-    return NULL;
+        irq_restore(flags);
+
+        if (!task) {
+            break;
+        }
+
+        cond_resched();
+    }
 }
 
-void task_queue_remove_safe(struct task **queue, struct task *task)
+/**
+ * Find the task with the lowest pid greater than pid, so scans can walk
+ *   every task exactly once per pass
+ */
+struct task *task_next_by_pid(uint32_t pid)
 {
-    struct task *found = task_queue_find(queue, task->pid);
-    if (found) {
-	printf("removing task from queue %s\n", (queue == &running ? "running" : (queue == &blocked ? "blocked" : "zombies")));
-	task_queue_remove(queue, task);
+    struct list *queues[] = { &running, &blocked };
+    struct list *entry;
+    struct task *next = NULL;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(queues); ++i) {
+        LIST_FOR_EACH(queues[i], entry) {
+            struct task *task = LIST_ENTRY(entry, struct task, queue);
+            if (task->pid > pid && (!next || task->pid < next->pid)) {
+                next = task;
+            }
+        }
     }
+
+    return next;
 }
 
 /**
- * Management of task memory, pids and default files, etc.
+ * Merge identical user pages, a batch at a time. The scan picks up from
+ *   the pid it got to, so the task is looked up again after any switch.
  */
-struct task *alloc_task()
+static void merge_pages(void)
 {
-    struct task *task = kzalloc(MEM_GEN, sizeof(*task));
+    static uint32_t pid;
+    static uint32_t virtual;
 
-    if (!task) {
-        errno = -ENOMEM;
-        goto error;
-    }
+    uint32_t budget = KSM_SCAN_BATCH;
+    uint32_t flags = irq_save();
 
-    task->as = alloc_address_space();
+    struct task *task = task_find(pid);
 
-    if (!task->as) {
-        errno = -ENOMEM;
-        goto error_task;
-    }
+    while (budget > 0) {
+        if (!task || virtual >= (uint32_t)ld_virtual_offset) {
+            task = task_next_by_pid(task ? task->pid : pid);
+            virtual = 0;
 
-    task->pid = next_pid++;
+            if (!task) {
+                ksm_end_pass();
+                pid = 0;
+                break;
+            }
+        }
 
-    task->files[0] = open_path("/dev/tty", MODE_READ);
-    task->files[1] = open_path("/dev/tty", MODE_WRITE);
-    task->files[2] = open_path("/dev/tty", MODE_WRITE);
+        pid = task->pid;
 
-    list_init(&task->children);
-    list_init(&task->children_list);
+        if (task_skip_scan(task)) {
+            virtual = (uint32_t)ld_virtual_offset;
+            continue;
+        }
 
-    return task;
+        budget -= min(budget, ksm_scan(task->as, &virtual, budget));
 
- error_task:
-    kfree(task);
- error:
-    return NULL;
-}
+        if (cond_resched()) {
+            task = task_find(pid);
+        }
+    }
 
-void free_task(struct task *task)
-{
-    free_address_space(task->as);
-    free_kstack(task->esp0);
-    kfree(task);
+    irq_restore(flags);
 }
 
 /**
- * The idle task's main loop
+ * The idle task's main loop. Idle tasks run without the kernel lock, so
+ *   the boot CPU's takes it for the background work; the others just wait
+ *   for something to run. They start out holding it, like any kernel
+ *   thread.
  */
-static void halt()
+void idle_main(void __unused *data)
 {
+    unlock_kernel();
+
     while (true) {
+        if (cpu_id() == 0) {
+            lock_kernel();
+            reclaim_memory();
+            merge_pages();
+            unlock_kernel();
+        }
+
         asm volatile ("sti\n\t"
                       "hlt\n\t");
     }
@@ -152,20 +239,117 @@ static void halt()
 
 /**
  * Management functions for the task's kernel stack (each task has its own,
- * switched on context switch)
+ * switched on context switch). Stacks are mapped by vmalloc, so each sits
+ * above an unmapped guard page; a few recently freed ones are kept mapped
+ * per CPU so fork() and exit() don't map and unmap pages every time.
  */
+#define KSTACK_CACHE_SIZE 4
+
+struct kstack_cache {
+    uint32_t stacks[KSTACK_CACHE_SIZE];
+    uint32_t count;
+};
+
+static struct kstack_cache kstack_caches[NR_CPUS];
+
 uint32_t alloc_kstack()
 {
-    uint32_t stack = (uint32_t)kzalloc(MEM_GEN, PAGE_SIZE);
-    return stack + PAGE_SIZE;
+    struct kstack_cache *cache = &kstack_caches[cpu_id()];
+    uint32_t stack = 0;
+
+    uint32_t flags = irq_save();
+    if (cache->count > 0) {
+        stack = cache->stacks[--cache->count];
+    }
+    irq_restore(flags);
+
+    if (!stack) {
+        stack = (uint32_t)vmalloc(KSTACK_SIZE);
+    }
+
+    return stack;
 }
 
-void free_kstack(uint32_t esp0)
+void free_kstack(uint32_t kstack)
 {
-    uint32_t stack_bottom = align_down(esp0, PAGE_SIZE);
-    kfree((void *)stack_bottom);
+    if (!kstack) {
+        return;
+    }
+
+    struct kstack_cache *cache = &kstack_caches[cpu_id()];
+
+    uint32_t flags = irq_save();
+    if (cache->count < KSTACK_CACHE_SIZE) {
+        cache->stacks[cache->count++] = kstack;
+        kstack = 0;
+    }
+    irq_restore(flags);
+
+    vfree((void *)kstack);
 }
 
+/**
+ * Kernel threads have no user address space, so they run on whichever one
+ *   the CPU last loaded, and a user task that only gave the CPU up to a
+ *   kernel thread comes back without its page tables being switched at all.
+ *   The tables are still saved on the way out, as the task may run on
+ *   another CPU meanwhile.
+ */
+static void switch_user_space(struct task *old, struct task *new)
+{
+    struct cpu *cpu = this_cpu();
+
+    if (!new->as) {
+        save_address_space(old->as);
+        return;
+    }
+
+    if (old->as) {
+        switch_address_space(old->as, new->as);
+    }
+    else if (cpu->as != new->as) {
+        switch_address_space(NULL, new->as);
+
+        // The tables we were on were freed, and their frames may be back
+        //   in use at the same addresses
+        if (!cpu->as) {
+            flush_tlb_all();
+        }
+    }
+
+    cpu->as = new->as;
+}
+
+/**
+ * Switch from prev's kernel stack to next's. Every task switched out is
+ *   inside here, so only the registers a call preserves need saving; the
+ *   rest are on the stack, above us. A task only goes through an iret
+ *   again to get back to user mode.
+ *
+ * next takes over the kernel lock as deeply as it held it when it was
+ *   switched out. Only a newly forked child doesn't hold it, and that drops
+ *   the lock itself once it's running (see ret_from_fork).
+ */
+static void switch_to(struct task *prev, struct task *next)
+{
+    struct cpu *cpu = this_cpu();
+
+    prev->preempt_count = cpu->preempt_count;
+    cpu->preempt_count = next->preempt_count;
+
+    fpu_switch_out(prev);
+    kernel_lock_handoff(next);
+    set_esp0(next->kstack + KSTACK_SIZE);
+    switch_stacks(&prev->esp, next->esp);
+}
+
+/**
+ * Put the running task back to its scheduling class and switch to the one
+ *   the classes pick next, or to the idle task if nothing is runnable
+ *
+ * The old task carries on from here when it's next picked, holding the
+ *   kernel lock as deeply as we do now.
+ */
 void switch_tasks(void)
 {
     if (!current_task) {
@@ -173,105 +357,201 @@ void switch_tasks(void)
     }
 
     struct task *old = current_task;
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
 
-    if (task_queue_find(&running, old->pid)) {
-        task_queue_remove(&running, old);
-        task_queue_add(&running, old);
-    }
+    need_resched = false;
+    sched_put_prev(old);
 
-    if (running) {
-        current_task = running;
-    }
-    else {
-        current_task = idle;
+    current_task = sched_pick_next();
+    if (!current_task) {
+        current_task = this_cpu()->idle;
     }
 
+    sched_switched_in(current_task);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
     if (old == current_task) {
         return;
     }
 
-    switch_address_space(old->as, current_task->as);
-    switch_context(current_task);
+    old->lock_depth = this_cpu()->lock_depth;
+    ++old->se.nr_switches;
+
+    switch_user_space(old, current_task);
+    switch_to(old, current_task);
 }
 
 static void timer_handler(registers_t __unused *regs)
 {
-    static uint32_t ticks = 0;
-    ++ticks;
+    run_timers();
+    sched_tick();
+    sched_update_tick();
+}
 
-    if (ticks % 5 == 0 && current_task) {
-        switch_tasks();
-    }
+/* The other CPUs tick from their local APIC timers */
+static void cpu_timer_handler(registers_t __unused *regs)
+{
+    sched_tick();
 }
 
 /**
- * Set up the task's kernel stack as if we had just pushed data onto it, so
- * we can return from it as if we had just been interrupted when
- * switch_context() is called
+ * Set up the task's kernel stack as if we had just pushed data onto it,
+ *   leaving the task's stack pointer below it
  */
 unsigned long setup_stack(struct task *task, void *data, unsigned long size)
 {
-    task->esp0 = alloc_kstack();
-    if (!idle->esp0) {
+    task->kstack = alloc_kstack();
+    if (!task->kstack) {
         return -ENOMEM;
     }
 
-    task->esp0 -= size;
-    memcpy((void *)task->esp0, data, size);
+    task->esp = task->kstack + KSTACK_SIZE - size;
+    task->lock_depth = 0;
+    memcpy((void *)task->esp, data, size);
     return 0;
 }
 
-static int create_idle_task(void)
+/**
+ * Where every kernel thread starts, holding the kernel lock it was switched
+ *   to with. Interrupts are still off from the switch.
+ */
+static void kthread_start(void (*fn)(void *data), void *data)
 {
-    idle = alloc_task();
-    if (!idle) {
-        return -ENOMEM;
-    }
+    irq_restore(EFLAGS_IF);
+    fn(data);
 
-    // Set up the stack as if an interrupt had just occured *right* where
-    //   we want the task to begin, so switch_context() can iret smoothly
-    // See Intel developer's manual 6.4.1 (page 6-9)
+    PANIC("kernel thread returned");
+}
+
+/**
+ * Set up a kernel thread's stack for switch_stacks() to return to
+ *   kthread_start(fn, data) from
+ */
+static int setup_kthread_stack(struct task *task, void (*fn)(void *data),
+                               void *data)
+{
     uint32_t stack[] = {
-        0x10, // DS, ES, FS, GS
-        0, 0, 0, 0, 0, 0, 0, 0, // general-purpose registers
-        0, 0, // interrupt number, error code
-        (uint32_t)&halt, // eip
-        0x08, // CS
-        (1 << 9), // eflags
+        0, 0, 0, 0, // edi, esi, ebx, ebp
+        (uint32_t)&kthread_start,
+        0, // return address
+        (uint32_t)fn,
+        (uint32_t)data,
     };
 
-    int err = setup_stack(idle, stack, sizeof(stack));
+    int err = setup_stack(task, stack, sizeof(stack));
     if (err < 0) {
-        free_task(idle);
         return err;
     }
 
+    task->lock_depth = 1;
     return 0;
 }
 
+/**
+ * A CPU's idle task, which runs in the kernel when nothing else will
+ */
+struct task *create_idle_task(void)
+{
+    struct task *idle = alloc_task();
+    if (!idle) {
+        return NULL;
+    }
+
+    int err = setup_kthread_stack(idle, &idle_main, NULL);
+    if (err < 0) {
+        free_task(idle);
+        errno = err;
+        return NULL;
+    }
+
+    return idle;
+}
+
+/**
+ * Start a kernel thread running fn(data) in the kernel, on the CPU's
+ *   current page tables. It inherits the scheduling parameters of the task
+ *   that started it, if any, and runs until the kernel stops: fn mustn't
+ *   return.
+ */
+static struct task *kthread_create(void (*fn)(void *data), void *data)
+{
+    struct task *task = alloc_kernel_task();
+    if (!task) {
+        return NULL;
+    }
+
+    int err = setup_kthread_stack(task, fn, data);
+    if (err < 0) {
+        free_task(task);
+        errno = err;
+        return NULL;
+    }
+
+    if (current_task) {
+        sched_fork(task, current_task);
+    }
+    else {
+        task->cpu = cpu_id();
+    }
+
+    return task;
+}
+
+struct task *kthread_run(void (*fn)(void *data), void *data)
+{
+    struct task *task = kthread_create(fn, data);
+    if (!task) {
+        return NULL;
+    }
+
+    task_set_state(task, TASK_RUNNING);
+    return task;
+}
+
+/**
+ * Start a kernel thread that only ever runs on the given CPU
+ */
+struct task *kthread_run_on(void (*fn)(void *data), void *data, uint32_t cpu)
+{
+    struct task *task = kthread_create(fn, data);
+    if (!task) {
+        return NULL;
+    }
+
+    // Not runnable yet, so it can go anywhere
+    sched_pin(task, cpu);
+    task_set_state(task, TASK_RUNNING);
+    return task;
+}
+
 void init_scheduler(void)
 {
     printf("Initializing scheduler...\n");
 
-    int err = create_idle_task();
-    if (err < 0) {
+    int err = 0;
+
+    cpus[0].idle = create_idle_task();
+    if (!cpus[0].idle) {
+        err = errno;
         goto error;
     }
 
-    running = alloc_task();
-    if (!running) {
+    struct task *init = alloc_task();
+    if (!init) {
         err = -ENOMEM;
         goto error;
     }
 
-    /* blocked = NULL; */
-    /* zombies = NULL; */
+    task_set_state(init, TASK_RUNNING);
+    init_workqueue();
 
     printf("allocated idle and init tasks\n");
 
-    current_task = running;
-    register_interrupt_handler(32, &timer_handler);
-    init_timer(5);
+    current_task = sched_pick_next();
+    sched_switched_in(current_task);
+    register_interrupt_handler(TIMER_INTERRUPT, &timer_handler);
+    register_interrupt_handler(APIC_TIMER_INTERRUPT, &cpu_timer_handler);
+    init_timer(TIMER_HZ);
 
     printf("initialized timer\n");
 
@@ -284,26 +564,64 @@ void init_scheduler(void)
     PANIC();
 }
 
-void sleep(void)
+/**
+ * Give up the CPU to whichever task the scheduler picks next. A task that
+ *   set itself blocked beforehand stays off it until it's woken.
+ */
+void schedule(void)
 {
-    task_queue_remove(&running, current_task);
-    task_queue_add(&blocked, current_task);
+    uint32_t flags = irq_save();
+    switch_tasks();
+    irq_restore(flags);
+}
 
-    current_task->status = TASK_BLOCKED;
+/**
+ * Called when preemption's enabled again with interrupts on, and the
+ *   scheduler wanted the CPU back meanwhile
+ */
+void preempt_schedule(void)
+{
+    uint32_t flags = irq_save();
 
-    asm volatile ("mov $12, %%eax\n\t"
-                  "int $0x80\n\t"
-                  : : :); // sys_yield() TODO: This shouldn't be syscall 12.. :P
+    if (!preempt_count() && need_resched) {
+        switch_tasks();
+    }
+
+    irq_restore(flags);
 }
 
-void wake(uint32_t pid)
+/**
+ * A point in a long stretch of kernel code where it's safe to be switched
+ *   out, if something else should run. Interrupts are let in for a moment,
+ *   so a tick that came due while they were off can ask for the switch;
+ *   the way out of the interrupt takes it. Returns true if we were switched
+ *   out, so anything found before then should be looked up again.
+ */
+bool cond_resched(void)
 {
-    struct task *task = task_queue_find(&blocked, pid);
+    if (!current_task || preempt_count()) {
+        return false;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t switches = current_task->se.nr_switches;
 
-    if (task) {
-        task_queue_remove(&blocked, task);
-        task_queue_add(&running, task);
+    asm volatile ("sti\n\t"
+                  "nop\n\t"
+                  "cli\n\t"
+                  : : : "memory");
 
-	task->status = TASK_RUNNING;
+    if (need_resched) {
+        switch_tasks();
     }
+
+    bool switched = current_task->se.nr_switches != switches;
+    irq_restore(flags);
+    return switched;
+}
+
+void sleep(void)
+{
+    task_set_state(current_task, TASK_BLOCKED);
+    schedule();
 }
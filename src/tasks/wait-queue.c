@@ -0,0 +1,130 @@
+#include "wait-queue.h"
+#include "task.h"
+#include "internal.h"
+
+#include "cpu.h"
+#include "spinlock.h"
+
+/**
+ * Queues of waiting tasks: the waiters on mutexes, semaphores and condition
+ *   variables, and wait queues. Each is guarded by its own spinlock, and a
+ *   waiter is only ever woken by whoever took it off its queue, or by a
+ *   wake_up() of its wait queue, never by a scan of every blocked task.
+ */
+
+/**
+ * Sleep until waiter is woken. Called with lock, which guards the queue
+ *   waiter is on, taken by spin_lock_irqsave(); it's dropped while we
+ *   sleep, and the flags to restore when it's released again are returned.
+ */
+uint32_t wait_woken(struct waiter *waiter, spinlock_t *lock, uint32_t flags)
+{
+    while (!waiter->woken) {
+        task_set_state(waiter->task, TASK_BLOCKED);
+        spin_unlock_irqrestore(lock, flags);
+
+        schedule();
+
+        flags = spin_lock_irqsave(lock);
+    }
+
+    return flags;
+}
+
+/**
+ * Take the longest waiting task off a queue of waiters and wake it,
+ *   returning it, or NULL if none are waiting. Called with the queue's lock
+ *   held.
+ */
+struct task *wake_first_waiter(struct list *waiters)
+{
+    if (list_empty(waiters)) {
+        return NULL;
+    }
+
+    struct waiter *waiter = LIST_ENTRY(waiters->next, struct waiter, list);
+    struct task *task = waiter->task;
+
+    list_remove(&waiter->list);
+    waiter->woken = true;
+
+    if (task->status == TASK_BLOCKED) {
+        task_set_state(task, TASK_RUNNING);
+    }
+
+    return task;
+}
+
+void wait_queue_init(struct wait_queue *wq)
+{
+    *wq = (struct wait_queue)WAIT_QUEUE_INIT(*wq);
+}
+
+/**
+ * Join a wait queue, returning with its lock taken by spin_lock_irqsave()
+ *   and the flags to restore
+ */
+uint32_t prepare_to_wait(struct wait_queue *wq, struct waiter *waiter)
+{
+    waiter->task = current_task;
+    waiter->woken = false;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    list_insert(wq->waiters.prev, &waiter->list);
+
+    return flags;
+}
+
+/**
+ * Sleep on a wait queue we've joined until it's woken, dropping its lock
+ *   meanwhile. Returns with the lock taken again, and the flags to restore.
+ */
+uint32_t wait_queue_sleep(struct wait_queue *wq, uint32_t flags)
+{
+    if (current_task) {
+        task_set_state(current_task, TASK_BLOCKED);
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    if (current_task) {
+        schedule();
+    }
+    else {
+        cpu_relax();
+    }
+
+    return spin_lock_irqsave(&wq->lock);
+}
+
+/**
+ * Leave a wait queue, releasing its lock
+ */
+void finish_wait(struct wait_queue *wq, struct waiter *waiter,
+                 uint32_t flags)
+{
+    list_remove(&waiter->list);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/**
+ * Wake every task waiting on a wait queue. They stay on it, to go back to
+ *   sleep if what they're waiting for hasn't happened.
+ */
+void wake_up(struct wait_queue *wq)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    struct list *l;
+
+    LIST_FOR_EACH(&wq->waiters, l) {
+        struct waiter *waiter = LIST_ENTRY(l, struct waiter, list);
+
+        waiter->woken = true;
+
+        if (waiter->task && waiter->task->status == TASK_BLOCKED) {
+            task_set_state(waiter->task, TASK_RUNNING);
+        }
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
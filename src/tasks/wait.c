@@ -12,24 +12,18 @@ int wait(uint32_t pid, int __user *status)
 	return -EFAULT;
     }
 
-    struct list *elem;
-    LIST_FOR_EACH(&current_task->children, elem) {
-	struct task *child = LIST_ENTRY(elem, struct task, children_list);
-
-	if (child->pid == pid) {
-	    while (child->status != TASK_FINISHED) {
-		printf("sleeping while waiting for process\n");
-		sleep();
-	    }
-	}
+    struct task *child = pid_task(pid);
+    if (!child || child->parent != current_task) {
+	return -1;
+    }
 
-	printf("child process exited, code %d\n", child->exit_code);
-	*status = child->exit_code;
+    wait_event(current_task->child_exit, child->status == TASK_FINISHED);
 
-	free_task(child);
+    printf("child process exited, code %d\n", child->exit_code);
+    *status = child->exit_code;
 
-	return pid;
-    }
+    list_remove(&child->children_list);
+    free_task(child);
 
-    return -1;
+    return pid;
 }
@@ -0,0 +1,77 @@
+#include "workqueue.h"
+#include "task.h"
+#include "internal.h"
+
+#include "compiler.h"
+#include "macros.h"
+#include "wait-queue.h"
+
+/**
+ * The workqueue: one kernel thread running work in the order it was
+ *   queued.
+ *
+ * Work is queued by pushing it onto a lock-free stack with a compare and
+ *   swap, so an interrupt handler on any CPU can queue work while another
+ *   is mid-push. The worker takes the whole stack at once with an exchange,
+ *   and reverses it to run the oldest first.
+ */
+static struct work *volatile queued; // newest first
+static DEFINE_WAIT_QUEUE(worker_wait);
+
+void work_setup(struct work *work, void (*fn)(struct work *work))
+{
+    *work = (struct work)WORK_INIT(fn);
+}
+
+/**
+ * Queue work to be run, returning false if it was already waiting to run
+ */
+bool queue_work(struct work *work)
+{
+    if (!__sync_bool_compare_and_swap(&work->pending, 0, 1)) {
+        return false;
+    }
+
+    struct work *head;
+
+    do {
+        head = queued;
+        work->next = head;
+    } while (!__sync_bool_compare_and_swap(&queued, head, work));
+
+    wake_up(&worker_wait);
+    return true;
+}
+
+static void worker(void __unused *data)
+{
+    while (true) {
+        wait_event(worker_wait, queued != NULL);
+
+        struct work *work = __sync_lock_test_and_set(&queued, NULL);
+        struct work *fifo = NULL;
+
+        while (work) {
+            struct work *next = work->next;
+
+            work->next = fifo;
+            fifo = work;
+            work = next;
+        }
+
+        while (fifo) {
+            work = fifo;
+            fifo = work->next;
+
+            __sync_lock_release(&work->pending);
+            work->fn(work);
+        }
+    }
+}
+
+void init_workqueue(void)
+{
+    if (!kthread_run(worker, NULL)) {
+        PANIC("Unable to start the workqueue thread!");
+    }
+}
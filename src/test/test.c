@@ -1,6 +1,27 @@
 #include "test.h"
 
 #include "list.h"
+#include "lzf.h"
+
+#include "condvar.h"
+#include "cpu.h"
+#include "errno.h"
+#include "fpu.h"
+#include "mutex.h"
+#include "preempt.h"
+#include "semaphore.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "task.h"
+#include "wait-queue.h"
+#include "workqueue.h"
+
+#include "device/clock.h"
+#include "device/timer.h"
+#include "memory/pmm.h"
+#include "memory/slab.h"
+#include "memory/vmalloc.h"
+#include "memory/vmm.h"
 
 struct list_test
 {
@@ -88,7 +109,383 @@ void test_list(void)
     test_multiple_element_list();
 }
 
+void test_lzf(void)
+{
+    static uint8_t in[1024];
+    static uint8_t compressed[1024];
+    static uint8_t out[1024];
+
+    for (uint32_t i = 0; i < sizeof(in); ++i) {
+        in[i] = (i % 64 < 48) ? 'a' + i % 7 : i * 13;
+    }
+
+    uint32_t len = lzf_compress(in, sizeof(in), compressed, sizeof(compressed));
+    KASSERT(len > 0 && len < sizeof(in));
+
+    KASSERT(lzf_decompress(compressed, len, out, sizeof(out)) == sizeof(in));
+    for (uint32_t i = 0; i < sizeof(in); ++i) {
+        KASSERT(out[i] == in[i]);
+    }
+
+    // Output that doesn't fit is rejected rather than overrun
+    KASSERT(lzf_compress(in, sizeof(in), compressed, 16) == 0);
+    KASSERT(lzf_decompress(compressed, len, out, 16) == 0);
+}
+
+struct slab_test
+{
+    uint32_t magic;
+    char pad[100];
+};
+
+static void slab_test_ctor(void *obj)
+{
+    ((struct slab_test *)obj)->magic = 0xCAFE;
+}
+
+void test_slab(void)
+{
+    static DEFINE_KMEM_CACHE(cache, struct slab_test, slab_test_ctor);
+    static struct slab_test *objs[100];
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        objs[i] = kmem_cache_alloc(&cache);
+        KASSERT(objs[i]);
+        KASSERT(((uint32_t)objs[i] & (SLAB_ALIGN - 1)) == 0);
+        KASSERT(objs[i]->magic == 0xCAFE);
+    }
+
+    KASSERT(cache.active == 100);
+    KASSERT(cache.nslabs > 1);
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        kmem_cache_free(&cache, objs[i]);
+    }
+
+    // Only SLAB_MAX_EMPTY empty slabs are kept once everything is freed
+    KASSERT(cache.active == 0);
+    KASSERT(cache.nslabs == SLAB_MAX_EMPTY);
+
+    struct slab_test *obj = kmem_cache_alloc(&cache);
+    KASSERT(obj->magic == 0xCAFE);
+    kmem_cache_free(&cache, obj);
+}
+
+void test_vmalloc(void)
+{
+    uint32_t *a = vmalloc(3 * PAGE_SIZE);
+    uint32_t *b = vmalloc(PAGE_SIZE);
+    KASSERT(a && b);
+    KASSERT(is_vmalloc_addr(a) && is_vmalloc_addr(b));
+
+    // Every page is mapped, and each area sits above an unmapped guard page
+    for (uint32_t i = 0; i < 3; ++i) {
+        KASSERT(get_physical((uint32_t)a + i * PAGE_SIZE));
+    }
+    KASSERT(!get_physical((uint32_t)a - PAGE_SIZE));
+    KASSERT(!get_physical((uint32_t)b - PAGE_SIZE));
+    KASSERT((uint32_t)b >= (uint32_t)a + 4 * PAGE_SIZE);
+
+    a[3 * PAGE_SIZE / sizeof(uint32_t) - 1] = 0xCAFE;
+
+    // Freeing merges areas back together, so the lowest fit is reused
+    vfree(b);
+    vfree(a);
+    KASSERT(!get_physical((uint32_t)a));
+
+    uint32_t *c = vmalloc(5 * PAGE_SIZE);
+    KASSERT(c == a);
+    vfree(c);
+}
+
+void test_clock(void)
+{
+    // A second's worth of cycles is a second, give or take rounding
+    uint64_t second = cycles_to_ns((uint64_t)tsc_khz * 1000);
+    KASSERT(second > NSEC_PER_SEC - NSEC_PER_MSEC);
+    KASSERT(second < NSEC_PER_SEC + NSEC_PER_MSEC);
+
+    // Past 2^32 cycles, where the conversion splits
+    uint64_t cycles = (uint64_t)tsc_khz * 1000 * 10;
+    uint64_t ten = cycles_to_ns(cycles);
+    KASSERT(ten > 10ULL * NSEC_PER_SEC - NSEC_PER_MSEC);
+    KASSERT(ten < 10ULL * NSEC_PER_SEC + NSEC_PER_MSEC);
+
+    struct timespec ts;
+    ns_to_timespec(10ULL * NSEC_PER_SEC + 5, &ts);
+    KASSERT(ts.tv_sec == 10 && ts.tv_nsec == 5);
+
+    uint64_t before = clock_ns();
+    KASSERT(clock_ns() >= before);
+}
+
+/* A wheel of the test's own, so it can run time on without the kernel's */
+static struct timer_base test_timers;
+static uint32_t test_now;
+
+static uint32_t timer_fired[4];
+static uint32_t timer_nfired;
+
+static void record_timer(struct timer *timer)
+{
+    KASSERT(timer->expires == test_now);
+    timer_fired[timer_nfired++] = timer->expires;
+}
+
+void test_timer_wheel(void)
+{
+    struct timer near, far, farther, cancelled;
+    uint32_t start = ticks;
+
+    timer_base_init(&test_timers, start);
+    test_now = start;
+
+    timer_setup(&near, record_timer);
+    timer_setup(&far, record_timer);
+    timer_setup(&farther, record_timer);
+    timer_setup(&cancelled, record_timer);
+
+    // One timer on each of the first three levels, added out of order
+    timer_base_add(&test_timers, &farther, start + 70000);
+    timer_base_add(&test_timers, &near, start + 3);
+    timer_base_add(&test_timers, &far, start + 300);
+    timer_base_add(&test_timers, &cancelled, start + 5);
+
+    KASSERT(timer_pending(&cancelled));
+    KASSERT(timer_cancel(&cancelled));
+    KASSERT(!timer_pending(&cancelled));
+    KASSERT(!timer_cancel(&cancelled));
+
+    KASSERT(timer_base_next_event(&test_timers, test_now) == 3);
+
+    // Time can jump, as ticks does when the tick was stopped
+    test_now += 2;
+    timer_base_run(&test_timers, test_now);
+    KASSERT(timer_nfired == 0);
+
+    while (test_now != start + 70000) {
+        ++test_now;
+        timer_base_run(&test_timers, test_now);
+    }
+
+    KASSERT(timer_nfired == 3);
+    KASSERT(timer_fired[0] == start + 3);
+    KASSERT(timer_fired[1] == start + 300);
+    KASSERT(timer_fired[2] == start + 70000);
+    KASSERT(!timer_pending(&farther));
+    KASSERT(timer_base_next_event(&test_timers, test_now) == UINT32_MAX);
+}
+
+void test_spinlock(void)
+{
+    spinlock_t lock = SPINLOCK_INIT;
+
+    KASSERT(spin_trylock(&lock));
+    KASSERT(spin_is_locked(&lock));
+    KASSERT(!spin_trylock(&lock));
+    spin_unlock(&lock);
+    KASSERT(!spin_is_locked(&lock));
+
+    // Each acquisition takes the next ticket
+    spin_lock(&lock);
+    KASSERT(lock.next == (uint16_t)(lock.owner + 1));
+    spin_unlock(&lock);
+    KASSERT(lock.owner == 2 && lock.next == 2);
+
+    // The owner count wraps along with the tickets
+    lock.owner = lock.next = 0xFFFF;
+    KASSERT(spin_trylock(&lock));
+    KASSERT(lock.next == 0);
+    spin_unlock(&lock);
+    KASSERT(!spin_is_locked(&lock));
+
+    uint32_t flags = irq_save();
+    uint32_t inner = spin_lock_irqsave(&lock);
+    KASSERT(spin_is_locked(&lock));
+    spin_unlock_irqrestore(&lock, inner);
+    KASSERT(!spin_is_locked(&lock));
+    irq_restore(flags);
+
+    mcs_lock_t mcs = MCS_LOCK_INIT;
+    struct mcs_node node;
+
+    KASSERT(!mcs_is_locked(&mcs));
+    mcs_lock(&mcs, &node);
+    KASSERT(mcs_is_locked(&mcs));
+    KASSERT(mcs.tail == &node);
+    mcs_unlock(&mcs, &node);
+    KASSERT(!mcs_is_locked(&mcs));
+
+    flags = mcs_lock_irqsave(&mcs, &node);
+    KASSERT(mcs_is_locked(&mcs));
+    mcs_unlock_irqrestore(&mcs, &node, flags);
+    KASSERT(!mcs_is_locked(&mcs));
+}
+
+/* Only what can be checked without another task to block */
+void test_sync(void)
+{
+    DEFINE_MUTEX(mutex);
+
+    KASSERT(!mutex_is_locked(&mutex));
+    KASSERT(mutex_trylock(&mutex));
+    KASSERT(mutex_is_locked(&mutex));
+    KASSERT(!mutex_trylock(&mutex));
+    mutex_unlock(&mutex);
+    KASSERT(!mutex_is_locked(&mutex));
+
+    mutex_lock(&mutex);
+    KASSERT(mutex_owner(&mutex) == current_task);
+    mutex_unlock(&mutex);
+    KASSERT(!mutex_is_locked(&mutex) && list_empty(&mutex.waiters));
+
+    DEFINE_SEMAPHORE(sem, 2);
+
+    down(&sem);
+    KASSERT(down_trylock(&sem));
+    KASSERT(!down_trylock(&sem));
+    up(&sem);
+    KASSERT(sem.count == 1);
+    KASSERT(down_trylock(&sem));
+    up(&sem);
+    up(&sem);
+    KASSERT(sem.count == 2);
+
+    DEFINE_CONDVAR(cond);
+
+    // Signals with no one waiting are lost
+    cond_signal(&cond);
+    cond_broadcast(&cond);
+    KASSERT(list_empty(&cond.waiters));
+
+    DEFINE_WAIT_QUEUE(wq);
+    int events = 1;
+
+    // Already true, so there's no need to sleep
+    wait_event(wq, events > 0);
+    KASSERT(list_empty(&wq.waiters));
+    wake_up(&wq);
+    KASSERT(!spin_is_locked(&wq.lock));
+}
+
+static void test_work_fn(struct work __unused *work)
+{
+}
+
+/* Queued before the worker starts, so it stays pending until then */
+void test_workqueue(void)
+{
+    static DEFINE_WORK(work, test_work_fn);
+
+    KASSERT(!work.pending);
+    KASSERT(queue_work(&work));
+    KASSERT(work.pending);
+    KASSERT(!queue_work(&work));
+}
+
+void test_smp(void)
+{
+    // We run on the boot CPU, which kernel_main locked the kernel on
+    KASSERT(cpu_id() == 0);
+    KASSERT(this_cpu()->lock_depth == 1);
+
+    lock_kernel();
+    lock_kernel();
+    KASSERT(this_cpu()->lock_depth == 3);
+    unlock_kernel();
+    unlock_kernel();
+    KASSERT(this_cpu()->lock_depth == 1);
+}
+
+/* A child gets its own copy of its parent's FPU state */
+void test_fpu(void)
+{
+    static struct fpu_state state = { .fcw = 0x37F, .mxcsr = 0x1F80 };
+    static struct task parent;
+    static struct task child;
+
+    KASSERT(fpu_fork(&child, &parent) == 0);
+    KASSERT(!child.fpu);
+
+    parent.fpu = &state;
+    KASSERT(fpu_fork(&child, &parent) == 0);
+    KASSERT(child.fpu && child.fpu != &state);
+    KASSERT(child.fpu->fcw == 0x37F && child.fpu->mxcsr == 0x1F80);
+
+    this_cpu()->fpu_owner = &child;
+    fpu_release(&child);
+    KASSERT(!child.fpu);
+    KASSERT(!this_cpu()->fpu_owner);
+}
+
+/*
+ * A task whose FPU state can't be allocated doesn't get the FPU, and is
+ *   killed once however often it's killed
+ */
+void test_fpu_alloc_failure(void)
+{
+    static struct task parent;
+    static struct task victim;
+
+    list_init(&victim.children);
+    wait_queue_init(&parent.child_exit);
+    victim.parent = &parent;
+
+    fpu_fail_alloc = true;
+    KASSERT(fpu_first_use(&victim) < 0);
+    KASSERT(!victim.fpu && !victim.fpu_live);
+    KASSERT(this_cpu()->fpu_owner != &victim);
+    fpu_fail_alloc = false;
+
+    task_exit(&victim, -ENOMEM);
+    KASSERT(victim.status == TASK_FINISHED);
+    KASSERT(victim.exit_code == -ENOMEM);
+
+    task_exit(&victim, -ENOMEM);
+    task_exit(&victim, -ENOSYS);
+    KASSERT(victim.exit_code == -ENOMEM);
+
+    // Off the zombie list, as wait() would take it
+    list_remove(&victim.queue);
+    victim.status = TASK_NEW;
+}
+
+/* Spinlocks hold off preemption while they're held, and only then */
+void test_preempt(void)
+{
+    spinlock_t lock = SPINLOCK_INIT;
+    uint32_t count = preempt_count();
+
+    spin_lock(&lock);
+    KASSERT(preempt_count() == count + 1);
+    KASSERT(!spin_trylock(&lock));
+    KASSERT(preempt_count() == count + 1);
+    spin_unlock(&lock);
+    KASSERT(preempt_count() == count);
+
+    KASSERT(spin_trylock(&lock));
+    KASSERT(preempt_count() == count + 1);
+    spin_unlock(&lock);
+
+    preempt_disable();
+    KASSERT(preempt_count() == count + 1);
+    preempt_enable();
+    KASSERT(preempt_count() == count);
+}
+
 void ktest(void)
 {
     test_list();
+    test_lzf();
+    test_slab();
+    test_vmalloc();
+    test_clock();
+    test_timer_wheel();
+    test_spinlock();
+    test_sync();
+    test_workqueue();
+    test_smp();
+    test_fpu();
+    test_fpu_alloc_failure();
+    test_preempt();
 }
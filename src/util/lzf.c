@@ -0,0 +1,180 @@
+#include "lzf.h"
+
+#define LZF_HLOG 12
+#define LZF_HSIZE (1 << LZF_HLOG)
+
+#define LZF_MAX_LIT 32
+#define LZF_MAX_OFF (1 << 13)
+#define LZF_MAX_REF ((1 << 8) + (1 << 3))
+
+/**
+ * Stream format:
+ *  000LLLLL <L+1 literal bytes>
+ *  LLLooooo oooooooo            back reference, length L+2 (L in 1..6)
+ *  111ooooo LLLLLLLL oooooooo   back reference, length L+9
+ *
+ * The hash table only ever holds hints - matches are always verified - so
+ *   it doesn't need clearing between calls. Callers serialize compression
+ *   (it's only used with interrupts disabled).
+ */
+static uint16_t htab[LZF_HSIZE];
+
+static inline uint32_t lzf_hash(const uint8_t *p)
+{
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((v >> (24 - LZF_HLOG)) - v * 5) & (LZF_HSIZE - 1);
+}
+
+uint32_t lzf_compress(const void *in, uint32_t in_len,
+                      void *out, uint32_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = ip + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+
+    if (in_len == 0 || out_len < 2 || in_len > 0xFFFF) {
+        return 0;
+    }
+
+    int lit = 0;
+    ++op; // reserve the control byte for the first literal run
+
+    while (ip + 2 < in_end) {
+        uint32_t h = lzf_hash(ip);
+        const uint8_t *ref = (const uint8_t *)in + htab[h];
+        htab[h] = ip - (const uint8_t *)in;
+
+        uint32_t off = ip - ref - 1;
+
+        if (ref < ip && off < LZF_MAX_OFF
+            && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2])
+        {
+            uint32_t maxlen = in_end - ip;
+            if (maxlen > LZF_MAX_REF) {
+                maxlen = LZF_MAX_REF;
+            }
+
+            uint32_t len = 3;
+            while (len < maxlen && ref[len] == ip[len]) {
+                ++len;
+            }
+
+            // close the current literal run (dropping it if it's empty)
+            if (op + 3 + 1 > out_end) {
+                return 0;
+            }
+
+            if (lit) {
+                op[-lit - 1] = lit - 1;
+            }
+            else {
+                --op;
+            }
+
+            len -= 2;
+            if (len < 7) {
+                *op++ = (off >> 8) + (len << 5);
+            }
+            else {
+                *op++ = (off >> 8) + (7 << 5);
+                *op++ = len - 7;
+            }
+            *op++ = off;
+
+            ip += len + 2;
+            lit = 0;
+            ++op;
+        }
+        else {
+            if (op >= out_end) {
+                return 0;
+            }
+
+            ++lit;
+            *op++ = *ip++;
+
+            if (lit == LZF_MAX_LIT) {
+                op[-lit - 1] = lit - 1;
+                lit = 0;
+                ++op;
+            }
+        }
+    }
+
+    while (ip < in_end) {
+        if (op >= out_end) {
+            return 0;
+        }
+
+        ++lit;
+        *op++ = *ip++;
+
+        if (lit == LZF_MAX_LIT) {
+            op[-lit - 1] = lit - 1;
+            lit = 0;
+            ++op;
+        }
+    }
+
+    if (lit) {
+        op[-lit - 1] = lit - 1;
+    }
+    else {
+        --op;
+    }
+
+    return op - (uint8_t *)out;
+}
+
+uint32_t lzf_decompress(const void *in, uint32_t in_len,
+                        void *out, uint32_t out_len)
+{
+    const uint8_t *ip = in;
+    const uint8_t *in_end = ip + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = op + out_len;
+
+    while (ip < in_end) {
+        uint32_t ctrl = *ip++;
+
+        if (ctrl < (1 << 5)) {
+            ++ctrl;
+
+            if (op + ctrl > out_end || ip + ctrl > in_end) {
+                return 0;
+            }
+
+            while (ctrl--) {
+                *op++ = *ip++;
+            }
+        }
+        else {
+            uint32_t len = ctrl >> 5;
+
+            if (len == 7) {
+                if (ip >= in_end) {
+                    return 0;
+                }
+                len += *ip++;
+            }
+
+            if (ip >= in_end) {
+                return 0;
+            }
+
+            const uint8_t *ref = op - ((ctrl & 0x1F) << 8) - 1 - *ip++;
+            len += 2;
+
+            if (op + len > out_end || ref < (uint8_t *)out) {
+                return 0;
+            }
+
+            while (len--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op - (uint8_t *)out;
+}
@@ -0,0 +1,192 @@
+/*
+ * heapbench: host-side stress test and benchmark for the kernel heap
+ *
+ * Runs the same pseudo-random allocation traces against the current TLSF
+ *   heap (src/memory/kmalloc.c) and the first-fit heap it replaced, checking
+ *   every block for corruption on free, and reports throughput along with
+ *   the most memory each heap had mapped (large blocks from vmalloc
+ *   included) against its peak live data, and how much memory it still
+ *   holds (RSS) once everything is freed.
+ */
+#include "shim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct workload {
+    const char *name;
+    uint32_t slots;
+    uint32_t ops;
+    uint32_t (*size)(void);
+};
+
+struct slot {
+    unsigned char *ptr;
+    uint32_t size;
+};
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t small_size(void)
+{
+    return 8 + rng() % 249;
+}
+
+static uint32_t mixed_size(void)
+{
+    uint32_t r = rng() % 100;
+
+    if (r < 80) {
+        return 16 + rng() % 497;
+    }
+    else if (r < 98) {
+        return 512 + rng() % 3585;
+    }
+
+    return 4096 + rng() % 28673;
+}
+
+static uint32_t page_size(void)
+{
+    return (rng() % 2) ? 4096 : 1024 + rng() % 8192;
+}
+
+static const struct workload workloads[] = {
+    { "small",  4096, 1000000, small_size },
+    { "mixed",  2048,  400000, mixed_size },
+    { "pages",   512,   50000, page_size },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(struct slot *slot, uint32_t tag)
+{
+    memset(slot->ptr, tag & 0xFF, slot->size);
+}
+
+static int check(const struct slot *slot, uint32_t tag)
+{
+    for (uint32_t i = 0; i < slot->size; ++i) {
+        if (slot->ptr[i] != (tag & 0xFF)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int run(const struct heap *heap, const struct workload *work)
+{
+    struct slot *slots = calloc(work->slots, sizeof(*slots));
+    unsigned long live = 0;
+    unsigned long peak = 0;
+    long peak_mapped = 0;
+    double elapsed = 0;
+
+    shim_pages_mapped = 0;
+    heap->init();
+    rng_state = 0x2545F491;
+
+    for (uint32_t op = 0; op < work->ops; ++op) {
+        uint32_t i = rng() % work->slots;
+        struct slot *slot = &slots[i];
+
+        if (slot->ptr) {
+            if (check(slot, i) < 0) {
+                fprintf(stderr, "%s/%s: block %u corrupted\n",
+                        heap->name, work->name, i);
+                return -1;
+            }
+
+            double start = now();
+            heap->kfree(slot->ptr);
+            elapsed += now() - start;
+
+            live -= slot->size;
+            slot->ptr = NULL;
+        }
+        else {
+            slot->size = work->size();
+
+            double start = now();
+            slot->ptr = heap->kmalloc(MEM_GEN, slot->size);
+            elapsed += now() - start;
+
+            if (!slot->ptr) {
+                fprintf(stderr, "%s/%s: out of memory\n",
+                        heap->name, work->name);
+                return -1;
+            }
+
+            fill(slot, i);
+            live += slot->size;
+            if (live > peak) {
+                peak = live;
+            }
+
+            // Pages are only mapped by allocating, so sample them here
+            if (shim_pages_mapped > peak_mapped) {
+                peak_mapped = shim_pages_mapped;
+            }
+        }
+    }
+
+    unsigned long footprint = peak_mapped * 4096UL;
+
+    for (uint32_t i = 0; i < work->slots; ++i) {
+        heap->kfree(slots[i].ptr);
+    }
+
+    // With everything freed most of a page should fit without growing,
+    //   unless free neighbours failed to coalesce
+    unsigned long top = *heap->top;
+    void *big = heap->kmalloc(MEM_GEN, 3 * 1024);
+    int coalesced = *heap->top == top;
+    heap->kfree(big);
+
+    printf("%-6s %-6s %9.1f %11.2f %10lu %10lu %6.2f %9s %8ld\n",
+           heap->name, work->name,
+           elapsed * 1e9 / work->ops,
+           work->ops / elapsed / 1e6,
+           peak / 1024, footprint / 1024,
+           (double)footprint / peak,
+           coalesced ? "yes" : "no",
+           shim_pages_mapped * 4);
+
+    free(slots);
+    return 0;
+}
+
+int main(void)
+{
+    printf("%-6s %-6s %9s %11s %10s %10s %6s %9s %8s\n",
+           "heap", "load", "ns/op", "Mops/s", "peak KiB", "mapped KiB",
+           "ratio", "coalesced", "rss KiB");
+
+    int err = 0;
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+        for (size_t h = 0; h < NHEAPS; ++h) {
+            if (run(&heaps[h], &workloads[w]) < 0) {
+                err = 1;
+            }
+        }
+    }
+
+    return err;
+}
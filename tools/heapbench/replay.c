@@ -0,0 +1,260 @@
+/*
+ * replay: run an allocation trace captured from /dev/ktrace against both
+ *   host builds of the kernel heap
+ *
+ *   ./replay trace.bin
+ *
+ * The trace is first matched up: each free is paired with the allocation
+ *   it frees, by the kernel address they share. Then it's replayed against
+ *   each heap in turn, reporting throughput, the peak of live data against
+ *   the peak of memory the heap held for it, and the same at the end of
+ *   the trace. DMA buffer records are counted but not replayed, and frees
+ *   of blocks allocated before tracing started are skipped.
+ */
+#include "shim.h"
+
+#include "memory/ktrace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NO_ALLOC 0xFFFFFFFF
+
+struct op {
+    uint32_t alloc; // index of the allocation made or freed
+    uint32_t size;  // bytes, for allocations
+    int free;
+};
+
+struct trace {
+    struct op *ops;
+    uint32_t nops;
+    uint32_t nallocs;
+    uint32_t nfrees;
+    uint32_t unmatched;
+    uint32_t dma;
+    uint32_t lost;
+    uint64_t cycles;
+};
+
+/* Live kernel addresses, mapped to the allocation that returned them */
+struct live {
+    uint32_t ptr;
+    uint32_t alloc;
+};
+
+static struct live *live;
+static uint32_t live_mask;
+
+static struct live *find_live(uint32_t ptr)
+{
+    uint32_t i = (ptr >> 3) * 2654435761U & live_mask;
+
+    while (live[i].ptr && live[i].ptr != ptr) {
+        i = (i + 1) & live_mask;
+    }
+
+    return &live[i];
+}
+
+static int load(const char *path, struct trace *trace)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint32_t nrecords = len / sizeof(struct ktrace_record);
+    struct ktrace_record *records = malloc(nrecords * sizeof(*records));
+
+    if (fread(records, sizeof(*records), nrecords, file) != nrecords) {
+        perror(path);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+
+    // Every address is inserted at most once per allocation, so with twice
+    //   as many slots as records there's always an empty one to stop at
+    uint32_t slots = 1;
+    while (slots < 2 * nrecords) {
+        slots <<= 1;
+    }
+
+    live = calloc(slots, sizeof(*live));
+    live_mask = slots - 1;
+
+    memset(trace, 0, sizeof(*trace));
+    trace->ops = calloc(nrecords, sizeof(*trace->ops));
+
+    if (nrecords) {
+        trace->cycles = records[nrecords - 1].timestamp - records[0].timestamp;
+    }
+
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        struct ktrace_record *record = &records[i];
+        struct op *op = &trace->ops[trace->nops];
+        struct live *entry;
+
+        switch (record->op) {
+        case KTRACE_ALLOC:
+            op->alloc = trace->nallocs++;
+            op->size = record->size;
+            op->free = 0;
+            ++trace->nops;
+
+            // A reused address means its free was lost: the old block
+            //   just stays allocated in the replay
+            entry = find_live(record->ptr);
+            entry->ptr = record->ptr;
+            entry->alloc = op->alloc;
+            break;
+
+        case KTRACE_FREE:
+            entry = find_live(record->ptr);
+            if (!entry->ptr || entry->alloc == NO_ALLOC) {
+                ++trace->unmatched;
+                break;
+            }
+
+            op->alloc = entry->alloc;
+            op->free = 1;
+            ++trace->nops;
+            ++trace->nfrees;
+
+            entry->alloc = NO_ALLOC;
+            break;
+
+        case KTRACE_DMA_ALLOC:
+        case KTRACE_DMA_FREE:
+            ++trace->dma;
+            break;
+
+        case KTRACE_LOST:
+            trace->lost += record->size;
+            break;
+        }
+    }
+
+    free(records);
+    free(live);
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int replay(const struct heap *heap, const struct trace *trace)
+{
+    void **blocks = calloc(trace->nallocs, sizeof(*blocks));
+    uint32_t *sizes = calloc(trace->nallocs, sizeof(*sizes));
+    unsigned long live_bytes = 0;
+    unsigned long peak_live = 0;
+    long peak_pages = 0;
+    double elapsed = 0;
+
+    shim_pages_mapped = 0;
+    heap->init();
+
+    for (uint32_t i = 0; i < trace->nops; ++i) {
+        const struct op *op = &trace->ops[i];
+
+        if (op->free) {
+            double start = now();
+            heap->kfree(blocks[op->alloc]);
+            elapsed += now() - start;
+
+            live_bytes -= sizes[op->alloc];
+            blocks[op->alloc] = NULL;
+        }
+        else {
+            double start = now();
+            void *block = heap->kmalloc(MEM_GEN, op->size);
+            elapsed += now() - start;
+
+            if (!block) {
+                fprintf(stderr, "%s: out of memory at record %u\n",
+                        heap->name, i);
+                return -1;
+            }
+
+            memset(block, 0xA5, op->size);
+            blocks[op->alloc] = block;
+            sizes[op->alloc] = op->size;
+
+            live_bytes += op->size;
+            if (live_bytes > peak_live) {
+                peak_live = live_bytes;
+            }
+        }
+
+        if (shim_pages_mapped > peak_pages) {
+            peak_pages = shim_pages_mapped;
+        }
+    }
+
+    unsigned long peak_rss = peak_pages * 4096;
+    unsigned long end_rss = shim_pages_mapped * 4096;
+
+    printf("%-6s %9.1f %11.2f %10lu %10lu %6.2f %10lu %10lu %6.2f\n",
+           heap->name,
+           trace->nops ? elapsed * 1e9 / trace->nops : 0,
+           elapsed > 0 ? trace->nops / elapsed / 1e6 : 0,
+           peak_live / 1024, peak_rss / 1024,
+           peak_live ? (double)peak_rss / peak_live : 0,
+           live_bytes / 1024, end_rss / 1024,
+           live_bytes ? (double)end_rss / live_bytes : 0);
+
+    for (uint32_t i = 0; i < trace->nallocs; ++i) {
+        heap->kfree(blocks[i]);
+    }
+
+    free(blocks);
+    free(sizes);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    struct trace trace;
+    if (load(argv[1], &trace) < 0) {
+        return 1;
+    }
+
+    printf("allocs %u, frees %u, unmatched frees %u, dma %u, lost %u, "
+           "%.1f Mcycles\n\n",
+           trace.nallocs, trace.nfrees, trace.unmatched, trace.dma,
+           trace.lost, trace.cycles / 1e6);
+
+    printf("%-6s %9s %11s %10s %10s %6s %10s %10s %6s\n",
+           "heap", "ns/op", "Mops/s", "peak KiB", "prss KiB", "ratio",
+           "end KiB", "erss KiB", "ratio");
+
+    int err = 0;
+
+    for (size_t h = 0; h < NHEAPS; ++h) {
+        if (replay(&heaps[h], &trace) < 0) {
+            err = 1;
+        }
+    }
+
+    free(trace.ops);
+    return err;
+}
@@ -0,0 +1,198 @@
+/*
+ * Stand-ins for the kernel services the heaps are built on. Each heap gets
+ *   its own arena in .bss (the binary is linked non-PIE, so it lands below
+ *   4GB where the heaps' 32-bit address arithmetic is fine). Mapping pages is
+ *   a no-op and unmapping just drops them with madvise(), but both are
+ *   counted so the benchmark can report how many pages each heap holds.
+ *
+ * Large allocations go to vmalloc, which is stood in for by a next-fit page
+ *   allocator over a range reserved at the kernel's VMALLOC_START, so the
+ *   heap's is_vmalloc_addr() check sees the same addresses it would in the
+ *   kernel.
+ */
+#include "shim.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define ARENA_SIZE (256UL << 20)
+
+char new_arena[ARENA_SIZE] __attribute__((aligned(4096)));
+char old_arena[ARENA_SIZE] __attribute__((aligned(4096)));
+
+int new_errno;
+int old_errno;
+
+long shim_pages_mapped;
+
+int kprof_enabled;
+int ktrace_enabled;
+
+const struct heap heaps[NHEAPS] = {
+    { "tlsf", new_kmalloc, new_kfree, new_init_kheap,
+      &new_kheap_top, new_arena },
+    { "first", old_kmalloc, old_kfree, old_init_kheap,
+      &old_kheap_top, old_arena },
+};
+
+#define VMALLOC_START 0xE0000000UL
+#define VMALLOC_PAGES ((256UL << 20) / 4096)
+
+static uint32_t vmalloc_runs[VMALLOC_PAGES]; // pages allocated from here
+static uint32_t vmalloc_cursor;
+static char *vmalloc_base;
+
+int alloc_page(uint32_t virtual, uint8_t readonly, uint8_t kernel)
+{
+    (void)virtual;
+    (void)readonly;
+    (void)kernel;
+
+    ++shim_pages_mapped;
+    return 0;
+}
+
+int alloc_pages(uint32_t virtual, uint8_t readonly, uint8_t kernel,
+                uint32_t num)
+{
+    (void)virtual;
+    (void)readonly;
+    (void)kernel;
+
+    shim_pages_mapped += num;
+    return 0;
+}
+
+void free_page(uint32_t virtual)
+{
+    madvise((void *)(uintptr_t)virtual, 4096, MADV_DONTNEED);
+    --shim_pages_mapped;
+}
+
+static uint32_t vmalloc_find(uint32_t pages)
+{
+    uint32_t scanned = 0;
+    uint32_t start = vmalloc_cursor;
+    uint32_t found = 0;
+
+    while (scanned < 2 * VMALLOC_PAGES) {
+        uint32_t page = (start + found) % VMALLOC_PAGES;
+        if (page < start) {
+            start = 0;
+            found = 0;
+            continue;
+        }
+
+        if (vmalloc_runs[page]) {
+            scanned += vmalloc_runs[page];
+            start = page + vmalloc_runs[page];
+            found = 0;
+            continue;
+        }
+
+        ++scanned;
+        if (++found == pages) {
+            vmalloc_cursor = start + pages;
+            return start;
+        }
+    }
+
+    return VMALLOC_PAGES;
+}
+
+void *vmalloc(uint32_t size)
+{
+    if (!vmalloc_base) {
+        vmalloc_base = mmap((void *)VMALLOC_START, VMALLOC_PAGES * 4096,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+                            | MAP_FIXED_NOREPLACE, -1, 0);
+        if (vmalloc_base != (char *)VMALLOC_START) {
+            fprintf(stderr, "unable to reserve the vmalloc range\n");
+            exit(1);
+        }
+    }
+
+    // One extra page stands in for the guard page
+    uint32_t pages = (size + 4095) / 4096 + 1;
+    uint32_t start = vmalloc_find(pages);
+    if (start == VMALLOC_PAGES) {
+        return NULL;
+    }
+
+    vmalloc_runs[start] = pages;
+    shim_pages_mapped += pages - 1;
+    return vmalloc_base + (start + 1) * 4096UL;
+}
+
+void vfree(void *address)
+{
+    uint32_t start = ((char *)address - vmalloc_base) / 4096 - 1;
+    uint32_t pages = vmalloc_runs[start];
+
+    madvise(address, (pages - 1) * 4096UL, MADV_DONTNEED);
+    shim_pages_mapped -= pages - 1;
+    vmalloc_runs[start] = 0;
+}
+
+uint32_t vmalloc_used_pages(void)
+{
+    return 0;
+}
+
+void kprof_alloc(const void *site, const void *ptr, uint32_t size)
+{
+    (void)site;
+    (void)ptr;
+    (void)size;
+}
+
+void kprof_free(const void *ptr)
+{
+    (void)ptr;
+}
+
+void ktrace_record(int op, const void *ptr, uint32_t size)
+{
+    (void)op;
+    (void)ptr;
+    (void)size;
+}
+
+int check_dma_address(uint32_t physical)
+{
+    (void)physical;
+    return 0;
+}
+
+void *kmalloc_dma(unsigned long size)
+{
+    (void)size;
+    return NULL;
+}
+
+void kfree_dma(void *address)
+{
+    (void)address;
+}
+
+uint32_t get_physical(uint32_t virtual)
+{
+    return virtual;
+}
+
+void heap_puts(const char *str)
+{
+    (void)str;
+}
+
+void heap_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
@@ -0,0 +1,36 @@
+#ifndef __HEAPBENCH_SHIM_H_
+#define __HEAPBENCH_SHIM_H_
+
+#include <stdint.h>
+
+/* Both heaps' entry points, renamed apart at compile time (see Makefile) */
+void *new_kmalloc(int type, uint32_t size);
+void new_kfree(void *address);
+void new_init_kheap(void);
+extern unsigned long new_kheap_top;
+extern char new_arena[];
+
+void *old_kmalloc(int type, uint32_t size);
+void old_kfree(void *address);
+void old_init_kheap(void);
+extern unsigned long old_kheap_top;
+extern char old_arena[];
+
+extern long shim_pages_mapped;
+
+#define MEM_GEN 0
+
+struct heap {
+    const char *name;
+    void *(*kmalloc)(int type, uint32_t size);
+    void (*kfree)(void *address);
+    void (*init)(void);
+    unsigned long *top;
+    char *arena;
+};
+
+/* The current heap first, then the old one */
+#define NHEAPS 2
+extern const struct heap heaps[NHEAPS];
+
+#endif // __HEAPBENCH_SHIM_H_
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Check symbolize.sh against a report in /dev/kprof's format: a host binary
+#   with debug info stands in for the kernel, and its functions' addresses
+#   for the call sites, printed as the kernel's %x prints them.
+
+set -e
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+cat > "$TMP/sites.c" <<'SRC'
+void kprof_site_one(void) {}
+void kprof_site_two(void) {}
+int main(void) { kprof_site_one(); kprof_site_two(); return 0; }
+SRC
+
+${CC:-cc} -g -O0 -no-pie -o "$TMP/kernel.sym" "$TMP/sites.c"
+
+# A return address just inside each function
+site() {
+    addr=$(nm "$TMP/kernel.sym" | awk -v f="$1" '$3 == f { print $1 }')
+    printf "0x%X" $((0x$addr + 2))
+}
+
+cat > "$TMP/report.txt" <<REPORT
+enabled 1
+elapsed_ticks 100
+tick_hz 100
+live_blocks 2
+dropped 0
+site live_bytes peak_bytes total_bytes allocs frees allocs_per_sec
+$(site kprof_site_one) 64 64 64 1 0 1
+$(site kprof_site_two) 32 32 32 1 0 1
+REPORT
+
+"$DIR/symbolize.sh" "$TMP/kernel.sym" < "$TMP/report.txt" > "$TMP/out.txt"
+
+grep -q "^enabled 1$" "$TMP/out.txt"
+grep -q "^site .* function location$" "$TMP/out.txt"
+grep -q " 64 64 64 1 0 1 kprof_site_one sites.c:1$" "$TMP/out.txt"
+grep -q " 32 32 32 1 0 1 kprof_site_two sites.c:2$" "$TMP/out.txt"
+
+echo "symbolize.sh ok"
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Symbolize a /dev/kprof report: append the function and source line of each
+#   call site. The symbols come from a debug build (CONFIG=dbg), e.g.
+#
+#   ./symbolize.sh ../../dbg/bin/kernel.sym < kprof.txt
+#
+# Sites are return addresses, printed by the kernel's %x as "0x" and
+#   uppercase hex, so each is looked up one byte earlier to land on the call
+#   instruction itself. Other lines are passed through.
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 kernel.sym < report" >&2
+    exit 1
+fi
+
+SYMBOLS=$1
+ADDR2LINE=${ADDR2LINE:-addr2line}
+
+while read -r site rest; do
+    case "$site" in
+        site)
+            echo "$site $rest function location"
+            ;;
+        0x*[!0-9A-Fa-f]*|0x)
+            echo "$site $rest"
+            ;;
+        0x*)
+            call=$(printf "%x" $(($site - 1)))
+            symbol=$($ADDR2LINE -f -s -e "$SYMBOLS" "$call" | paste -s -d ' ')
+            echo "$site $rest $symbol"
+            ;;
+        *)
+            echo "$site $rest"
+            ;;
+    esac
+done
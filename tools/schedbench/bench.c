@@ -0,0 +1,290 @@
+/*
+ * schedbench: host-side microbenchmark of the scheduler's task queues
+ *
+ * Builds src/tasks/queue.c, pid.c and the scheduling classes for the host
+ *   and drives them the way the kernel does, with each class (rr and fair),
+ *   against the pid-searched lists they replaced (old/queue-old.c), with a
+ *   few hundred to a few thousand tasks:
+ *
+ *   tick   switch_tasks() handing the current task back to the scheduling
+ *          class and picking the next one
+ *   wake   the current task blocking, then a random task being woken by
+ *          pid as the keyboard handler does (half the time it's blocked),
+ *          which goes through the pid hash (tasks/pid.c)
+ *
+ * Then it measures wakeup latency on a simulated timer: a probe task
+ *   sleeps, is woken at a random tick as if by an interrupt, and goes back
+ *   to sleep as soon as it runs, while every other task is a CPU hog. The
+ *   probe's longest wait from wakeup to running is reported in ticks, as a
+ *   normal task under each class and as a SCHED_FIFO task.
+ */
+// The kernel's terminal and clock functions clash with libc's
+#define puts kernel_puts
+#define putc kernel_putc
+#define timespec kernel_timespec
+#define nanosleep kernel_nanosleep
+#define clock_nanosleep kernel_clock_nanosleep
+#define clock_gettime kernel_clock_gettime
+#include "task.h"
+#include "internal.h"
+#undef puts
+#undef putc
+#undef timespec
+#undef nanosleep
+#undef clock_nanosleep
+#undef clock_gettime
+
+#include "device/timer.h"
+
+#include "old/queue-old.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct load {
+    const char *name;
+    uint32_t ops;
+};
+
+static const uint32_t sizes[] = { 100, 300, 1000, 3000 };
+
+/* Nanoseconds per timer tick on the simulated clock */
+#define TICK_NS (1000000000ULL / TIMER_HZ)
+
+#define LATENCY_WAKEUPS 100
+#define LATENCY_RT_PRIO 50
+
+uint32_t ticks;
+
+/* There's only the one CPU, so nothing to interrupt */
+void smp_send_reschedule(uint32_t __unused cpu)
+{
+}
+
+/* The scheduler runs on a simulated clock */
+static uint64_t shim_ns;
+
+uint64_t clock_ns(void)
+{
+    return shim_ns;
+}
+
+static struct task idle_task;
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void switch_tasks_new(void)
+{
+    need_resched = false;
+    sched_put_prev(current_task);
+
+    current_task = sched_pick_next();
+    if (!current_task) {
+        current_task = this_cpu()->idle;
+    }
+
+    sched_switched_in(current_task);
+}
+
+static struct task *start_tasks(const struct sched_class *class,
+                                uint32_t ntasks)
+{
+    struct task *tasks = calloc(ntasks, sizeof(*tasks));
+
+    sched = class;
+    memset(&cpus[0], 0, sizeof(cpus[0]));
+    cpus[0].idle = &idle_task;
+    list_init(&running);
+    list_init(&blocked);
+
+    for (uint32_t i = 0; i < ntasks; ++i) {
+        attach_pid(&tasks[i]);
+        tasks[i].se.weight = nice_to_weight(0);
+    }
+
+    return tasks;
+}
+
+static void stop_tasks(struct task *tasks, uint32_t ntasks)
+{
+    for (uint32_t i = 0; i < ntasks; ++i) {
+        task_set_state(&tasks[i], TASK_NEW);
+        detach_pid(&tasks[i]);
+    }
+
+    free(tasks);
+}
+
+static double run_new(const struct sched_class *class, uint32_t ntasks,
+                      uint32_t ops, int wake)
+{
+    struct task *tasks = start_tasks(class, ntasks);
+
+    for (uint32_t i = 0; i < ntasks; ++i) {
+        task_set_state(&tasks[i], TASK_RUNNING);
+    }
+
+    current_task = sched_pick_next();
+    rng_state = 0x2545F491;
+
+    double start = now();
+
+    for (uint32_t op = 0; op < ops; ++op) {
+        shim_ns += TICK_NS;
+
+        if (wake) {
+            task_set_state(current_task, TASK_BLOCKED);
+
+            struct task *task = task_find(tasks[rng() % ntasks].pid);
+            if (task && task->status == TASK_BLOCKED) {
+                task_set_state(task, TASK_RUNNING);
+            }
+
+            if (list_empty(&running)) {
+                task_set_state(&tasks[0], TASK_RUNNING);
+            }
+        }
+
+        switch_tasks_new();
+    }
+
+    double elapsed = now() - start;
+
+    stop_tasks(tasks, ntasks);
+    return elapsed * 1e9 / ops;
+}
+
+static uint32_t run_latency(const struct sched_class *class, uint32_t ntasks,
+                            int policy)
+{
+    struct task *tasks = start_tasks(class, ntasks + 1);
+    struct task *probe = &tasks[ntasks];
+
+    for (uint32_t i = 0; i < ntasks; ++i) {
+        task_set_state(&tasks[i], TASK_RUNNING);
+    }
+
+    task_set_state(probe, TASK_BLOCKED);
+    sched_setscheduler(probe->pid, policy,
+                       policy == SCHED_NORMAL ? 0 : LATENCY_RT_PRIO);
+
+    current_task = sched_pick_next();
+    rng_state = 0x2545F491;
+
+    uint32_t woken_at = 0;
+    uint32_t worst = 0;
+
+    for (uint32_t wakeups = 0; wakeups < LATENCY_WAKEUPS;) {
+        shim_ns += TICK_NS;
+        ++ticks;
+        sched_tick();
+
+        if (probe->status == TASK_BLOCKED && rng() % 4 == 0) {
+            woken_at = ticks;
+            task_set_state(probe, TASK_RUNNING);
+        }
+
+        if (need_resched) {
+            switch_tasks_new();
+        }
+
+        if (current_task == probe) {
+            if (ticks - woken_at > worst) {
+                worst = ticks - woken_at;
+            }
+
+            ++wakeups;
+            task_set_state(probe, TASK_BLOCKED);
+            switch_tasks_new();
+        }
+    }
+
+    stop_tasks(tasks, ntasks + 1);
+    return worst;
+}
+
+static double run_old(uint32_t ntasks, uint32_t ops, int wake)
+{
+    struct old_task *tasks = calloc(ntasks, sizeof(*tasks));
+
+    old_running = NULL;
+    old_blocked = NULL;
+
+    for (uint32_t i = 0; i < ntasks; ++i) {
+        tasks[i].pid = i + 1;
+        old_queue_add(&old_running, &tasks[i]);
+    }
+
+    struct old_task *current = old_running;
+    rng_state = 0x2545F491;
+
+    double start = now();
+
+    for (uint32_t op = 0; op < ops; ++op) {
+        if (wake) {
+            old_sleep(current);
+            old_wake(1 + rng() % ntasks);
+        }
+
+        current = old_switch(current);
+        if (!current) {
+            current = &tasks[0];
+            old_wake(current->pid);
+        }
+    }
+
+    double elapsed = now() - start;
+
+    free(tasks);
+    return elapsed * 1e9 / ops;
+}
+
+int main(void)
+{
+    const struct load loads[] = {
+        { "tick", 200000 },
+        { "wake", 100000 },
+    };
+
+    printf("%-6s %6s %12s %12s %12s\n",
+           "load", "tasks", "old ns/op", "rr ns/op", "fair ns/op");
+
+    for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); ++l) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            printf("%-6s %6u %12.1f %12.1f %12.1f\n",
+                   loads[l].name, sizes[s],
+                   run_old(sizes[s], loads[l].ops, l),
+                   run_new(&sched_rr, sizes[s], loads[l].ops, l),
+                   run_new(&sched_fair, sizes[s], loads[l].ops, l));
+        }
+    }
+
+    printf("\n%-6s %6s %12s %12s %12s\n",
+           "worst", "hogs", "rr ticks", "fair ticks", "fifo ticks");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        printf("%-6s %6u %12u %12u %12u\n",
+               "wakeup", sizes[s],
+               run_latency(&sched_rr, sizes[s], SCHED_NORMAL),
+               run_latency(&sched_fair, sizes[s], SCHED_NORMAL),
+               run_latency(&sched_fair, sizes[s], SCHED_FIFO));
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * The task queues as they were before tasks/queue.c: NULL-terminated lists
+ *   with no tail pointer, searched by pid
+ */
+#include "queue-old.h"
+
+#include <stddef.h>
+
+struct old_task *old_running;
+struct old_task *old_blocked;
+
+void old_queue_add(struct old_task **queue, struct old_task *task)
+{
+    if (!task) {
+        return;
+    }
+
+    struct old_task *curr = *queue;
+
+    if (!curr) {
+        *queue = task;
+        task->next = NULL;
+        task->prev = NULL;
+        return;
+    }
+
+    while (curr->next) {
+        curr = curr->next;
+    }
+
+    curr->next = task;
+    task->prev = curr;
+    task->next = NULL;
+}
+
+void old_queue_remove(struct old_task **queue, struct old_task *task)
+{
+    if (!task) {
+        return;
+    }
+
+    if (*queue == task) {
+        *queue = task->next;
+    }
+
+    if (task->prev) {
+        task->prev->next = task->next;
+    }
+
+    if (task->next) {
+        task->next->prev = task->prev;
+    }
+}
+
+struct old_task *old_queue_find(struct old_task **queue, uint32_t pid)
+{
+    for (struct old_task *task = *queue; task; task = task->next) {
+        if (task->pid == pid) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+struct old_task *old_switch(struct old_task *old)
+{
+    if (old_queue_find(&old_running, old->pid)) {
+        old_queue_remove(&old_running, old);
+        old_queue_add(&old_running, old);
+    }
+
+    return old_running;
+}
+
+void old_sleep(struct old_task *task)
+{
+    old_queue_remove(&old_running, task);
+    old_queue_add(&old_blocked, task);
+}
+
+void old_wake(uint32_t pid)
+{
+    struct old_task *task = old_queue_find(&old_blocked, pid);
+
+    if (task) {
+        old_queue_remove(&old_blocked, task);
+        old_queue_add(&old_running, task);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef __QUEUE_OLD_H_
+#define __QUEUE_OLD_H_
+
+#include <stdint.h>
+
+struct old_task {
+    uint32_t pid;
+    struct old_task *next;
+    struct old_task *prev;
+};
+
+extern struct old_task *old_running;
+extern struct old_task *old_blocked;
+
+void old_queue_add(struct old_task **queue, struct old_task *task);
+void old_queue_remove(struct old_task **queue, struct old_task *task);
+struct old_task *old_queue_find(struct old_task **queue, uint32_t pid);
+
+struct old_task *old_switch(struct old_task *old);
+void old_sleep(struct old_task *task);
+void old_wake(uint32_t pid);
+
+#endif // __QUEUE_OLD_H_
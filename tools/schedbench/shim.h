@@ -0,0 +1,50 @@
+#ifndef __SCHEDBENCH_SHIM_H_
+#define __SCHEDBENCH_SHIM_H_
+
+/*
+ * Force-included into the kernel sources built for the host: stands in for
+ *   cpu.h, whose interrupt masking would fault in user mode, and preempt.h
+ */
+#define __CPU_H_
+#define __PREEMPT_H_
+
+#include <stdint.h>
+
+#define NR_CPUS 1
+
+static inline uint32_t cpu_id(void)
+{
+    return 0;
+}
+
+static inline void cpu_relax(void)
+{
+}
+
+static inline uint32_t irq_save(void)
+{
+    return 0;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+    (void)flags;
+}
+
+static inline void preempt_disable(void)
+{
+}
+
+static inline void preempt_enable(void)
+{
+}
+
+static inline void preempt_enable_no_resched(void)
+{
+}
+
+static inline void preempt_check_resched(void)
+{
+}
+
+#endif // __SCHEDBENCH_SHIM_H_